@@ -1,5 +1,10 @@
 #include <stdexcept>
 #include <chrono>
+#include <thread>
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <ctime>
 #include <boost/filesystem.hpp>
 #include <boost/algorithm/string/join.hpp>
 #include <cityhash/src/city.h>
@@ -15,6 +20,17 @@ namespace fs = boost::filesystem;
 namespace sp = subprocess;
 namespace cr = std::chrono;
 
+/**
+ * Headers used by most of the generated code. These are precompiled at startup.
+ */
+static const std::vector<std::string> PRELUDE_HEADERS = {
+  "cstdint", "cstddef", "cstring", "cstdio", "cfloat", "string", "vector", "iterator",
+  "utility", "algorithm", "atomic", "thread", "exception", "unordered_set",
+  "util/likely.h", "util/varint.h", "util/time.h", "util/format.h", "util/bitset.h",
+  "db/segment.h", "db/store.h", "db/table.h", "db/dictionary.h",
+  "query/output.h", "query/stats.h"
+};
+
 Compiler::Compiler():Compiler(util::Config()) {}
 
 Compiler::Compiler(const util::Config& config) {
@@ -70,54 +86,382 @@ Compiler::Compiler(const util::Config& config) {
     "-o",
     ""           // This will hold the target .so file path
   };
+  // Quick tier keeps cheap optimizations only:
+  for (auto& arg : cmd_) {
+    if (arg != "-funroll-loops") {
+      quick_cmd_.push_back(arg == "-O2" ? "-O1" : arg);
+    }
+  }
+
   path_ = config.str("tmp_path", "/tmp");
+  max_parallel_ = std::max(config.num("max_parallel", std::thread::hardware_concurrency()), 1L);
+  tiered_ = config.boolean("tiered_compilation", quick_cmd_ != cmd_);
+  optimize_after_ = std::max(config.num("optimize_after", 10), 1L);
+  max_libraries_ = std::max(config.num("max_libraries", 1000), 1L);
+  max_disk_size_ = std::max(config.num("max_disk_size", 1L << 30), 0L);
+  running_ = 0;
+  background_ = 0;
+  stats_ = {};
+  headers_hash_ = 0;
+
+  if (config.boolean("precompile_headers", true)) {
+    BuildPrelude();
+  }
+}
+
+void Compiler::BuildPrelude() {
+  std::string prelude;
+  for (auto& header : PRELUDE_HEADERS) {
+    prelude += "#include <" + header + ">\n";
+  }
+
+  // Other processes may build the same prelude concurrently, so write to unique files first:
+  std::string tmp_prefix = path_ + "/viya_prelude" + fs::unique_path("_%%%%%%%%").string();
+  std::string tmp_header_file = tmp_prefix + ".h";
+  std::string tmp_pch_file = tmp_prefix + ".h.gch";
+  std::string tmp_preprocessed_file = tmp_prefix + ".ii";
+
+  std::ofstream out(tmp_header_file);
+  out<<prelude;
+  out.close();
+
+  // Keep compilation flags, but drop linker options:
+  std::vector<std::string> flags;
+  for (auto it = cmd_.begin(); it != cmd_.end() - 5; ++it) {
+    if (it->compare(0, 2, "-l") != 0 && it->compare(0, 2, "-L") != 0
+        && it->compare(0, 4, "-Wl,") != 0 && *it != "-shared") {
+      flags.push_back(*it);
+    }
+  }
+
+  // Precompiled header is only valid for the same compilation flags and headers contents:
+  std::vector<std::string> cmd(flags);
+  cmd.insert(cmd.end(), {"-E", "-P", "-x", "c++-header", tmp_header_file, "-o", tmp_preprocessed_file});
+  if (sp::Popen(cmd).wait() != 0) {
+    LOG(WARNING)<<"Can't preprocess headers, generated code will be compiled without them";
+    fs::remove(fs::path(tmp_header_file));
+    return;
+  }
+  std::ifstream in(tmp_preprocessed_file);
+  std::string key((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  in.close();
+  fs::remove(fs::path(tmp_preprocessed_file));
+  key += boost::algorithm::join(flags, " ");
+
+  // Libraries built against other headers must not be reused either:
+  headers_hash_ = CityHash64(key.c_str(), key.size());
+
+  std::string header_file = path_ + "/viya_prelude_" + std::to_string(headers_hash_) + ".h";
+  std::string pch_file = header_file + ".gch";
+
+  if (!fs::exists(pch_file)) {
+    cmd = flags;
+    cmd.insert(cmd.end(), {"-x", "c++-header", tmp_header_file, "-o", tmp_pch_file});
+
+    LOG(INFO)<<boost::algorithm::join(cmd, " ");
+    auto begin = cr::steady_clock::now();
+
+    if (sp::Popen(cmd).wait() != 0) {
+      LOG(WARNING)<<"Can't precompile headers, generated code will be compiled without them";
+      fs::remove(fs::path(tmp_header_file));
+      return;
+    }
+
+    auto end = cr::steady_clock::now();
+    LOG(INFO)<<"Headers precompilation took "<<cr::duration_cast<cr::milliseconds>(end - begin).count()
+      <<" ms"<<std::endl;
+
+    fs::rename(fs::path(tmp_header_file), fs::path(header_file));
+    fs::rename(fs::path(tmp_pch_file), fs::path(pch_file));
+  } else {
+    fs::remove(fs::path(tmp_header_file));
+  }
+
+  prelude_ = header_file;
+}
+
+Compiler::~Compiler() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  background_done_.wait(lock, [this] { return background_ == 0; });
 }
 
-std::shared_ptr<SharedLibrary> Compiler::Compile(const std::string& code) {
-  uint64_t code_hash = CityHash64(code.c_str(), code.size());
+std::shared_ptr<SharedLibrary> Compiler::Compile(const std::string& code, bool tiered) {
+  uint64_t code_hash = CityHash64WithSeed(code.c_str(), code.size(), headers_hash_);
+
+  auto promise = std::make_shared<LibraryPromise>();
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    auto library = Lookup(code_hash, code, tiered);
+    if (library) {
+      return library;
+    }
+
+    // Someone is compiling this code already, wait for the result:
+    auto flight_it = in_flight_.find(code_hash);
+    if (flight_it != in_flight_.end()) {
+      auto future = flight_it->second;
+      lock.unlock();
+      return future.get();
+    }
+    in_flight_.insert(std::make_pair(code_hash, promise->get_future().share()));
+  }
+
+  return Run(code_hash, code, tiered, *promise);
+}
+
+std::shared_ptr<SharedLibrary> Compiler::CompileAsync(const std::string& code, bool tiered) {
+  uint64_t code_hash = CityHash64WithSeed(code.c_str(), code.size(), headers_hash_);
+
+  auto promise = std::make_shared<LibraryPromise>();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
 
+    auto library = Lookup(code_hash, code, tiered);
+    if (library) {
+      return library;
+    }
+    if (in_flight_.find(code_hash) != in_flight_.end()) {
+      return nullptr;
+    }
+    in_flight_.insert(std::make_pair(code_hash, promise->get_future().share()));
+    ++background_;
+  }
+
+  std::thread([this, code_hash, code, tiered, promise] {
+    try {
+      Run(code_hash, code, tiered, *promise);
+    } catch (std::exception& e) {
+      LOG(WARNING)<<"Background compilation failed: "<<e.what();
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    --background_;
+    background_done_.notify_all();
+  }).detach();
+
+  return nullptr;
+}
+
+CompilerStats Compiler::stats() {
   std::lock_guard<std::mutex> lock(mutex_);
+  CompilerStats stats = stats_;
+  stats.libraries = libs_.size();
+  return stats;
+}
 
-  auto library = libs_[code_hash];
-  if (library == nullptr) {
+std::shared_ptr<SharedLibrary> Compiler::Lookup(uint64_t code_hash, const std::string& code, bool tiered) {
+  auto lib_it = libs_.find(code_hash);
+  if (lib_it == libs_.end()) {
+    ++stats_.misses;
+    return nullptr;
+  }
+  ++stats_.hits;
+  lru_.splice(lru_.begin(), lru_, lib_it->second.lru_it);
+  CountHit(code_hash, code, tiered);
+  return lib_it->second.library;
+}
 
-    std::string prefix = path_ + "/" + std::to_string(code_hash);
-    std::string so_file = prefix + ".so";
-    std::string tmp_so_file = prefix + "_.so";
+void Compiler::Cache(uint64_t code_hash, std::shared_ptr<SharedLibrary> library) {
+  auto lib_it = libs_.find(code_hash);
+  if (lib_it != libs_.end()) {
+    lib_it->second.library = library;
+    lru_.splice(lru_.begin(), lru_, lib_it->second.lru_it);
+    return;
+  }
+  lru_.push_front(code_hash);
+  libs_.insert(std::make_pair(code_hash, CachedLibrary {library, lru_.begin()}));
+
+  // Libraries referenced from outside are still in use, and can't be unloaded:
+  for (auto it = lru_.end(); libs_.size() > max_libraries_ && it != lru_.begin();) {
+    --it;
+    auto evicted_it = libs_.find(*it);
+    if (evicted_it->second.library.use_count() == 1) {
+      hits_.erase(*it);
+      libs_.erase(evicted_it);
+      it = lru_.erase(it);
+      ++stats_.evictions;
+    }
+  }
+}
+
+void Compiler::AcquireSlot() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  slot_released_.wait(lock, [this] { return running_ < max_parallel_; });
+  ++running_;
+}
+
+void Compiler::CountHit(uint64_t code_hash, const std::string& code, bool tiered) {
+  // Quick library is optimized right away when the code is requested as non-tiered:
+  auto hits_it = hits_.find(code_hash);
+  if (hits_it != hits_.end() && (!tiered || ++hits_it->second >= optimize_after_)) {
+    hits_.erase(hits_it);
+    Optimize(code_hash, code);
+  }
+}
+
+void Compiler::Optimize(uint64_t code_hash, const std::string& code) {
+  ++background_;
+
+  std::thread([this, code_hash, code] {
+    AcquireSlot();
+
+    std::shared_ptr<SharedLibrary> library;
+    try {
+      library = Build(code_hash, code, true);
+    } catch (std::exception& e) {
+      LOG(WARNING)<<"Optimized compilation failed, keeping the quick library: "<<e.what();
+    }
+
+    // Compiler may be destroyed as soon as background work is done, so the lock is held
+    // till the last access:
+    std::lock_guard<std::mutex> lock(mutex_);
+    --running_;
+    slot_released_.notify_one();
+    if (library) {
+      // Functions of the quick library may still be running, its users hold a reference:
+      Cache(code_hash, library);
+    }
+    --background_;
+    background_done_.notify_all();
+  }).detach();
+}
+
+std::shared_ptr<SharedLibrary> Compiler::Run(uint64_t code_hash, const std::string& code, bool tiered,
+                                             LibraryPromise& promise) {
+  AcquireSlot();
+
+  // Optimized library may be left by previous runs:
+  bool optimized = !tiered_ || !tiered || fs::exists(LibraryPath(code_hash, true));
+
+  std::shared_ptr<SharedLibrary> library;
+  std::exception_ptr error;
+  try {
+    library = Build(code_hash, code, optimized);
+  } catch (...) {
+    error = std::current_exception();
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    --running_;
+    slot_released_.notify_one();
+    in_flight_.erase(code_hash);
+    if (library) {
+      Cache(code_hash, library);
+      if (!optimized) {
+        hits_[code_hash] = 0;
+      }
+    }
+  }
+
+  if (error) {
+    promise.set_exception(error);
+    std::rethrow_exception(error);
+  }
+  promise.set_value(library);
+  return library;
+}
+
+std::string Compiler::LibraryPath(uint64_t code_hash, bool optimized) {
+  return path_ + "/" + std::to_string(code_hash) + (optimized ? "" : "_quick") + ".so";
+}
+
+std::shared_ptr<SharedLibrary> Compiler::Build(uint64_t code_hash, const std::string& code, bool optimized) {
+  std::string so_file = LibraryPath(code_hash, optimized);
+  std::string prefix = so_file.substr(0, so_file.size() - 3);
+  std::string tmp_so_file = prefix + "_.so";
+  std::vector<std::string> cmd(optimized ? cmd_ : quick_cmd_);
+  if (!prelude_.empty()) {
+    // GCC picks up the precompiled version of this header automatically:
+    cmd.insert(cmd.begin() + 1, {"-include", prelude_});
+  }
 
 #ifndef NDEBUG
-    std::string cpp_file = prefix + ".cc";
-    std::ofstream out(cpp_file);
-    out<<code.c_str();
-    out.close();
-    cmd_[cmd_.size() - 3] = cpp_file;
+  std::string cpp_file = prefix + ".cc";
+  std::ofstream out(cpp_file);
+  out<<code.c_str();
+  out.close();
+  cmd[cmd.size() - 3] = cpp_file;
 #endif
 
-    if (!fs::exists(so_file)) {
-      cmd_.back() = tmp_so_file;
+  if (!fs::exists(so_file)) {
+    cmd.back() = tmp_so_file;
 
-      LOG(INFO)<<boost::algorithm::join(cmd_, " ");
-      DLOG(INFO)<<code;
-      auto begin = cr::steady_clock::now();
+    LOG(INFO)<<boost::algorithm::join(cmd, " ");
+    DLOG(INFO)<<code;
+    auto begin = cr::steady_clock::now();
 
-      auto p = sp::Popen(cmd_, sp::input {sp::PIPE});
-      p.communicate(code.c_str(), code.size());
-      if (p.wait() != 0) {
-        throw std::runtime_error("Can't compile: " + code);
-      }
+    auto p = sp::Popen(cmd, sp::input {sp::PIPE});
+    p.communicate(code.c_str(), code.size());
+    if (p.wait() != 0) {
+      throw std::runtime_error("Can't compile: " + code);
+    }
+
+    auto end = cr::steady_clock::now();
+    LOG(INFO)<<"Compilation took "<<cr::duration_cast<cr::milliseconds>(end - begin).count()
+      <<" ms"<<std::endl;
+
+    fs::rename(fs::path(tmp_so_file), fs::path(so_file));
+
+    if (max_disk_size_ > 0) {
+      TrimDisk(so_file);
+    }
+  } else {
+    // Modification time tells which files were used recently:
+    boost::system::error_code ec;
+    fs::last_write_time(fs::path(so_file), std::time(nullptr), ec);
+  }
+
+  return std::make_shared<SharedLibrary>(so_file);
+}
 
-      auto end = cr::steady_clock::now();
-      LOG(INFO)<<"Compilation took "<<cr::duration_cast<cr::milliseconds>(end - begin).count()
-        <<" ms"<<std::endl;
+void Compiler::TrimDisk(const std::string& keep_file) {
+  std::lock_guard<std::mutex> lock(disk_mutex_);
 
-      fs::rename(fs::path(tmp_so_file), fs::path(so_file));
+  // Files may be removed concurrently by other processes, so ignore errors:
+  boost::system::error_code ec;
+  std::vector<std::pair<std::time_t, fs::path>> files;
+  uintmax_t total_size = 0;
+  for (fs::directory_iterator it(fs::path(path_), ec), end; !ec && it != end; it.increment(ec)) {
+    auto& file = it->path();
+    auto name = file.filename().string();
+    auto ext = file.extension().string();
+    // Only compiled libraries and their sources, skipping ones being written right now:
+    if ((ext != ".so" && ext != ".cc") || name.find_first_not_of("0123456789") == 0
+        || name.compare(name.size() - 4, 4, "_.so") == 0) {
+      continue;
+    }
+    auto size = fs::file_size(file, ec);
+    auto mtime = fs::last_write_time(file, ec);
+    if (!ec) {
+      total_size += size;
+      files.push_back(std::make_pair(mtime, file));
     }
+  }
+  ec.clear();
 
-    library = std::make_shared<SharedLibrary>(so_file);
-    libs_[code_hash] = library;
+  if (total_size <= max_disk_size_) {
+    return;
   }
+  std::sort(files.begin(), files.end());
 
-  return library;
+  size_t removed = 0;
+  for (auto& f : files) {
+    if (total_size <= max_disk_size_) {
+      break;
+    }
+    if (f.second.string() != keep_file) {
+      auto size = fs::file_size(f.second, ec);
+      if (fs::remove(f.second, ec)) {
+        total_size -= size;
+        ++removed;
+      }
+    }
+  }
+  LOG(INFO)<<"Removed "<<removed<<" compiled files from "<<path_;
+
+  std::lock_guard<std::mutex> stats_lock(mutex_);
+  stats_.disk_evictions += removed;
 }
 
 }}
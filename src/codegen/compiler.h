@@ -2,8 +2,11 @@
 #define VIYA_CODEGEN_COMPILER_H_
 
 #include <unordered_map>
+#include <list>
 #include <memory>
 #include <mutex>
+#include <future>
+#include <condition_variable>
 #include "util/config.h"
 #include "codegen/shared_library.h"
 
@@ -12,20 +15,96 @@ namespace codegen {
 
 namespace util = viya::util;
 
+struct CompilerStats {
+  size_t libraries;      // libraries currently in cache
+  size_t hits;           // requests served from cache
+  size_t misses;         // requests which had to compile a library, or load it from disk
+  size_t evictions;      // libraries evicted from cache
+  size_t disk_evictions; // library files removed from disk
+};
+
+/**
+ * Compiles generated code into shared libraries, and caches them by code hash.
+ * Compilation runs outside of the cache lock: concurrent requests for the same code wait
+ * for a single compilation, while different code is compiled in parallel (up to a limit).
+ *
+ * Headers common to all generated code are precompiled once, and are force-included
+ * into every compilation unit, so that only the generated code itself needs to be parsed.
+ *
+ * When tiered compilation is enabled, new code requested as tiered (query code) is first
+ * compiled with cheap optimizations. Once the library is requested enough times, it's rebuilt
+ * with full optimizations in background, and the optimized library replaces the quick one in
+ * cache. Other code (table code, which is compiled once) is always fully optimized.
+ *
+ * The cache is bounded: least recently used libraries are unloaded, unless someone still
+ * holds a reference to them. Library files are removed from disk in the same manner
+ * when their total size exceeds the quota.
+ */
 class Compiler {
   public:
     Compiler();
     Compiler(const util::Config& config);
-    std::shared_ptr<SharedLibrary> Compile(const std::string& code);
+    ~Compiler();
+
+    std::shared_ptr<SharedLibrary> Compile(const std::string& code, bool tiered = false);
+
+    /**
+     * Returns the library if the code was compiled already, otherwise starts compiling it
+     * in background (unless it's being compiled already), and returns nullptr
+     */
+    std::shared_ptr<SharedLibrary> CompileAsync(const std::string& code, bool tiered = false);
+
+    CompilerStats stats();
+
+    /**
+     * Maximal number of libraries compiled in parallel
+     */
+    size_t max_parallel() const { return max_parallel_; }
 
   private:
+    using LibraryPromise = std::promise<std::shared_ptr<SharedLibrary>>;
+    using LibraryFuture = std::shared_future<std::shared_ptr<SharedLibrary>>;
+
+    struct CachedLibrary {
+      std::shared_ptr<SharedLibrary> library;
+      std::list<uint64_t>::iterator lru_it;
+    };
+
+    std::shared_ptr<SharedLibrary> Lookup(uint64_t code_hash, const std::string& code, bool tiered);
+    void Cache(uint64_t code_hash, std::shared_ptr<SharedLibrary> library);
+    std::shared_ptr<SharedLibrary> Run(uint64_t code_hash, const std::string& code, bool tiered,
+                                       LibraryPromise& promise);
+    void AcquireSlot();
+    void CountHit(uint64_t code_hash, const std::string& code, bool tiered);
+    void Optimize(uint64_t code_hash, const std::string& code);
+    void BuildPrelude();
+    std::string LibraryPath(uint64_t code_hash, bool optimized);
+    std::shared_ptr<SharedLibrary> Build(uint64_t code_hash, const std::string& code, bool optimized);
+    void TrimDisk(const std::string& keep_file);
     std::vector<std::string> GetFunctionNames(const std::string& lib_file);
 
   private:
     std::vector<std::string> cmd_;
+    std::vector<std::string> quick_cmd_;
     std::string path_;
+    std::string prelude_;
+    uint64_t headers_hash_;
+    size_t max_parallel_;
+    bool tiered_;
+    size_t optimize_after_;
+    size_t max_libraries_;
+    uintmax_t max_disk_size_;
+    size_t running_;
+    size_t background_;
     std::mutex mutex_;
-    std::unordered_map<uint64_t,std::shared_ptr<SharedLibrary>> libs_;
+    std::mutex disk_mutex_;
+    std::condition_variable slot_released_;
+    std::condition_variable background_done_;
+    std::unordered_map<uint64_t,CachedLibrary> libs_;
+    std::list<uint64_t> lru_; // most recently used libraries first
+    std::unordered_map<uint64_t,LibraryFuture> in_flight_;
+    std::unordered_map<uint64_t,size_t> hits_; // hits of quick libraries, which weren't optimized yet
+    CompilerStats stats_;
 };
 
 }}
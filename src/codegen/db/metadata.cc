@@ -25,6 +25,9 @@ Code TableMetadata::GenerateCode() const {
 
   // Segments metadata
   code<<" unsigned long records = 0L;\n";
+  if (!table_.star_tree().empty()) {
+    code<<" unsigned long star_tree_segments = 0L, star_tree_memory_size = 0L;\n";
+  }
   code<<" meta[\"segments\"] = json::array();\n";
   code<<" for (auto* s : table.store()->segments_copy()) {\n";
   code<<"  auto segment = static_cast<Segment*>(s);\n";
@@ -38,9 +41,21 @@ Code TableMetadata::GenerateCode() const {
       code<<"  segment_meta[\""<<dim->name()<<"\"][\"min\"] = segment->stats.dmin"<<dim_idx<<";\n";
     }
   }
+  if (!table_.star_tree().empty()) {
+    code<<"  auto star_tree = std::static_pointer_cast<const SegmentStarTree>(s->star_tree());\n";
+    code<<"  if (star_tree) {\n";
+    code<<"   segment_meta[\"star_tree\"][\"memory_size\"] = star_tree->memory_size();\n";
+    code<<"   ++star_tree_segments;\n";
+    code<<"   star_tree_memory_size += star_tree->memory_size();\n";
+    code<<"  }\n";
+  }
   code<<"  meta[\"segments\"].push_back(segment_meta);\n"; 
   code<<" }\n";
   code<<" meta[\"records_num\"] = records;\n";
+  if (!table_.star_tree().empty()) {
+    code<<" meta[\"star_tree\"][\"segments\"] = star_tree_segments;\n";
+    code<<" meta[\"star_tree\"][\"memory_size\"] = star_tree_memory_size;\n";
+  }
 
   // Dimensions metadata
   code<<" meta[\"dimensions\"] = json::array();\n";
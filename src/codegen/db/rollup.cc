@@ -9,7 +9,6 @@ namespace db = viya::db;
 Code RollupDefs::GenerateCode() const {
   Code code;
   code.AddHeaders({"util/time.h"});
-  code<<" namespace util = viya::util;\n";
   for (auto dimension : dimensions_) {
     if (dimension->dim_type() == db::Dimension::DimType::TIME) {
       auto dim_idx = std::to_string(dimension->index());
@@ -10,7 +10,17 @@ namespace db = viya::db;
 
 Code DimensionsStruct::GenerateCode() const {
   Code code;
-  code.AddHeaders({"cstdio"});
+  code.AddHeaders({"cstdio", "cstring"});
+
+  // When the fields fit into one or two machine words, the key is compared and hashed
+  // as a single integer. The integer is built from the fields rather than from the struct
+  // memory, so the struct itself keeps its layout (it's also used for segment storage):
+  size_t key_size = 0;
+  for (auto* dim : dimensions_) {
+    key_size += dim->num_type().size();
+  }
+  size_t packed_size = key_size <= 8 ? 8 : key_size <= 16 ? 16 : 0;
+  std::string packed_type = packed_size == 8 ? "uint64_t" : "unsigned __int128";
 
   code<<"struct "<<struct_name_<<" {\n";
 
@@ -21,14 +31,31 @@ Code DimensionsStruct::GenerateCode() const {
     last_dim = dim;
   }
 
-  // Equality operator:
-  code<<" bool operator==(const "<<struct_name_<<" &other) const {\n";
-  code<<"  return \n";
-  for (auto* dim : dimensions_) {
-    auto dim_idx = std::to_string(dim->index());
-    code<<"   _"<<dim_idx<<"==other._"<<dim_idx<<(dim == last_dim ? ";" : " &&")<<"\n";
+  if (packed_size > 0) {
+    code<<" "<<packed_type<<" Pack() const {\n";
+    code<<"  "<<packed_type<<" packed = 0;\n";
+    size_t offset = 0;
+    for (auto* dim : dimensions_) {
+      code<<"  std::memcpy(reinterpret_cast<char*>(&packed) + "<<std::to_string(offset)
+        <<", &_"<<std::to_string(dim->index())<<", "<<std::to_string(dim->num_type().size())<<");\n";
+      offset += dim->num_type().size();
+    }
+    code<<"  return packed;\n";
+    code<<" }\n";
+
+    code<<" bool operator==(const "<<struct_name_<<" &other) const {\n";
+    code<<"  return Pack() == other.Pack();\n";
+    code<<" }\n";
+  } else {
+    // Equality operator:
+    code<<" bool operator==(const "<<struct_name_<<" &other) const {\n";
+    code<<"  return \n";
+    for (auto* dim : dimensions_) {
+      auto dim_idx = std::to_string(dim->index());
+      code<<"   _"<<dim_idx<<"==other._"<<dim_idx<<(dim == last_dim ? ";" : " &&")<<"\n";
+    }
+    code<<" }\n";
   }
-  code<<" }\n";
 
 #if ENABLE_PERSISTENCE
   // Save function:
@@ -55,11 +82,22 @@ Code DimensionsStruct::GenerateCode() const {
   // Hash generator functor:
   code<<"struct "<<struct_name_<<"Hasher {\n";
   code<<" std::size_t operator()(const "<<struct_name_<<"& k) const {\n";
-  code<<"  size_t h = 0L;\n";
-  for (auto* dim : dimensions_) {
-    code<<"  h ^= k._"<<std::to_string(dim->index())<<" + 0x9e3779b9 + (h<<6) + (h>>2);\n";
+  if (packed_size == 8) {
+    // Multiply-shift hashing of the packed key:
+    code<<"  uint64_t h = k.Pack() * 0x9e3779b97f4a7c15ULL;\n";
+    code<<"  return h ^ (h >> 32);\n";
+  } else if (packed_size == 16) {
+    code<<"  unsigned __int128 packed = k.Pack();\n";
+    code<<"  uint64_t h = (uint64_t) packed * 0x9e3779b97f4a7c15ULL\n";
+    code<<"    ^ (uint64_t) (packed >> 64) * 0xc2b2ae3d27d4eb4fULL;\n";
+    code<<"  return h ^ (h >> 32);\n";
+  } else {
+    code<<"  size_t h = 0L;\n";
+    for (auto* dim : dimensions_) {
+      code<<"  h ^= k._"<<std::to_string(dim->index())<<" + 0x9e3779b9 + (h<<6) + (h>>2);\n";
+    }
+    code<<"  return h;\n";
   }
-  code<<"  return h;\n";
   code<<" }\n};\n";
 
   return code;
@@ -100,6 +138,9 @@ Code MetricsStruct::GenerateCode() const {
       }
     }
     code<<";\n";
+    if (squares_ && metric->additive()) {
+      code<<" double _"<<metric_idx<<"_sq = 0;\n";
+    }
   }
 
   // Aggregate function:
@@ -125,7 +166,21 @@ Code MetricsStruct::GenerateCode() const {
         throw std::runtime_error("Unsupported metric aggregation type!");
     }
     code<<";\n";
+    if (squares_ && metric->additive()) {
+      code<<"  _"<<metric_idx<<"_sq += metrics._"<<metric_idx<<"_sq;\n";
+    }
+  }
+  code<<" }\n";
+
+  // Memory allocated by bitsets:
+  code<<" size_t heap_size() const {\n";
+  code<<"  return 0";
+  for (auto* metric : metrics_) {
+    if (metric->agg_type() == db::Metric::AggregationType::BITSET) {
+      code<<" + _"<<std::to_string(metric->index())<<".heap_size()";
+    }
   }
+  code<<";\n";
   code<<" }\n";
 
 #if ENABLE_PERSISTENCE
@@ -185,6 +240,35 @@ Code SegmentStatsStruct::GenerateCode() const {
   return code;
 }
 
+Code StarTreeStruct::GenerateCode() const {
+  Code code;
+  code.AddHeaders({"db/star_tree.h"});
+  auto& dims = table_.star_tree().dimensions();
+
+  code<<"struct StarTreeDims {\n";
+  code<<" static const size_t levels = "<<std::to_string(dims.size())<<";\n";
+  code<<" static uint64_t Get(const Dimensions& dims, size_t level) {\n";
+  code<<"  switch (level) {\n";
+  for (size_t level = 0; level < dims.size(); ++level) {
+    code<<"   case "<<std::to_string(level)<<": return dims._"<<std::to_string(dims[level]->index())<<";\n";
+  }
+  code<<"  }\n";
+  code<<"  return 0;\n";
+  code<<" }\n";
+  code<<" static void Set(Dimensions& dims, size_t level, uint64_t value) {\n";
+  code<<"  switch (level) {\n";
+  for (size_t level = 0; level < dims.size(); ++level) {
+    auto dim = dims[level];
+    code<<"   case "<<std::to_string(level)<<": dims._"<<std::to_string(dim->index())
+      <<" = ("<<dim->num_type().cpp_type()<<") value; break;\n";
+  }
+  code<<"  }\n";
+  code<<" }\n";
+  code<<"};\n";
+  code<<"typedef db::StarTree<Dimensions, Metrics, StarTreeDims> SegmentStarTree;\n";
+  return code;
+}
+
 Code StoreDefs::GenerateCode() const {
   Code code;
   code.AddHeaders({"db/segment.h"});
@@ -199,6 +283,11 @@ Code StoreDefs::GenerateCode() const {
   SegmentStatsStruct stats_struct(table_);
   code<<stats_struct.GenerateCode();
 
+  if (!table_.star_tree().empty()) {
+    StarTreeStruct star_tree_struct(table_);
+    code<<star_tree_struct.GenerateCode();
+  }
+
   auto size = std::to_string(table_.segment_size());
   code<<"class Segment: public db::SegmentBase {\n";
   code<<"public:\n";
@@ -206,6 +295,8 @@ Code StoreDefs::GenerateCode() const {
   code<<" Metrics m["<<size<<"];\n";
   code<<" SegmentStats stats;\n";
   code<<" Segment():SegmentBase("<<size<<") {}\n";
+  code<<" const char* dims_data() const { return reinterpret_cast<const char*>(d); }\n";
+  code<<" const char* metrics_data() const { return reinterpret_cast<const char*>(m); }\n";
 
   code<<" void insert(Dimensions& dims, Metrics& metrics) {\n";
   code<<"  lock_.lock();\n";
@@ -243,6 +334,29 @@ Code CreateSegment::GenerateCode() const {
   code<<"extern \"C\" db::SegmentBase* viya_segment_create() {\n";
   code<<" return new Segment();\n";
   code<<"}\n";
+
+  // Describe tuple structures for code that doesn't know them:
+  code<<"extern \"C\" void viya_segment_layout(db::SegmentLayout& layout) __attribute__((__visibility__(\"default\")));\n";
+  code<<"extern \"C\" void viya_segment_layout(db::SegmentLayout& layout) {\n";
+  code<<" Dimensions dims;\n";
+  code<<" Metrics metrics;\n";
+  code<<" const char* dims_ptr = reinterpret_cast<const char*>(&dims);\n";
+  code<<" const char* metrics_ptr = reinterpret_cast<const char*>(&metrics);\n";
+  code<<" layout.dims_size = sizeof(Dimensions);\n";
+  code<<" layout.metrics_size = sizeof(Metrics);\n";
+  code<<" layout.dim_offsets.resize("<<std::to_string(table_.dimensions().size())<<");\n";
+  for (auto* dim : table_.dimensions()) {
+    auto dim_idx = std::to_string(dim->index());
+    code<<" layout.dim_offsets["<<dim_idx<<"] = reinterpret_cast<const char*>(&dims._"<<dim_idx
+      <<") - dims_ptr;\n";
+  }
+  code<<" layout.metric_offsets.resize("<<std::to_string(table_.metrics().size())<<");\n";
+  for (auto* metric : table_.metrics()) {
+    auto metric_idx = std::to_string(metric->index());
+    code<<" layout.metric_offsets["<<metric_idx<<"] = reinterpret_cast<const char*>(&metrics._"<<metric_idx
+      <<") - metrics_ptr;\n";
+  }
+  code<<"}\n";
   return code;
 }
 
@@ -250,5 +364,9 @@ db::CreateSegmentFn CreateSegment::Function() {
   return GenerateFunction<db::CreateSegmentFn>(std::string("viya_segment_create"));
 }
 
+db::SegmentLayoutFn CreateSegment::LayoutFunction() {
+  return GenerateFunction<db::SegmentLayoutFn>(std::string("viya_segment_layout"));
+}
+
 }}
 
@@ -37,10 +37,14 @@ class DimensionsStruct: public CodeGenerator {
     std::string struct_name_;
 };
 
+/**
+ * When squares are requested, sums of squared values are kept along with sums and counts
+ * (see SampledAggregation)
+ */
 class MetricsStruct: public CodeGenerator {
   public:
-    MetricsStruct(const std::vector<const db::Metric*>& metrics, std::string struct_name):
-      metrics_(metrics),struct_name_(struct_name) {}
+    MetricsStruct(const std::vector<const db::Metric*>& metrics, std::string struct_name, bool squares = false):
+      metrics_(metrics),struct_name_(struct_name),squares_(squares) {}
 
     MetricsStruct(const MetricsStruct& other) = delete;
 
@@ -49,6 +53,7 @@ class MetricsStruct: public CodeGenerator {
   private:
     const std::vector<const db::Metric*>& metrics_;
     std::string struct_name_;
+    bool squares_;
 };
 
 class SegmentStatsStruct: public CodeGenerator {
@@ -62,6 +67,20 @@ class SegmentStatsStruct: public CodeGenerator {
     const db::Table& table_;
 };
 
+/**
+ * Accessor of indexed dimensions by their star-tree level, and the star-tree type itself
+ */
+class StarTreeStruct: public CodeGenerator {
+  public:
+    StarTreeStruct(const db::Table& table):table_(table) {}
+    StarTreeStruct(const StarTreeStruct& other) = delete;
+
+    Code GenerateCode() const;
+
+  private:
+    const db::Table& table_;
+};
+
 class StoreDefs: public CodeGenerator {
   public:
     StoreDefs(const db::Table& table):table_(table) {}
@@ -83,6 +102,7 @@ class CreateSegment: public FunctionGenerator {
 
     Code GenerateCode() const;
     db::CreateSegmentFn Function();
+    db::SegmentLayoutFn LayoutFunction();
 
   private:
     const db::Table& table_;
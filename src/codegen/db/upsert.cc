@@ -9,9 +9,8 @@ namespace codegen {
 
 namespace db = viya::db;
 
-void ValueParser::Visit(const db::StrDimension* dimension) {
+void ValueParser::DictionaryLookup(const db::StrDimension* dimension) {
   auto dim_idx = std::to_string(dimension->index());
-  code_<<" auto& value = values["<<value_idx_++<<"];\n";
 
   auto max_length = dimension->length();
   if (max_length != -1) {
@@ -45,6 +44,26 @@ void ValueParser::Visit(const db::StrDimension* dimension) {
   code_<<" }\n";
 }
 
+void ValueParser::TimeRollup(const db::TimeDimension* dimension) {
+  if (!dimension->rollup_rules().empty() || !dimension->granularity().empty()) {
+    auto dim_idx = std::to_string(dimension->index());
+    code_<<" time"<<dim_idx<<".set_ts(upsert_dims._"<<dim_idx<<");\n";
+    if (!dimension->rollup_rules().empty()) {
+      TimestampRollup ts_rollup(dimension, "upsert_dims._" + dim_idx);
+      code_<<ts_rollup.GenerateCode();
+    } else {
+      code_<<"time"<<dim_idx<<".trunc<static_cast<util::TimeUnit>("
+        <<static_cast<int>(dimension->granularity().time_unit())<<")>();\n";
+    }
+    code_<<" upsert_dims._"<<dim_idx<<" = time"<<dim_idx<<".get_ts();\n";
+  }
+}
+
+void ValueParser::Visit(const db::StrDimension* dimension) {
+  code_<<" auto& value = values["<<value_idx_++<<"];\n";
+  DictionaryLookup(dimension);
+}
+
 void ValueParser::Visit(const db::NumDimension* dimension) {
   code_<<" upsert_dims._"<<std::to_string(dimension->index())
     <<" = "<<dimension->num_type().cpp_parse_fn()<<"(values["<<value_idx_++<<"]);\n";
@@ -77,26 +96,18 @@ void ValueParser::Visit(const db::TimeDimension* dimension) {
     }
     code_<<"  upsert_dims._"<<dim_idx<<" = ts_val;\n";
     code_<<" }\n";
-    if (!dimension->rollup_rules().empty() || !dimension->granularity().empty()) {
-      code_<<" time"<<dim_idx<<".set_ts(upsert_dims._"<<dim_idx<<");\n";
-    }
+    TimeRollup(dimension);
   } else {
     code_<<" time"<<dim_idx<<".parse(\""<<format<<"\", values["<<value_idx_<<"]);\n";
     if (!dimension->rollup_rules().empty()) {
       code_<<" upsert_dims._"<<dim_idx<<" = time"<<dim_idx<<".get_ts();\n";
+      TimestampRollup ts_rollup(dimension, "upsert_dims._" + dim_idx);
+      code_<<ts_rollup.GenerateCode();
+    }
+    else if (!dimension->granularity().empty()) {
+      code_<<"time"<<dim_idx<<".trunc<static_cast<util::TimeUnit>("
+        <<static_cast<int>(dimension->granularity().time_unit())<<")>();\n";
     }
-  }
-
-  if (!dimension->rollup_rules().empty()) {
-    TimestampRollup ts_rollup(dimension, "upsert_dims._" + dim_idx);
-    code_<<ts_rollup.GenerateCode();
-  }
-  else if (!dimension->granularity().empty()) {
-    code_<<"time"<<dim_idx<<".trunc<static_cast<util::TimeUnit>("
-      <<static_cast<int>(dimension->granularity().time_unit())<<")>();\n";
-  }
-
-  if (!is_num_input || !dimension->rollup_rules().empty() || !dimension->granularity().empty()) {
     code_<<" upsert_dims._"<<dim_idx<<" = time"<<dim_idx<<".get_ts();\n";
   }
 
@@ -126,11 +137,57 @@ void ValueParser::Visit(const db::BitsetMetric* metric) {
   code_<<" upsert_metrics._"<<metric_idx<<".add(metric_val"<<metric_idx<<");\n";
 }
 
+void BinaryValueParser::Visit(const db::StrDimension* dimension) {
+  code_<<" auto& value = str_value;\n";
+  code_<<" {\n";
+  code_<<"  const char* p = fields["<<value_idx_++<<"];\n";
+  code_<<"  auto length = viya::util::read_varint(p);\n";
+  code_<<"  value.assign(p, length);\n";
+  code_<<" }\n";
+  DictionaryLookup(dimension);
+}
+
+void BinaryValueParser::Visit(const db::NumDimension* dimension) {
+  code_<<" std::memcpy(&upsert_dims._"<<std::to_string(dimension->index())<<", fields["<<value_idx_++<<"], "
+    <<std::to_string(dimension->num_type().size())<<");\n";
+}
+
+void BinaryValueParser::Visit(const db::TimeDimension* dimension) {
+  // Timestamps are always stored in the dimension precision (seconds or microseconds):
+  code_<<" std::memcpy(&upsert_dims._"<<std::to_string(dimension->index())<<", fields["<<value_idx_++<<"], "
+    <<std::to_string(dimension->num_type().size())<<");\n";
+  TimeRollup(dimension);
+}
+
+void BinaryValueParser::Visit(const db::BoolDimension* dimension) {
+  code_<<" upsert_dims._"<<std::to_string(dimension->index())
+    <<" = *fields["<<value_idx_++<<"] != 0;\n";
+}
+
+void BinaryValueParser::Visit(const db::ValueMetric* metric) {
+  auto metric_idx = std::to_string(metric->index());
+  if (metric->agg_type() == db::Metric::AggregationType::COUNT) {
+    code_<<" upsert_metrics._"<<metric_idx<<" = 1;\n";
+  } else {
+    code_<<" std::memcpy(&upsert_metrics._"<<metric_idx<<", fields["<<value_idx_++<<"], "
+      <<std::to_string(metric->num_type().size())<<");\n";
+  }
+}
+
+void BinaryValueParser::Visit(const db::BitsetMetric* metric) {
+  auto metric_idx = std::to_string(metric->index());
+  code_<<" "<<metric->num_type().cpp_type()<<" metric_val"<<metric_idx<<";\n";
+  code_<<" std::memcpy(&metric_val"<<metric_idx<<", fields["<<value_idx_++<<"], "
+    <<std::to_string(metric->num_type().size())<<");\n";
+  code_<<" upsert_metrics._"<<metric_idx<<".add(metric_val"<<metric_idx<<");\n";
+}
+
 Code UpsertGenerator::SetupFunctionCode() const {
   Code code;
   auto& cardinality_guards = table_.cardinality_guards();
 
-  code.AddHeaders({"vector", "string", "util/likely.h", "db/store.h", "db/table.h", "db/dictionary.h"});
+  code.AddHeaders({"vector", "string", "cstring", "util/likely.h", "util/varint.h",
+                   "db/store.h", "db/table.h", "db/dictionary.h"});
   if (!cardinality_guards.empty()) {
     code.AddHeaders({"util/bitset.h"});
   }
@@ -141,12 +198,21 @@ Code UpsertGenerator::SetupFunctionCode() const {
 
   StoreDefs store_defs(table_);
   code<<store_defs.GenerateCode();
+  code<<"namespace util = viya::util;\n";
 
-  code<<"static db::Table* table;\n";
-  code<<"static db::UpsertStats stats;\n";
-  code<<"static Dimensions upsert_dims;\n";
-  code<<"static Metrics upsert_metrics;\n";
-  code<<"static std::unordered_map<Dimensions,size_t,DimensionsHasher> tuple_offsets;\n";
+  for (auto& guard : cardinality_guards) {
+    DimensionsStruct card_key_struct(guard.dimensions(), "CardDimKey" + std::to_string(guard.dim()->index()));
+    code<<card_key_struct.GenerateCode();
+  }
+
+  // Upsert state is kept per table, so tables having the same schema can share the code:
+  code<<"struct UpsertContext {\n";
+  code<<"db::Table* table;\n";
+  code<<"db::UpsertStats stats;\n";
+  code<<"Dimensions upsert_dims;\n";
+  code<<"Metrics upsert_metrics;\n";
+  code<<"std::string str_value;\n";
+  code<<"std::unordered_map<Dimensions,size_t,DimensionsHasher> tuple_offsets;\n";
   if (add_optimize) {
     code<<"uint32_t updates_before_optimize = 1000000L;\n";
   }
@@ -159,11 +225,9 @@ Code UpsertGenerator::SetupFunctionCode() const {
   for (auto& guard : cardinality_guards) {
     auto dim_idx = std::to_string(guard.dim()->index());
     std::string struct_name = "CardDimKey" + dim_idx;
-    DimensionsStruct card_key_struct(guard.dimensions(), struct_name);
-    code<<card_key_struct.GenerateCode();
-    code<<"static "<<struct_name<<" card_dim_key"<<dim_idx<<";\n";
+    code<<struct_name<<" card_dim_key"<<dim_idx<<";\n";
 
-    code<<"static std::unordered_map<"<<struct_name<<","
+    code<<"std::unordered_map<"<<struct_name<<","
       <<"Bitset<"<<std::to_string(guard.dim()->num_type().size())<<">"
       <<","<<struct_name<<"Hasher> card_stats"<<dim_idx<<";\n";
   }
@@ -171,8 +235,8 @@ Code UpsertGenerator::SetupFunctionCode() const {
   for (auto* dimension : table_.dimensions()) {
     auto dim_idx = std::to_string(dimension->index());
     if (dimension->dim_type() == db::Dimension::DimType::STRING) {
-      code<<"static db::DimensionDict* dict"<<dim_idx<<";\n";
-      code<<"static db::DictImpl<"<<dimension->num_type().cpp_type()<<">* v2c"<<dim_idx<<";\n";
+      code<<"db::DimensionDict* dict"<<dim_idx<<";\n";
+      code<<"db::DictImpl<"<<dimension->num_type().cpp_type()<<">* v2c"<<dim_idx<<";\n";
     }
   }
 
@@ -184,22 +248,9 @@ Code UpsertGenerator::SetupFunctionCode() const {
   }
 
   code<<OptimizeFunctionCode();
+  code<<BuildStarTreesCode();
 
-  code<<"extern \"C\" void viya_upsert_setup(db::Table& t) __attribute__((__visibility__(\"default\")));\n";
-  code<<"extern \"C\" void viya_upsert_setup(db::Table& t) {\n";
-  code<<" table = &t;\n";
-  for (auto* dimension : table_.dimensions()) {
-    if (dimension->dim_type() == db::Dimension::DimType::STRING) {
-      auto dim_idx = std::to_string(dimension->index());
-      code<<" dict"<<dim_idx<<" = static_cast<const db::StrDimension*>(table->dimension("<<dim_idx<<"))->dict();\n";
-      code<<" v2c"<<dim_idx<<" = reinterpret_cast<db::DictImpl<"<<dimension->num_type().cpp_type()
-        <<">*>(dict"<<dim_idx<<"->v2c());\n";
-    }
-  }
-  code<<"}\n";
-
-  code<<"extern \"C\" void viya_upsert_before() __attribute__((__visibility__(\"default\")));\n";
-  code<<"extern \"C\" void viya_upsert_before() {\n";
+  code<<"void Before() {\n";
   code<<" stats = db::UpsertStats();\n";
   if (has_time_dim) {
     RollupReset rollup_reset(table_.dimensions());
@@ -207,9 +258,8 @@ Code UpsertGenerator::SetupFunctionCode() const {
   }
   code<<"}\n";
 
-  code<<"extern \"C\" db::UpsertStats viya_upsert_after() __attribute__((__visibility__(\"default\")));\n";
-  code<<"extern \"C\" db::UpsertStats viya_upsert_after() {\n";
-  code<<" viya_upsert_optimize();\n";
+  code<<"db::UpsertStats After() {\n";
+  code<<" Optimize();\n";
   code<<" return stats;\n";
   code<<"}\n";
 
@@ -224,7 +274,7 @@ bool UpsertGenerator::AddOptimize() const {
 
 Code UpsertGenerator::OptimizeFunctionCode() const {
   Code code;
-  code<<"void viya_upsert_optimize() {\n";
+  code<<"void Optimize() {\n";
 
   bool add_optimize = AddOptimize();
   if (add_optimize) {
@@ -259,6 +309,45 @@ Code UpsertGenerator::OptimizeFunctionCode() const {
   return code;
 }
 
+Code UpsertGenerator::BuildStarTreesCode() const {
+  Code code;
+  if (table_.star_tree().empty()) {
+    return code;
+  }
+  code.AddHeaders({"memory"});
+
+  // Trees are built on full segments, and rebuilt on segments that were updated since:
+  code<<"void BuildStarTrees() {\n";
+  code<<" auto segments = table->store()->segments_copy();\n";
+  code<<" size_t memory_size = 0;\n";
+  code<<" for (auto* s : segments) {\n";
+  code<<"  auto star_tree = std::static_pointer_cast<const SegmentStarTree>(s->star_tree());\n";
+  code<<"  if (star_tree) memory_size += star_tree->memory_size();\n";
+  code<<" }\n";
+  code<<" for (auto* s : segments) {\n";
+  code<<"  if (!s->full()) continue;\n";
+  code<<"  auto version = s->version();\n";
+  code<<"  auto star_tree = std::static_pointer_cast<const SegmentStarTree>(s->star_tree());\n";
+  code<<"  if (star_tree && star_tree->version() == version) continue;\n";
+  code<<"  if (star_tree) {\n";
+  code<<"   memory_size -= star_tree->memory_size();\n";
+  code<<"   s->set_star_tree(nullptr);\n";
+  code<<"  }\n";
+  auto max_memory_size = table_.star_tree().max_memory_size();
+  if (max_memory_size > 0) {
+    // Segments left without a tree are scanned:
+    code<<"  if (memory_size >= "<<std::to_string(max_memory_size)<<"UL) continue;\n";
+  }
+  code<<"  auto segment = static_cast<Segment*>(s);\n";
+  code<<"  star_tree = std::make_shared<const SegmentStarTree>(segment->d, segment->m, s->capacity(), "
+    <<std::to_string(table_.star_tree().max_leaf_records())<<"UL, version);\n";
+  code<<"  memory_size += star_tree->memory_size();\n";
+  code<<"  s->set_star_tree(star_tree);\n";
+  code<<" }\n";
+  code<<"}\n";
+  return code;
+}
+
 Code UpsertGenerator::CardinalityProtection() const {
   Code code;
   for (auto& guard : table_.cardinality_guards()) {
@@ -291,25 +380,97 @@ Code UpsertGenerator::CardinalityProtection() const {
 Code UpsertGenerator::GenerateCode() const {
   Code code;
   code<<SetupFunctionCode();
+  code<<UpsertTupleCode();
+
+  code<<"void Upsert(std::vector<std::string>& values) {\n";
+  {
+    size_t value_idx = 0;
+    for (auto* dimension : table_.dimensions()) {
+      code<<"{\n";
+      ValueParser value_parser(code, value_idx);
+      dimension->Accept(value_parser);
+      code<<"}\n";
+    }
+    for (auto* metric : table_.metrics()) {
+      ValueParser value_parser(code, value_idx);
+      metric->Accept(value_parser);
+    }
+  }
+  code<<" UpsertTuple();\n";
+  code<<"}\n";
 
-  code<<"extern \"C\" void viya_upsert_do(std::vector<std::string>& values) __attribute__((__visibility__(\"default\")));\n";
-  code<<"extern \"C\" void viya_upsert_do(std::vector<std::string>& values) {\n";
-
-  size_t value_idx = 0;
-  bool add_optimize = AddOptimize();
+  code<<"void UpsertBinary(const std::vector<const char*>& fields) {\n";
+  {
+    size_t value_idx = 0;
+    for (auto* dimension : table_.dimensions()) {
+      code<<"{\n";
+      BinaryValueParser value_parser(code, value_idx);
+      dimension->Accept(value_parser);
+      code<<"}\n";
+    }
+    for (auto* metric : table_.metrics()) {
+      BinaryValueParser value_parser(code, value_idx);
+      metric->Accept(value_parser);
+    }
+  }
+  code<<" UpsertTuple();\n";
+  code<<"}\n";
+  code<<"};\n";
 
+  code<<"extern \"C\" void* viya_upsert_setup(db::Table& t) __attribute__((__visibility__(\"default\")));\n";
+  code<<"extern \"C\" void* viya_upsert_setup(db::Table& t) {\n";
+  code<<" auto* ctx = new UpsertContext();\n";
+  code<<" ctx->table = &t;\n";
   for (auto* dimension : table_.dimensions()) {
-    code<<"{\n";
-    ValueParser value_parser(code, value_idx);
-    dimension->Accept(value_parser);
-    code<<"}\n";
+    if (dimension->dim_type() == db::Dimension::DimType::STRING) {
+      auto dim_idx = std::to_string(dimension->index());
+      code<<" ctx->dict"<<dim_idx<<" = static_cast<const db::StrDimension*>(t.dimension("<<dim_idx<<"))->dict();\n";
+      code<<" ctx->v2c"<<dim_idx<<" = reinterpret_cast<db::DictImpl<"<<dimension->num_type().cpp_type()
+        <<">*>(ctx->dict"<<dim_idx<<"->v2c());\n";
+    }
   }
+  code<<" return ctx;\n";
+  code<<"}\n";
 
-  for (auto* metric : table_.metrics()) {
-    ValueParser value_parser(code, value_idx);
-    metric->Accept(value_parser);
+  code<<"extern \"C\" void viya_upsert_destroy(void* ctx) __attribute__((__visibility__(\"default\")));\n";
+  code<<"extern \"C\" void viya_upsert_destroy(void* ctx) {\n";
+  code<<" delete static_cast<UpsertContext*>(ctx);\n";
+  code<<"}\n";
+
+  code<<"extern \"C\" void viya_upsert_before(void* ctx) __attribute__((__visibility__(\"default\")));\n";
+  code<<"extern \"C\" void viya_upsert_before(void* ctx) {\n";
+  code<<" static_cast<UpsertContext*>(ctx)->Before();\n";
+  code<<"}\n";
+
+  code<<"extern \"C\" db::UpsertStats viya_upsert_after(void* ctx) __attribute__((__visibility__(\"default\")));\n";
+  code<<"extern \"C\" db::UpsertStats viya_upsert_after(void* ctx) {\n";
+  code<<" return static_cast<UpsertContext*>(ctx)->After();\n";
+  code<<"}\n";
+
+  code<<"extern \"C\" void viya_upsert_do(void* ctx, std::vector<std::string>& values) __attribute__((__visibility__(\"default\")));\n";
+  code<<"extern \"C\" void viya_upsert_do(void* ctx, std::vector<std::string>& values) {\n";
+  code<<" static_cast<UpsertContext*>(ctx)->Upsert(values);\n";
+  code<<"}\n";
+
+  code<<"extern \"C\" void viya_upsert_binary(void* ctx, const std::vector<const char*>& fields) __attribute__((__visibility__(\"default\")));\n";
+  code<<"extern \"C\" void viya_upsert_binary(void* ctx, const std::vector<const char*>& fields) {\n";
+  code<<" static_cast<UpsertContext*>(ctx)->UpsertBinary(fields);\n";
+  code<<"}\n";
+
+  if (!table_.star_tree().empty()) {
+    code<<"extern \"C\" void viya_upsert_build_star_trees(void* ctx) __attribute__((__visibility__(\"default\")));\n";
+    code<<"extern \"C\" void viya_upsert_build_star_trees(void* ctx) {\n";
+    code<<" static_cast<UpsertContext*>(ctx)->BuildStarTrees();\n";
+    code<<"}\n";
   }
+  return code;
+}
+
+Code UpsertGenerator::UpsertTupleCode() const {
+  Code code;
+  bool add_optimize = AddOptimize();
 
+  code<<"void UpsertTuple() {\n";
   code<<CardinalityProtection();
 
   code<<" auto* store = table->store();\n";
@@ -322,9 +483,10 @@ Code UpsertGenerator::GenerateCode() const {
   code<<"  size_t tuple_idx = global_idx % " <<segment_size<<";\n";
   code<<"  Metrics* metrics = static_cast<Segment*>(segments[segment_idx])->m;\n";
   code<<"  (metrics + tuple_idx)->Update(upsert_metrics);\n";
+  code<<"  segments[segment_idx]->Touch();\n";
   if (add_optimize) {
     code<<"  if (--updates_before_optimize == 0) {\n";
-    code<<"   viya_upsert_optimize();\n";
+    code<<"   Optimize();\n";
     code<<"  }\n";
   }
   code<<" } else {\n";
@@ -352,6 +514,10 @@ db::UpsertSetupFn UpsertGenerator::SetupFunction() {
   return GenerateFunction<db::UpsertSetupFn>(std::string("viya_upsert_setup"));
 }
 
+db::UpsertDestroyFn UpsertGenerator::DestroyFunction() {
+  return GenerateFunction<db::UpsertDestroyFn>(std::string("viya_upsert_destroy"));
+}
+
 db::BeforeUpsertFn UpsertGenerator::BeforeFunction() {
   return GenerateFunction<db::BeforeUpsertFn>(std::string("viya_upsert_before"));
 }
@@ -364,5 +530,13 @@ db::UpsertFn UpsertGenerator::Function() {
   return GenerateFunction<db::UpsertFn>(std::string("viya_upsert_do"));
 }
 
+db::UpsertBinaryFn UpsertGenerator::BinaryFunction() {
+  return GenerateFunction<db::UpsertBinaryFn>(std::string("viya_upsert_binary"));
+}
+
+db::BuildStarTreesFn UpsertGenerator::BuildStarTreesFunction() {
+  return GenerateFunction<db::BuildStarTreesFn>(std::string("viya_upsert_build_star_trees"));
+}
+
 }}
 
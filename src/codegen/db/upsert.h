@@ -22,11 +22,32 @@ class ValueParser: public db::ColumnVisitor {
     void Visit(const db::ValueMetric* metric);
     void Visit(const db::BitsetMetric* metric);
 
-  private:
+  protected:
+    void DictionaryLookup(const db::StrDimension* dimension);
+    void TimeRollup(const db::TimeDimension* dimension);
+
+  protected:
     Code& code_;
     size_t& value_idx_;
 };
 
+/**
+ * Generates code that reads column values from binary input fields
+ * (see input/file.h for the format description) instead of parsing strings
+ */
+class BinaryValueParser: public ValueParser {
+  public:
+    BinaryValueParser(Code& code, size_t& value_idx):
+      ValueParser(code, value_idx) {}
+
+    void Visit(const db::StrDimension* dimension);
+    void Visit(const db::NumDimension* dimension);
+    void Visit(const db::TimeDimension* dimension);
+    void Visit(const db::BoolDimension* dimension);
+    void Visit(const db::ValueMetric* metric);
+    void Visit(const db::BitsetMetric* metric);
+};
+
 class UpsertGenerator: public FunctionGenerator {
   public:
     UpsertGenerator(Compiler& compiler, const db::Table& table)
@@ -37,15 +58,20 @@ class UpsertGenerator: public FunctionGenerator {
     Code GenerateCode() const;
 
     db::UpsertSetupFn SetupFunction();
+    db::UpsertDestroyFn DestroyFunction();
     db::BeforeUpsertFn BeforeFunction();
     db::AfterUpsertFn AfterFunction();
     db::UpsertFn Function();
+    db::UpsertBinaryFn BinaryFunction();
+    db::BuildStarTreesFn BuildStarTreesFunction();
 
   private:
     Code SetupFunctionCode() const;
+    Code UpsertTupleCode() const;
     Code CardinalityProtection() const;
     bool AddOptimize() const;
     Code OptimizeFunctionCode() const;
+    Code BuildStarTreesCode() const;
 
   private:
     const db::Table& table_;
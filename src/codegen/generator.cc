@@ -12,9 +12,12 @@ Code::Code(Code&& other) {
 
 std::string Code::str() const {
   std::stringstream ss;
-  std::unordered_set<std::string> headers_set(headers_.begin(), headers_.end());
-  for (auto& header : headers_set) {
-    ss<<"#include <"<<header<<">"<<std::endl;
+  // Keep headers order stable, so the same code always hashes the same:
+  std::unordered_set<std::string> headers_set;
+  for (auto& header : headers_) {
+    if (headers_set.insert(header).second) {
+      ss<<"#include <"<<header<<">"<<std::endl;
+    }
   }
   ss<<body_.str();
   return ss.str();
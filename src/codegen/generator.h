@@ -47,23 +47,53 @@ class CodeGenerator {
 
 class FunctionGenerator: public CodeGenerator {
   public:
-    FunctionGenerator(Compiler& compiler):compiler_(compiler) {}
+    /**
+     * Tiered code starts with a quickly compiled library, and is only optimized when used
+     * often enough (see Compiler)
+     */
+    FunctionGenerator(Compiler& compiler, bool tiered = false):tiered_(tiered),compiler_(compiler) {}
 
     virtual ~FunctionGenerator() {}
 
-  protected:
-    template <typename Func>
-    Func GenerateFunction(const std::string& func_name) {
+    /**
+     * Library containing the generated functions. Compiler may unload it once it's not
+     * referenced anymore, so it must be held for as long as the functions are used.
+     */
+    std::shared_ptr<SharedLibrary> library() const { return library_; }
+
+    /**
+     * Generated code, which identifies the generated functions
+     */
+    const std::string& code() {
       if (code_.empty()) {
         code_ = GenerateCode().str();
       }
-      auto library = compiler_.Compile(code_);
-      return library->GetFunction<Func>(func_name);
+      return code_;
+    }
+
+  protected:
+    template <typename Func>
+    Func GenerateFunction(const std::string& func_name) {
+      library_ = compiler_.Compile(code(), tiered_);
+      return library_->GetFunction<Func>(func_name);
     }
 
+    /**
+     * Returns nullptr if the code is not compiled yet, and compiles it in background
+     */
+    template <typename Func>
+    Func GenerateFunctionAsync(const std::string& func_name) {
+      library_ = compiler_.CompileAsync(code(), tiered_);
+      return library_ ? library_->GetFunction<Func>(func_name) : nullptr;
+    }
+
+  protected:
+    bool tiered_;
+
   private:
     std::string code_;
     Compiler& compiler_;
+    std::shared_ptr<SharedLibrary> library_;
 };
 
 }};
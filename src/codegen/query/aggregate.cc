@@ -0,0 +1,118 @@
+#include "codegen/query/aggregate.h"
+
+namespace viya {
+namespace codegen {
+
+Code AggTableStruct::GenerateCode() const {
+  Code code;
+  code.AddHeaders({"vector", "iterator", "cstdint", "utility"});
+
+  auto& name = struct_name_;
+  code<<"class "<<name<<" {\n";
+  code<<"public:\n";
+  code<<" struct Entry {\n";
+  code<<"  "<<key_struct_<<" first;\n";
+  code<<"  "<<value_struct_<<" second;\n";
+  code<<" };\n";
+
+  // Forward iterator over occupied slots:
+  code<<" class iterator {\n";
+  code<<" public:\n";
+  code<<"  typedef std::forward_iterator_tag iterator_category;\n";
+  code<<"  typedef Entry value_type;\n";
+  code<<"  typedef std::ptrdiff_t difference_type;\n";
+  code<<"  typedef Entry* pointer;\n";
+  code<<"  typedef Entry& reference;\n";
+  code<<"  iterator(const "<<name<<"* table, size_t idx):table_(table),idx_(idx) { Skip(); }\n";
+  code<<"  Entry& operator*() const { return const_cast<Entry&>(table_->entries_[idx_]); }\n";
+  code<<"  Entry* operator->() const { return &**this; }\n";
+  code<<"  iterator& operator++() { ++idx_; Skip(); return *this; }\n";
+  code<<"  bool operator==(const iterator& other) const { return idx_ == other.idx_; }\n";
+  code<<"  bool operator!=(const iterator& other) const { return idx_ != other.idx_; }\n";
+  code<<" private:\n";
+  code<<"  void Skip() { while (idx_ < table_->hashes_.size() && table_->hashes_[idx_] == 0) ++idx_; }\n";
+  code<<"  const "<<name<<"* table_;\n";
+  code<<"  size_t idx_;\n";
+  code<<" };\n";
+
+  code<<" "<<name<<"():size_(0),mask_(0) {}\n";
+
+  // Hash code is never zero, since zero marks an empty slot. The highest bit is set rather than
+  // the lowest one, so that all slots can be home slots:
+  code<<" static uint64_t Hash(const "<<key_struct_<<"& key) {\n";
+  code<<"  uint64_t h = "<<key_struct_<<"Hasher()(key);\n";
+  code<<"  h ^= h >> 33;\n";
+  code<<"  h *= 0xff51afd7ed558ccdULL;\n";
+  code<<"  h ^= h >> 33;\n";
+  code<<"  return h | (1ULL << 63);\n";
+  code<<" }\n";
+
+  code<<" void Reserve(size_t groups) {\n";
+  code<<"  size_t capacity = 16;\n";
+  code<<"  while (capacity < groups * 2) capacity <<= 1;\n";
+  code<<"  if (capacity > hashes_.size()) Rehash(capacity);\n";
+  code<<" }\n";
+
+  code<<" void Prefetch(uint64_t hash) const {\n";
+  code<<"  size_t idx = hash & mask_;\n";
+  code<<"  __builtin_prefetch(hashes_.data() + idx);\n";
+  code<<"  __builtin_prefetch(entries_.data() + idx, 1);\n";
+  code<<" }\n";
+
+  code<<" "<<value_struct_<<"& Find(const "<<key_struct_<<"& key, uint64_t hash) {\n";
+  code<<"  if (hashes_.empty()) Rehash(16);\n";
+  code<<"  size_t idx = hash & mask_;\n";
+  code<<"  while (true) {\n";
+  code<<"   uint64_t h = hashes_[idx];\n";
+  code<<"   if (h == hash && entries_[idx].first == key) return entries_[idx].second;\n";
+  code<<"   if (h == 0) {\n";
+  // Load factor is only checked when a new key is inserted:
+  code<<"    if ((size_ + 1) * 2 > hashes_.size()) {\n";
+  code<<"     Rehash(hashes_.size() * 2);\n";
+  code<<"     return Find(key, hash);\n";
+  code<<"    }\n";
+  code<<"    hashes_[idx] = hash;\n";
+  code<<"    entries_[idx].first = key;\n";
+  code<<"    ++size_;\n";
+  code<<"    return entries_[idx].second;\n";
+  code<<"   }\n";
+  code<<"   idx = (idx + 1) & mask_;\n";
+  code<<"  }\n";
+  code<<" }\n";
+
+  code<<" "<<value_struct_<<"& operator[](const "<<key_struct_<<"& key) { return Find(key, Hash(key)); }\n";
+  code<<" size_t size() const { return size_; }\n";
+  code<<" size_t memory_size() const {\n";
+  code<<"  size_t size = sizeof(*this) + hashes_.size() * (sizeof(uint64_t) + sizeof(Entry));\n";
+  code<<"  for (auto& entry : *this) size += entry.second.heap_size();\n";
+  code<<"  return size;\n";
+  code<<" }\n";
+  code<<" iterator begin() const { return iterator(this, 0); }\n";
+  code<<" iterator end() const { return iterator(this, hashes_.size()); }\n";
+
+  code<<"private:\n";
+  code<<" void Rehash(size_t capacity) {\n";
+  code<<"  std::vector<uint64_t> hashes(capacity, 0);\n";
+  code<<"  std::vector<Entry> entries(capacity);\n";
+  code<<"  size_t mask = capacity - 1;\n";
+  code<<"  for (size_t i = 0; i < hashes_.size(); ++i) {\n";
+  code<<"   if (hashes_[i] == 0) continue;\n";
+  code<<"   size_t idx = hashes_[i] & mask;\n";
+  code<<"   while (hashes[idx] != 0) idx = (idx + 1) & mask;\n";
+  code<<"   hashes[idx] = hashes_[i];\n";
+  code<<"   entries[idx] = std::move(entries_[i]);\n";
+  code<<"  }\n";
+  code<<"  hashes_.swap(hashes);\n";
+  code<<"  entries_.swap(entries);\n";
+  code<<"  mask_ = mask;\n";
+  code<<" }\n";
+
+  code<<" std::vector<uint64_t> hashes_;\n";
+  code<<" std::vector<Entry> entries_;\n";
+  code<<" size_t size_;\n";
+  code<<" size_t mask_;\n";
+  code<<"};\n";
+  return code;
+}
+
+}}
@@ -0,0 +1,32 @@
+#ifndef VIYA_CODEGEN_QUERY_AGGREGATE_H_
+#define VIYA_CODEGEN_QUERY_AGGREGATE_H_
+
+#include <string>
+#include "codegen/generator.h"
+
+namespace viya {
+namespace codegen {
+
+/**
+ * Generates open addressing (linear probing) hash table, which maps aggregation keys
+ * to aggregated metrics. Keys and metrics are stored inline in a flat array, along
+ * with a separate array of hash codes used for probing.
+ */
+class AggTableStruct: public CodeGenerator {
+  public:
+    AggTableStruct(std::string struct_name, std::string key_struct, std::string value_struct):
+      struct_name_(struct_name),key_struct_(key_struct),value_struct_(value_struct) {}
+
+    AggTableStruct(const AggTableStruct& other) = delete;
+
+    Code GenerateCode() const;
+
+  private:
+    std::string struct_name_;
+    std::string key_struct_;
+    std::string value_struct_;
+};
+
+}}
+
+#endif // VIYA_CODEGEN_QUERY_AGGREGATE_H_
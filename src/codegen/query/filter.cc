@@ -7,7 +7,31 @@
 namespace viya {
 namespace codegen {
 
+/**
+ * Range comparison on a string dimension is done on ranks of dictionary codes
+ */
+static bool is_string_range(const query::RelOpFilter* filter) {
+  auto column = filter->column();
+  return column->type() == db::Column::Type::DIMENSION
+    && static_cast<const db::Dimension*>(column)->dim_type() == db::Dimension::DimType::STRING
+    && filter->op() != query::RelOpFilter::Operator::EQUAL
+    && filter->op() != query::RelOpFilter::Operator::NOT_EQUAL;
+}
+
+static bool is_below(const query::RelOpFilter* filter) {
+  return filter->op() == query::RelOpFilter::Operator::LESS
+    || filter->op() == query::RelOpFilter::Operator::LESS_EQUAL;
+}
+
 void FilterArgsPacker::Visit(const query::RelOpFilter* filter) {
+  if (is_string_range(filter)) {
+    // Pass the code of the last matching value in dictionary order:
+    auto dict = static_cast<const db::StrDimension*>(filter->column())->dict();
+    bool inclusive = filter->op() == query::RelOpFilter::Operator::LESS_EQUAL
+      || filter->op() == query::RelOpFilter::Operator::GREATER_EQUAL;
+    args_.push_back(dict->DecodeBound(filter->value(), is_below(filter), inclusive));
+    return;
+  }
   ValueDecoder value_decoder(filter->value());
   filter->column()->Accept(value_decoder);
   args_.push_back(value_decoder.decoded_value());
@@ -41,7 +65,19 @@ void ArgsUnpacker::UnpackArg(const db::Column* column) {
 }
 
 void ArgsUnpacker::Visit(const query::RelOpFilter* filter) {
+  auto arg_idx = std::to_string(argidx_);
   UnpackArg(filter->column());
+
+  if (is_string_range(filter)) {
+    // Translate bound code into its rank, using a missing code as the rank that matches nothing:
+    auto dim_idx = std::to_string(filter->column()->index());
+    code_<<"auto forder"<<arg_idx<<" = static_cast<const db::StrDimension*>(table.dimension("
+      <<dim_idx<<"))->dict()->Order();\n";
+    code_<<"const uint32_t* franks"<<arg_idx<<" = forder"<<arg_idx<<"->ranks.data();\n";
+    code_<<"size_t franks_size"<<arg_idx<<" = forder"<<arg_idx<<"->ranks.size();\n";
+    code_<<"int64_t frank"<<arg_idx<<" = farg"<<arg_idx<<" < franks_size"<<arg_idx
+      <<" ? (int64_t) franks"<<arg_idx<<"[farg"<<arg_idx<<"] : "<<(is_below(filter) ? "-1" : "INT64_MAX")<<";\n";
+  }
 }
 
 void ArgsUnpacker::Visit(const query::InFilter* filter) {
@@ -111,6 +147,15 @@ void ValueDecoder::Visit(const db::BitsetMetric* metric) {
 }
 
 void ComparisonBuilder::Visit(const query::RelOpFilter* filter) {
+  if (is_string_range(filter)) {
+    // Codes that appeared after ranks were calculated never match:
+    auto arg_idx = std::to_string(argidx_++);
+    auto value = "tuple_dims._" + std::to_string(filter->column()->index());
+    bool below = is_below(filter);
+    code_<<"((("<<value<<" < franks_size"<<arg_idx<<") ? (int64_t) franks"<<arg_idx<<"["<<value<<"] : "
+      <<(below ? "INT64_MAX" : "-1")<<")"<<(below ? "<=" : ">=")<<"frank"<<arg_idx<<")";
+    return;
+  }
   code_<<"("
     <<(filter->column()->type() == db::Column::Type::DIMENSION ? "tuple_dims" : "tuple_metrics")
     <<"._"<<std::to_string(filter->column()->index())
@@ -216,6 +261,55 @@ void SegmentSkipBuilder::Visit(const query::InFilter* filter) {
   }
 }
 
+void SegmentSkipBuilder::Visit(const query::NotFilter* filter) {
+  // Segment stats only tell whether a segment may contain matching tuples, which can't be negated.
+  // Just skip arguments of the negated filter:
+  Code ignored;
+  SegmentSkipBuilder negated(ignored);
+  negated.argidx_ = argidx_;
+  filter->filter()->Accept(negated);
+  argidx_ = negated.argidx_;
+  code_<<"1";
+}
+
+bool PartialComparisonBuilder::is_known(const db::Column* column) const {
+  return std::find(known_.begin(), known_.end(), column) != known_.end();
+}
+
+void PartialComparisonBuilder::Visit(const query::RelOpFilter* filter) {
+  if (is_known(filter->column())) {
+    ComparisonBuilder::Visit(filter);
+  } else {
+    ++argidx_;
+    code_<<"1";
+  }
+}
+
+void PartialComparisonBuilder::Visit(const query::InFilter* filter) {
+  if (is_known(filter->column())) {
+    ComparisonBuilder::Visit(filter);
+  } else {
+    argidx_ += filter->values().size();
+    code_<<"1";
+  }
+}
+
+void PartialComparisonBuilder::Visit(const query::NotFilter* filter) {
+  query::FilterColumns columns;
+  filter->filter()->Accept(columns);
+  if (std::all_of(columns.columns().begin(), columns.columns().end(),
+                  [this](const db::Column* column) { return is_known(column); })) {
+    ComparisonBuilder::Visit(filter);
+    return;
+  }
+  Code ignored;
+  PartialComparisonBuilder negated(ignored, known_);
+  negated.argidx_ = argidx_;
+  filter->filter()->Accept(negated);
+  argidx_ = negated.argidx_;
+  code_<<"1";
+}
+
 Code FilterArgsUnpack::GenerateCode() const {
   Code code;
   ArgsUnpacker b(code);
@@ -237,4 +331,11 @@ Code FilterComparison::GenerateCode() const {
   return code;
 }
 
+Code PartialFilterComparison::GenerateCode() const {
+  Code code;
+  PartialComparisonBuilder b(code, known_);
+  filter_->Accept(b);
+  return code;
+}
+
 }}
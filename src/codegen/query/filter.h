@@ -83,6 +83,27 @@ class SegmentSkipBuilder: public ComparisonBuilder {
 
     void Visit(const query::RelOpFilter* filter);
     void Visit(const query::InFilter* filter);
+    void Visit(const query::NotFilter* filter);
+};
+
+/**
+ * Evaluates the filter on known columns only, assuming that the rest of it matches.
+ * Negation of a filter on unknown columns is assumed to match as well.
+ */
+class PartialComparisonBuilder: public ComparisonBuilder {
+  public:
+    PartialComparisonBuilder(Code& code, const std::vector<const db::Column*>& known)
+      :ComparisonBuilder(code),known_(known) {}
+
+    void Visit(const query::RelOpFilter* filter);
+    void Visit(const query::InFilter* filter);
+    void Visit(const query::NotFilter* filter);
+
+  private:
+    bool is_known(const db::Column* column) const;
+
+  private:
+    const std::vector<const db::Column*>& known_;
 };
 
 class FilterArgsUnpack: public CodeGenerator {
@@ -118,6 +139,19 @@ class FilterComparison: CodeGenerator {
     const query::Filter* filter_;
 };
 
+class PartialFilterComparison: CodeGenerator {
+  public:
+    PartialFilterComparison(const query::Filter* filter, const std::vector<const db::Column*>& known)
+      :filter_(filter),known_(known) {}
+    PartialFilterComparison(const PartialFilterComparison& other) = delete;
+
+    Code GenerateCode() const;
+
+  private:
+    const query::Filter* filter_;
+    const std::vector<const db::Column*>& known_;
+};
+
 }}
 
 #endif // VIYA_CODEGEN_QUERY_FILTER_H_
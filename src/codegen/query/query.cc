@@ -1,67 +1,125 @@
+#include <algorithm>
 #include "db/defs.h"
+#include "db/table.h"
 #include "codegen/db/store.h"
 #include "codegen/db/rollup.h"
 #include "codegen/query/query.h"
 #include "codegen/query/filter.h"
+#include "codegen/query/aggregate.h"
 
 namespace viya {
 namespace codegen {
 
-void ScanGenerator::IterationStart(query::FilterBasedQuery* query) {
+void ScanGenerator::IterationStart(query::FilterBasedQuery* query, bool parallel, bool batched) {
+  SegmentStart(query, parallel);
+  TupleStart(query, batched);
+}
+
+void ScanGenerator::SegmentStart(query::FilterBasedQuery* query, bool parallel) {
+  std::string stats_var = parallel ? "worker_stats" : "stats";
+
   // Iterate on segments:
-  code_<<" for (auto* s : table.store()->segments_copy()) {\n";
+  if (parallel) {
+    // Workers claim segments one by one, so skipped segments don't unbalance them:
+    code_<<" for (size_t segment_idx = next_segment++; segment_idx < segments.size(); segment_idx = next_segment++) {\n";
+    code_<<"  auto* s = segments[segment_idx];\n";
+  } else {
+    code_<<" for (auto* s : table.store()->segments_copy()) {\n";
+  }
   code_<<"  auto segment_size = s->size();\n";
-  code_<<"  stats.scanned_recs += segment_size;\n";
+  code_<<"  "<<stats_var<<".scanned_recs += segment_size;\n";
   code_<<"  auto segment = static_cast<Segment*>(s);\n";
 
   // Check whether to skip this segment:
   SegmentSkip segment_skip(query->filter());
   code_<<"  auto process_segment = "<<segment_skip.GenerateCode()<<";\n";
   code_<<"  if (!process_segment) continue;\n";
-  code_<<"  stats.scanned_segments++;\n";
-
-  // Iterate on tuples:
-  code_<<"  for (size_t tuple_idx = 0; tuple_idx < segment_size; ++tuple_idx) {\n";
-  code_<<"   Dimensions& tuple_dims = segment->d[tuple_idx];\n";
-  code_<<"   Metrics& tuple_metrics = segment->m[tuple_idx];\n";
+  code_<<"  "<<stats_var<<".scanned_segments++;\n";
+}
 
-  // Apply filter, and check it's return code:
-  // TODO : is it possible to do it without IF branch?
+void ScanGenerator::TupleStart(query::FilterBasedQuery* query, bool batched) {
   FilterComparison comparison(query->filter());
-  code_<<"   auto res = "<<comparison.GenerateCode()<<";\n";
-  code_<<"   if (res) {\n";
+  if (batched) {
+    // Evaluate filter on blocks of tuples without branching, collecting positions
+    // of matching tuples into a selection vector:
+    auto block_size = std::to_string(SCAN_BLOCK_SIZE);
+    code_<<"  uint16_t selection["<<block_size<<"];\n";
+    code_<<"  for (size_t block_start = 0; block_start < segment_size; block_start += "<<block_size<<") {\n";
+    code_<<"   size_t block_size = std::min(segment_size - block_start, (size_t) "<<block_size<<");\n";
+    code_<<"   Dimensions* block_dims = segment->d + block_start;\n";
+    code_<<"   Metrics* block_metrics = segment->m + block_start;\n";
+    code_<<"   size_t selected = 0;\n";
+    code_<<"   for (size_t block_idx = 0; block_idx < block_size; ++block_idx) {\n";
+    code_<<"    Dimensions& tuple_dims = block_dims[block_idx];\n";
+    code_<<"    Metrics& tuple_metrics = block_metrics[block_idx];\n";
+    code_<<"    selection[selected] = block_idx;\n";
+    code_<<"    selected += "<<comparison.GenerateCode()<<";\n";
+    code_<<"   }\n";
+
+    // Iterate on selected tuples:
+    code_<<"   for (size_t sel_idx = 0; sel_idx < selected; ++sel_idx) {\n";
+    code_<<"    Dimensions& tuple_dims = block_dims[selection[sel_idx]];\n";
+    code_<<"    Metrics& tuple_metrics = block_metrics[selection[sel_idx]];\n";
+    code_<<"    {\n";
+  } else {
+    // Iterate on tuples:
+    code_<<"  for (size_t tuple_idx = 0; tuple_idx < segment_size; ++tuple_idx) {\n";
+    code_<<"   Dimensions& tuple_dims = segment->d[tuple_idx];\n";
+    code_<<"   Metrics& tuple_metrics = segment->m[tuple_idx];\n";
+
+    // Apply filter, and check it's return code:
+    // TODO : is it possible to do it without IF branch?
+    code_<<"   auto res = "<<comparison.GenerateCode()<<";\n";
+    code_<<"   if (res) {\n";
+  }
 }
 
-void ScanGenerator::IterationEnd() {
-  // Close iteration loop:
+void ScanGenerator::SelectionEnd() {
+  // Close selected tuples loop:
+  code_<<"    }\n";
   code_<<"   }\n";
-  code_<<"  }\n";
+}
+
+void ScanGenerator::IterationEnd(bool batched) {
+  TupleEnd(batched);
   code_<<" }\n";
 }
 
-void ScanGenerator::UnpackArguments(query::FilterBasedQuery* query) {
-  FilterArgsUnpack args_unpack(query->filter());
-  code_<<args_unpack.GenerateCode();
+void ScanGenerator::TupleEnd(bool batched) {
+  // Close tuples (or blocks) loop:
+  if (!batched) {
+    code_<<"   }\n";
+  }
+  code_<<"  }\n";
 }
 
-void ScanGenerator::Scan(query::AggregateQuery* query) {
-  // Structures for aggragation in memory:
-  code_<<" AggDimensions agg_dims;\n";
-  code_<<" AggMetrics agg_metrics;\n";
-  code_<<" std::unordered_map<AggDimensions,AggMetrics,AggDimensionsHasher> agg_map;\n";
+void ScanGenerator::AggEstimate(query::AggregateQuery* query) {
+  // Records of segments, which aren't skipped by the filter, are going to be scanned:
+  SegmentSkip segment_skip(query->filter());
+  code_<<" size_t scan_estimate = 0;\n";
+  code_<<" for (auto* s : segments) {\n";
+  code_<<"  auto segment = static_cast<Segment*>(s);\n";
+  code_<<"  scan_estimate += ("<<segment_skip.GenerateCode()<<") ? segment->size() : 0;\n";
+  code_<<" }\n";
+  code_<<" scan_estimate = scan_estimate / threads + 1;\n";
 
-  std::vector<const db::Dimension*> dims;
-  for (auto& dim_col : query->dimension_cols()) {
-    dims.push_back(dim_col.dim());
-  }
-  RollupDefs rollup_defs(dims);
-  code_<<rollup_defs.GenerateCode();
+  // Number of groups a worker is going to produce is bounded by the number of records it scans,
+  // and by the key space size (filter selectivity is accounted for during the scan):
+  code_<<" size_t agg_estimate = std::min(scan_estimate, agg_domain);\n";
+  code_<<" agg_estimate = std::min(agg_estimate, (size_t) "<<std::to_string(AGG_PRESIZE_LIMIT)<<");\n";
 
-  RollupReset rollup_reset(dims);
-  code_<<rollup_reset.GenerateCode();
+  // Aggregation arrays are allocated and swept whole, so they're only worth it when the key
+  // space isn't much larger than the number of records a worker scans:
+  code_<<" bool agg_direct = agg_domain * threads <= "<<std::to_string(AGG_DIRECT_LIMIT)
+    <<" && agg_domain <= scan_estimate * "<<std::to_string(AGG_DIRECT_SPARSITY)<<";\n";
+}
 
-  IterationStart(query);
+void ScanGenerator::UnpackArguments(query::FilterBasedQuery* query) {
+  FilterArgsUnpack args_unpack(query->filter());
+  code_<<args_unpack.GenerateCode();
+}
 
+void ScanGenerator::AggKeys(query::AggregateQuery* query) {
   for (auto& dim_col : query->dimension_cols()) {
     auto dimension = dim_col.dim();
     auto dim_idx = std::to_string(dimension->index());
@@ -89,59 +147,534 @@ void ScanGenerator::Scan(query::AggregateQuery* query) {
       code_<<"agg_dims._"<<dim_idx<<" = tuple_dims._"<<dim_idx<<";\n";
     }
   }
+}
 
+void ScanGenerator::AggValues(query::AggregateQuery* query) {
   for (auto& metric_col : query->metric_cols()) {
     auto metric_idx = std::to_string(metric_col.metric()->index());
-    code_<<"agg_metrics._"<<metric_idx<<" = tuple_metrics._"<<metric_idx<<";\n";
+    code_<<"    agg_metrics._"<<metric_idx<<" = tuple_metrics._"<<metric_idx<<";\n";
   }
+}
 
-  code_<<"agg_map[agg_dims].Update(agg_metrics);\n";
+/**
+ * Returns the distance between possible values of a dimension as it appears in aggregation key
+ */
+static uint64_t agg_key_step(const query::DimOutputColumn& dim_col) {
+  auto dim = dim_col.dim();
+  if (dim->dim_type() != db::Dimension::DimType::TIME || dim_col.granularity().empty()) {
+    return 1;
+  }
+  uint64_t step;
+  switch (dim_col.granularity().time_unit()) {
+    case util::TimeUnit::SECOND: step = 1; break;
+    case util::TimeUnit::MINUTE: step = 60; break;
+    case util::TimeUnit::HOUR: step = 3600; break;
+    default: step = 86400; break;
+  }
+  return static_cast<const db::TimeDimension*>(dim)->micro_precision() ? step * 1000000L : step;
+}
 
-  IterationEnd();
+void ScanGenerator::AggDomain(query::AggregateQuery* query) {
+  // Every dimension value is mapped to [0, radix) range, and their combination to a mixed
+  // radix number, which is used as an index in the aggregation array. Value ranges are taken
+  // from dictionary sizes and segment stats:
+  auto limit = std::to_string(AGG_DIRECT_LIMIT);
+  code_<<" size_t agg_domain = 1;\n";
+  for (auto& dim_col : query->dimension_cols()) {
+    auto dim = dim_col.dim();
+    auto dim_idx = std::to_string(dim->index());
+    auto& num_type = dim->num_type();
+    auto type = num_type.cpp_type();
+
+    code_<<" "<<type<<" agg_base"<<dim_idx<<" = 0;\n";
+    code_<<" size_t agg_radix"<<dim_idx<<" = 0;\n";
+    code_<<" size_t agg_mult"<<dim_idx<<" = agg_domain;\n";
+    switch (dim->dim_type()) {
+      case db::Dimension::DimType::STRING:
+        code_<<" {\n";
+        code_<<"  auto dict = static_cast<const db::StrDimension*>(table.dimension("<<dim_idx<<"))->dict();\n";
+        code_<<"  dict->lock().lock_shared();\n";
+        code_<<"  agg_radix"<<dim_idx<<" = dict->c2v().size();\n";
+        code_<<"  dict->lock().unlock_shared();\n";
+        code_<<" }\n";
+        break;
+      case db::Dimension::DimType::BOOLEAN:
+        code_<<" agg_radix"<<dim_idx<<" = 2;\n";
+        break;
+      default: {
+        auto step = std::to_string(agg_key_step(dim_col));
+        auto time_dim = dim->dim_type() == db::Dimension::DimType::TIME ?
+          static_cast<const db::TimeDimension*>(dim) : nullptr;
+
+        // Truncation to weeks, months or years doesn't produce multiples of its unit,
+        // so leave a margin of a year below the lowest truncated value:
+        bool coarse = false;
+        if (time_dim != nullptr) {
+          std::vector<db::Granularity> units;
+          if (!dim_col.granularity().empty()) {
+            units.push_back(dim_col.granularity());
+          }
+          for (auto& rule : time_dim->rollup_rules()) {
+            units.push_back(rule.granularity());
+          }
+          for (auto& unit : units) {
+            coarse |= unit.time_unit() <= util::TimeUnit::WEEK;
+          }
+        }
+        std::string margin = coarse ?
+          std::to_string(366 * 86400L * (time_dim->micro_precision() ? 1000000L : 1L)) : "0";
+
+        code_<<" {\n";
+        code_<<"  "<<type<<" dmin = "<<num_type.cpp_max_value()<<";\n";
+        code_<<"  "<<type<<" dmax = "<<num_type.cpp_min_value()<<";\n";
+        code_<<"  for (auto* s : segments) {\n";
+        code_<<"   auto segment = static_cast<Segment*>(s);\n";
+        code_<<"   dmin = std::min(dmin, segment->stats.dmin"<<dim_idx<<");\n";
+        code_<<"   dmax = std::max(dmax, segment->stats.dmax"<<dim_idx<<");\n";
+        code_<<"  }\n";
+        code_<<"  if (dmin <= dmax) {\n";
+        code_<<"   agg_base"<<dim_idx<<" = dmin - dmin % "<<step<<";\n";
+        code_<<"   agg_base"<<dim_idx<<" = agg_base"<<dim_idx<<" > "<<margin
+          <<" ? agg_base"<<dim_idx<<" - "<<margin<<" : 0;\n";
+        code_<<"   agg_radix"<<dim_idx<<" = std::min((uint64_t) (dmax - agg_base"<<dim_idx<<") / "<<step
+          <<" + 1, (uint64_t) "<<limit<<" + 1);\n";
+        code_<<"  }\n";
+        code_<<" }\n";
+        break;
+      }
+    }
+    code_<<" agg_domain = std::min(agg_domain * agg_radix"<<dim_idx<<", (size_t) "<<limit<<" + 1);\n";
+  }
+}
 
-  code_<<" stats.aggregated_recs = agg_map.size();\n";
+void ScanGenerator::DirectAggregation(query::AggregateQuery* query) {
+  code_<<" std::vector<AggMetrics> agg_array(agg_domain);\n";
+  code_<<" std::vector<uint8_t> agg_used(agg_domain);\n";
+  code_<<" AggDimensions agg_dims;\n";
+
+  SegmentStart(query, true);
+  StarTreeScan(query);
+  CachedPartials(query);
+  TupleStart(query, true);
+  AggKeys(query);
+  AggValues(query);
+
+  // Values, which appeared after the domain was calculated (due to concurrent writes)
+  // are aggregated into the hash table:
+  code_<<"    if (";
+  bool first = true;
+  for (auto& dim_col : query->dimension_cols()) {
+    auto dim_idx = std::to_string(dim_col.dim()->index());
+    auto step = agg_key_step(dim_col);
+    code_<<(first ? "" : "\n     & ")<<"((size_t) (agg_dims._"<<dim_idx<<" - agg_base"<<dim_idx<<")";
+    if (step > 1) {
+      code_<<" / "<<std::to_string(step);
+    }
+    code_<<" < agg_radix"<<dim_idx<<")";
+    first = false;
+  }
+  if (first) {
+    // Without dimensions there's a single cell:
+    code_<<"true";
+  }
+  code_<<") {\n";
+  code_<<"     size_t agg_idx = 0";
+  for (auto& dim_col : query->dimension_cols()) {
+    auto dim_idx = std::to_string(dim_col.dim()->index());
+    auto step = agg_key_step(dim_col);
+    code_<<"\n      + (size_t) (agg_dims._"<<dim_idx<<" - agg_base"<<dim_idx<<")";
+    if (step > 1) {
+      code_<<" / "<<std::to_string(step);
+    }
+    code_<<" * agg_mult"<<dim_idx;
+  }
+  code_<<";\n";
+  code_<<"     agg_array[agg_idx].Update(agg_metrics);\n";
+  code_<<"     agg_used[agg_idx] = 1;\n";
+  code_<<"    } else {\n";
+  code_<<"     agg_map[agg_dims].Update(agg_metrics);\n";
+  code_<<"    }\n";
+  SelectionEnd();
+  IterationEnd(true);
+
+  // Restore keys of the used array cells, and pass the results to materialization:
+  code_<<" for (size_t agg_idx = 0; agg_idx < agg_domain; ++agg_idx) {\n";
+  code_<<"  if (!agg_used[agg_idx]) continue;\n";
+  code_<<"  size_t agg_rem = agg_idx;\n";
+  for (auto& dim_col : query->dimension_cols()) {
+    auto dim = dim_col.dim();
+    auto dim_idx = std::to_string(dim->index());
+    code_<<"  agg_dims._"<<dim_idx<<" = agg_base"<<dim_idx<<" + ("<<dim->num_type().cpp_type()
+      <<") (agg_rem % agg_radix"<<dim_idx<<") * "<<std::to_string(agg_key_step(dim_col))<<";\n";
+    code_<<"  agg_rem /= agg_radix"<<dim_idx<<";\n";
+  }
+  code_<<"  agg_map[agg_dims].Update(agg_array[agg_idx]);\n";
+  code_<<" }\n";
 }
 
-void ScanGenerator::SortResults(query::AggregateQuery* query) {
-  auto sort_columns = query->sort_cols();
-  if (!sort_columns.empty()) {
+void ScanGenerator::HashAggregation(query::AggregateQuery* query) {
+  // Filter selectivity isn't known in advance, so the hash table starts small, and is presized
+  // once the first full block shows what portion of records gets aggregated:
+  code_<<" agg_map.Reserve(std::min(agg_estimate, (size_t) "<<std::to_string(AGG_INITIAL_CAPACITY)<<"));\n";
+  code_<<" bool agg_presized = false;\n";
+  code_<<" AggDimensions block_keys["<<std::to_string(SCAN_BLOCK_SIZE)<<"];\n";
+  code_<<" uint64_t block_hashes["<<std::to_string(SCAN_BLOCK_SIZE)<<"];\n";
+
+  SegmentStart(query, true);
+  StarTreeScan(query);
+  CachedPartials(query);
+  TupleStart(query, true);
+
+  // Compute aggregation keys of selected tuples first, so their hash table
+  // slots can be prefetched ahead of aggregation:
+  code_<<"AggDimensions& agg_dims = block_keys[sel_idx];\n";
+  AggKeys(query);
+  code_<<"block_hashes[sel_idx] = AggMap::Hash(agg_dims);\n";
+  SelectionEnd();
+
+  code_<<"   if (!agg_presized && block_size == "<<std::to_string(SCAN_BLOCK_SIZE)<<") {\n";
+  code_<<"    agg_presized = true;\n";
+  code_<<"    agg_map.Reserve(std::min(agg_estimate, scan_estimate * selected / block_size + 1));\n";
+  code_<<"   }\n";
+  code_<<"   for (size_t sel_idx = 0; sel_idx < selected; ++sel_idx) {\n";
+  code_<<"    if (sel_idx + "<<std::to_string(AGG_PREFETCH_DISTANCE)<<" < selected) {\n";
+  code_<<"     agg_map.Prefetch(block_hashes[sel_idx + "<<std::to_string(AGG_PREFETCH_DISTANCE)<<"]);\n";
+  code_<<"    }\n";
+  code_<<"    Metrics& tuple_metrics = block_metrics[selection[sel_idx]];\n";
+  AggValues(query);
+  code_<<"    agg_map.Find(block_keys[sel_idx], block_hashes[sel_idx]).Update(agg_metrics);\n";
+  code_<<"   }\n";
+
+  IterationEnd(true);
+}
+
+void ScanGenerator::PartialScan(query::AggregateQuery* query) {
+  // Aggregates a single segment into a separate map, so the result can be cached:
+  code_<<" auto scan_partial = [&](Segment* segment, size_t segment_size, AggMap& agg_map) {\n";
+  code_<<" AggDimensions agg_dims;\n";
+  code_<<" AggMetrics agg_metrics;\n";
+  TupleStart(query, true);
+  AggKeys(query);
+  AggValues(query);
+  code_<<"    agg_map[agg_dims].Update(agg_metrics);\n";
+  SelectionEnd();
+  TupleEnd(true);
+  code_<<" };\n";
+}
 
-    // Sort the materialized records:
-    code_<<" std::sort(post_agg.begin(), post_agg.end(), [](const Row& a, const Row& b) {\n";
+void ScanGenerator::CachedPartials(query::AggregateQuery* query) {
+  if (query->time_dependent()) {
+    return;
+  }
+  // Full segments only change when their tuples are updated, which is tracked by their version:
+  code_<<"  if (partials != nullptr && segment_size == s->capacity()) {\n";
+  code_<<"   auto segment_version = s->version();\n";
+  code_<<"   auto segment_partial = std::static_pointer_cast<const AggMap>(partials->Get(segment_idx, segment_version));\n";
+  code_<<"   if (segment_partial) {\n";
+  code_<<"    worker_stats.scanned_segments--;\n";
+  code_<<"    worker_stats.scanned_recs -= segment_size;\n";
+  code_<<"    worker_stats.cached_segments++;\n";
+  code_<<"   } else {\n";
+  code_<<"    auto new_partial = std::make_shared<AggMap>();\n";
+  code_<<"    scan_partial(segment, segment_size, *new_partial);\n";
+  code_<<"    if (s->version() == segment_version) {\n";
+  code_<<"     partials->Put(segment_idx, segment_version, new_partial, new_partial->memory_size());\n";
+  code_<<"    }\n";
+  code_<<"    segment_partial = new_partial;\n";
+  code_<<"   }\n";
+  code_<<"   for (auto& entry : *segment_partial) {\n";
+  code_<<"    agg_map[entry.first].Update(entry.second);\n";
+  code_<<"   }\n";
+  code_<<"   continue;\n";
+  code_<<"  }\n";
+}
 
-    size_t sc_size = sort_columns.size();
-    for (size_t i = 0; i < sc_size; ++i) {
+/**
+ * Whether the query only groups and filters by dimensions of the table star-tree index
+ */
+static bool star_tree_applicable(query::AggregateQuery* query) {
+  auto& indexed = query->table().star_tree().dimensions();
+  auto is_indexed = [&indexed](const db::Column* column) {
+    return std::find(indexed.begin(), indexed.end(), column) != indexed.end();
+  };
+  if (indexed.empty()) {
+    return false;
+  }
+  for (auto& dim_col : query->dimension_cols()) {
+    if (!is_indexed(dim_col.dim())) {
+      return false;
+    }
+  }
+  query::FilterColumns filter_columns;
+  query->filter()->Accept(filter_columns);
+  auto& columns = filter_columns.columns();
+  return std::all_of(columns.begin(), columns.end(), is_indexed);
+}
 
-      auto& sort_column = sort_columns[i];
-      auto col_idx = std::to_string(sort_column.index());
-      auto col = sort_column.col();
+void ScanGenerator::StarTreeVisitor(query::AggregateQuery* query) {
+  auto& indexed = query->table().star_tree().dimensions();
+  query::FilterColumns filter_columns;
+  query->filter()->Accept(filter_columns);
+
+  // Levels of dimensions the query groups or filters by:
+  code_<<" const bool star_tree_needed[] = {";
+  for (size_t level = 0; level < indexed.size(); ++level) {
+    auto dim = indexed[level];
+    auto& columns = filter_columns.columns();
+    bool needed = std::find(columns.begin(), columns.end(), dim) != columns.end()
+      || std::any_of(query->dimension_cols().begin(), query->dimension_cols().end(),
+                     [dim](const query::DimOutputColumn& dim_col) { return dim_col.dim() == dim; });
+    code_<<(level > 0 ? ", " : "")<<(needed ? "true" : "false");
+  }
+  code_<<"};\n";
+
+  // Filter is checked on dimensions known at every level of the path, which is walked down:
+  code_<<" auto star_tree_prune = [&](const Dimensions& tuple_dims, size_t level) -> bool {\n";
+  code_<<"  switch (level) {\n";
+  std::vector<const db::Column*> known;
+  for (size_t level = 0; level < indexed.size(); ++level) {
+    known.push_back(indexed[level]);
+    PartialFilterComparison comparison(query->filter(), known);
+    code_<<"   case "<<std::to_string(level)<<": return "<<comparison.GenerateCode()<<";\n";
+  }
+  code_<<"  }\n";
+  code_<<"  return true;\n";
+  code_<<" };\n";
 
-      if (col->sort_type() == db::Column::SortType::STRING) {
-        auto sign = sort_column.ascending() ? "<" : ">";
-        code_<<"  if (a["<<col_idx<<"] "<<sign<<" b["<<col_idx<<"]) return true;\n";
-        if (i < sc_size - 1) {
-          code_<<"  if (b["<<col_idx<<"] "<<sign<<" a["<<col_idx<<"])";
-        }
-      } else {
-        std::string cmp_func = col->sort_type() == db::Column::SortType::INTEGER ? 
-          (sort_column.ascending() ? "SmallerInt" : "GreaterInt") :
-          (sort_column.ascending() ? "SmallerFloat" : "GreaterFloat");
-        code_<<"  if (util::StringNumCmp::"<<cmp_func<<"(a["<<col_idx<<"], b["<<col_idx<<"])) return true;\n";
-        if (i < sc_size - 1) {
-          code_<<"  if (util::StringNumCmp::"<<cmp_func<<"(b["<<col_idx<<"], a["<<col_idx<<"]))";
-        }
-      }
-      code_<<"  return false;\n";
+  code_<<" auto star_tree_visit = [&](const Dimensions& tuple_dims, const Metrics& tuple_metrics) {\n";
+  FilterComparison comparison(query->filter());
+  code_<<"  if ("<<comparison.GenerateCode()<<") {\n";
+  code_<<"   AggDimensions agg_dims;\n";
+  AggKeys(query);
+  AggValues(query);
+  code_<<"   agg_map[agg_dims].Update(agg_metrics);\n";
+  code_<<"  }\n";
+  code_<<" };\n";
+}
+
+void ScanGenerator::StarTreeScan(query::AggregateQuery* query) {
+  if (!star_tree_applicable(query)) {
+    return;
+  }
+  // The index is only used when it was built on the current version of the segment:
+  code_<<"  if (segment_size == s->capacity()) {\n";
+  code_<<"   auto star_tree = std::static_pointer_cast<const SegmentStarTree>(s->star_tree());\n";
+  code_<<"   if (star_tree && star_tree->version() == s->version()) {\n";
+  code_<<"    worker_stats.scanned_recs -= segment_size;\n";
+  code_<<"    worker_stats.scanned_recs += star_tree->Traverse(star_tree_needed, star_tree_prune, star_tree_visit);\n";
+  code_<<"    worker_stats.star_tree_segments++;\n";
+  code_<<"    continue;\n";
+  code_<<"   }\n";
+  code_<<"  }\n";
+}
+
+void ScanGenerator::SampledAggregation(query::AggregateQuery* query) {
+  code_<<" AggDimensions agg_dims;\n";
+  code_<<" double sample_log = std::log1p(-sample);\n";
+
+  SegmentStart(query, true);
+  code_<<"  worker_stats.sample_base_recs += segment_size;\n";
+
+  // Every tuple is sampled with the same probability. Instead of tossing a coin for every tuple,
+  // gaps between sampled tuples are drawn from the geometric distribution. Random generator
+  // (SplitMix64) is seeded by the segment, so the same data always gives the same sample:
+  code_<<"  uint64_t sample_state = (segment_idx + 1) * 0x9e3779b97f4a7c15ULL;\n";
+  code_<<"  auto sample_gap = [&]() -> size_t {\n";
+  code_<<"   uint64_t z = (sample_state += 0x9e3779b97f4a7c15ULL);\n";
+  code_<<"   z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;\n";
+  code_<<"   z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;\n";
+  code_<<"   double u = (double) ((z ^ (z >> 31)) >> 11) / 9007199254740992.0;\n";
+  code_<<"   double gap = std::log1p(-u) / sample_log;\n";
+  code_<<"   return gap < segment_size ? (size_t) gap + 1 : segment_size + 1;\n";
+  code_<<"  };\n";
+
+  code_<<"  for (size_t tuple_idx = sample_gap() - 1; tuple_idx < segment_size; tuple_idx += sample_gap()) {\n";
+  code_<<"   worker_stats.sampled_recs++;\n";
+  code_<<"   Dimensions& tuple_dims = segment->d[tuple_idx];\n";
+  code_<<"   Metrics& tuple_metrics = segment->m[tuple_idx];\n";
+  FilterComparison comparison(query->filter());
+  code_<<"   if ("<<comparison.GenerateCode()<<") {\n";
+  AggKeys(query);
+  AggValues(query);
+  for (auto& metric_col : query->metric_cols()) {
+    auto metric = metric_col.metric();
+    if (metric->additive()) {
+      auto metric_idx = std::to_string(metric->index());
+      code_<<"    agg_metrics._"<<metric_idx<<"_sq = (double) agg_metrics._"<<metric_idx
+        <<" * agg_metrics._"<<metric_idx<<";\n";
+    }
+  }
+  code_<<"    agg_map[agg_dims].Update(agg_metrics);\n";
+  code_<<"   }\n";
+  code_<<"  }\n";
+  code_<<" }\n";
+}
+
+void ScanGenerator::Scan(query::AggregateQuery* query) {
+  // Segments are scanned by the given number of workers, each one aggregating into its own map:
+  code_<<" struct ScanStats { size_t scanned_segments = 0; size_t cached_segments = 0; "
+    <<"size_t star_tree_segments = 0; size_t scanned_recs = 0; "
+    <<"size_t sample_base_recs = 0; size_t sampled_recs = 0; };\n";
+  code_<<" threads = std::max(threads, (size_t) 1);\n";
+  code_<<" std::vector<AggMap> agg_maps(threads);\n";
+  code_<<" std::vector<ScanStats> scan_stats(threads);\n";
+  code_<<" auto segments = table.store()->segments_copy();\n";
+  code_<<" std::atomic<size_t> next_segment(0);\n";
+
+  AggDomain(query);
+  AggEstimate(query);
+
+  code_<<" auto scan_worker = [&](size_t worker) {\n";
+  code_<<" AggMap& agg_map = agg_maps[worker];\n";
+  code_<<" ScanStats& worker_stats = scan_stats[worker];\n";
+  code_<<" AggMetrics agg_metrics;\n";
+
+  std::vector<const db::Dimension*> dims;
+  for (auto& dim_col : query->dimension_cols()) {
+    dims.push_back(dim_col.dim());
+  }
+  RollupDefs rollup_defs(dims);
+  code_<<rollup_defs.GenerateCode();
+
+  RollupReset rollup_reset(dims);
+  code_<<rollup_reset.GenerateCode();
+
+  if (query->sampled()) {
+    // Neither cached partials nor star-tree records can be sampled:
+    SampledAggregation(query);
+  } else {
+    if (!query->time_dependent()) {
+      PartialScan(query);
+    }
+    if (star_tree_applicable(query)) {
+      StarTreeVisitor(query);
     }
-    code_<<" });\n";
 
-    // Apply skip & limit during output:
-    code_<<" auto post_agg_end = limit > 0 ? post_agg.begin() + skip + limit : post_agg.end();\n";
-    code_<<" for (auto it = post_agg.begin() + skip; it != post_agg_end; ++it) {\n";
-    code_<<"  output.Send(*it);\n";
-    code_<<"  ++stats.output_recs;\n";
+    code_<<" if (agg_direct) {\n";
+    DirectAggregation(query);
+    code_<<" } else {\n";
+    HashAggregation(query);
+    code_<<" }\n";
+  }
+  code_<<" };\n";
+
+  // Run the workers, the calling thread being one of them:
+  code_<<" std::vector<std::exception_ptr> scan_errors(threads);\n";
+  code_<<" std::vector<std::thread> scan_threads;\n";
+  code_<<" for (size_t worker = 1; worker < threads; ++worker) {\n";
+  code_<<"  scan_threads.emplace_back([&, worker] {\n";
+  code_<<"   try { scan_worker(worker); } catch (...) { scan_errors[worker] = std::current_exception(); }\n";
+  code_<<"  });\n";
+  code_<<" }\n";
+  code_<<" try { scan_worker(0); } catch (...) { scan_errors[0] = std::current_exception(); }\n";
+  code_<<" for (auto& t : scan_threads) t.join();\n";
+  code_<<" for (auto& e : scan_errors) if (e) std::rethrow_exception(e);\n";
+
+  // Merge partial aggregations into the largest one:
+  code_<<" size_t largest = 0;\n";
+  code_<<" for (size_t worker = 1; worker < threads; ++worker) {\n";
+  code_<<"  if (agg_maps[worker].size() > agg_maps[largest].size()) largest = worker;\n";
+  code_<<" }\n";
+  code_<<" AggMap agg_map = std::move(agg_maps[largest]);\n";
+  code_<<" for (size_t worker = 0; worker < threads; ++worker) {\n";
+  code_<<"  stats.scanned_segments += scan_stats[worker].scanned_segments;\n";
+  code_<<"  stats.cached_segments += scan_stats[worker].cached_segments;\n";
+  code_<<"  stats.star_tree_segments += scan_stats[worker].star_tree_segments;\n";
+  code_<<"  stats.scanned_recs += scan_stats[worker].scanned_recs;\n";
+  code_<<"  if (worker == largest) continue;\n";
+  code_<<"  for (auto& partial : agg_maps[worker]) {\n";
+  code_<<"   agg_map[partial.first].Update(partial.second);\n";
+  code_<<"  }\n";
+  code_<<"  agg_maps[worker] = AggMap();\n";
+  code_<<" }\n";
+  code_<<" stats.scan_threads = threads;\n";
+  code_<<" stats.aggregated_recs = agg_map.size();\n";
+  if (query->sampled()) {
+    code_<<" size_t sample_base_recs = 0, sampled_recs = 0;\n";
+    code_<<" for (auto& worker_stats : scan_stats) {\n";
+    code_<<"  sample_base_recs += worker_stats.sample_base_recs;\n";
+    code_<<"  sampled_recs += worker_stats.sampled_recs;\n";
     code_<<" }\n";
+    code_<<" stats.sample_ratio = sample_base_recs > 0 ? (double) sampled_recs / sample_base_recs : sample;\n";
+  }
+}
+
+void ScanGenerator::SortResults(query::AggregateQuery* query) {
+  // Sort pointers to aggregated records on typed values, ordering only the requested page
+  // when the limit is set. Sort columns are only known at runtime, so comparison of every
+  // selected column is generated:
+  code_<<" std::vector<AggMap::Entry*> sorted;\n";
+  code_<<" sorted.reserve(agg_map.size());\n";
+  code_<<" for (auto& entry : agg_map) sorted.push_back(&entry);\n";
+  code_<<" size_t sort_end = limit > 0 ? skip + limit : sorted.size();\n";
+  code_<<" if (!sort.empty()) {\n";
+
+  size_t col_num = 0;
+  for (auto& dim_col : query->dimension_cols()) {
+    auto dim = dim_col.dim();
+    if (dim->dim_type() == db::Dimension::DimType::STRING) {
+      auto dim_idx = std::to_string(dim->index());
+      code_<<"  std::shared_ptr<const db::DictOrder> sort_order"<<dim_idx<<";\n";
+      code_<<"  const uint32_t* sort_ranks"<<dim_idx<<" = nullptr;\n";
+      code_<<"  for (auto& s : sort) {\n";
+      code_<<"   if (s.first == "<<std::to_string(col_num)<<") {\n";
+      code_<<"    sort_order"<<dim_idx<<" = dict"<<dim_idx<<"->Order();\n";
+      code_<<"    sort_ranks"<<dim_idx<<" = sort_order"<<dim_idx<<"->ranks.data();\n";
+      code_<<"   }\n";
+      code_<<"  }\n";
+    }
+    ++col_num;
+  }
+
+  code_<<"  auto sort_cmp = [&](AggMap::Entry* a, AggMap::Entry* b) {\n";
+  code_<<"   for (auto& s : sort) {\n";
+  code_<<"    AggMap::Entry* x = s.second ? a : b;\n";
+  code_<<"    AggMap::Entry* y = s.second ? b : a;\n";
+  code_<<"    switch (s.first) {\n";
+
+  col_num = 0;
+  for (auto& dim_col : query->dimension_cols()) {
+    auto dim = dim_col.dim();
+    auto dim_idx = std::to_string(dim->index());
+    std::string vx, vy;
+    if (dim->dim_type() == db::Dimension::DimType::STRING) {
+      // Dictionary order contains all the aggregated codes, since it's taken after the scan:
+      vx = "sort_ranks" + dim_idx + "[x->first._" + dim_idx + "]";
+      vy = "sort_ranks" + dim_idx + "[y->first._" + dim_idx + "]";
+    } else {
+      vx = "x->first._" + dim_idx;
+      vy = "y->first._" + dim_idx;
+    }
+    code_<<"     case "<<std::to_string(col_num++)<<":\n";
+    code_<<"      if ("<<vx<<" < "<<vy<<") return true;\n";
+    code_<<"      if ("<<vy<<" < "<<vx<<") return false;\n";
+    code_<<"      break;\n";
   }
+  for (auto& metric_col : query->metric_cols()) {
+    auto metric = metric_col.metric();
+    auto metric_idx = std::to_string(metric->index());
+    std::string vx = "x->second._" + metric_idx;
+    std::string vy = "y->second._" + metric_idx;
+    if (metric->agg_type() == db::Metric::AggregationType::BITSET) {
+      vx += ".cardinality()";
+      vy += ".cardinality()";
+    }
+    code_<<"     case "<<std::to_string(col_num++)<<":\n";
+    code_<<"      if ("<<vx<<" < "<<vy<<") return true;\n";
+    code_<<"      if ("<<vy<<" < "<<vx<<") return false;\n";
+    code_<<"      break;\n";
+  }
+  code_<<"    }\n";
+  code_<<"   }\n";
+  code_<<"   return false;\n";
+  code_<<"  };\n";
+
+  code_<<"  if (sort_end < sorted.size()) {\n";
+  code_<<"   std::partial_sort(sorted.begin(), sorted.begin() + sort_end, sorted.end(), sort_cmp);\n";
+  code_<<"  } else {\n";
+  code_<<"   std::sort(sorted.begin(), sorted.end(), sort_cmp);\n";
+  code_<<"  }\n";
+  code_<<" }\n";
 }
 
 void ScanGenerator::Materialize(query::AggregateQuery* query) {
@@ -154,51 +687,56 @@ void ScanGenerator::Materialize(query::AggregateQuery* query) {
     }
   }
 
-  auto sort_columns = query->sort_cols();
+  // Standard errors of estimated sums and counts follow the selected columns:
+  std::vector<const db::Metric*> error_metrics;
+  if (query->sampled()) {
+    for (auto& metric_col : query->metric_cols()) {
+      if (metric_col.metric()->additive()) {
+        error_metrics.push_back(metric_col.metric());
+      }
+    }
+  }
+  size_t selected_cols = query->dimension_cols().size() + query->metric_cols().size();
+
   code_<<" typedef std::vector<std::string> Row;\n";
-  code_<<" Row row("<<std::to_string(query->dimension_cols().size() + query->metric_cols().size())<<");\n";
+  code_<<" Row row("<<std::to_string(selected_cols + error_metrics.size())<<");\n";
   code_<<" util::Format fmt;\n";
   
   // Calculate how much records we should skip / drop:
   code_<<" skip = std::min(agg_map.size(), skip);\n";
   code_<<" limit = std::min(limit, agg_map.size() - skip);\n";
 
-  code_<<" auto agg_it = agg_map.begin();\n";
-  code_<<" auto agg_end = agg_map.end();\n";
-  if (sort_columns.empty()) {
-    // Just skip & limit on the agg_map:
-    code_<<" std::advance(agg_it, skip);\n";
-    code_<<" if (limit > 0) {\n";
-    code_<<"  agg_end = agg_it;\n";
-    code_<<"  std::advance(agg_end, limit);\n";
-    code_<<" }\n";
-  } else {
-    // Create additional structure to keep materialized records that will be sorted:
-    code_<<" std::vector<Row> post_agg;\n";
-  }
+  SortResults(query);
 
   code_<<" output.Start();\n";
 
   // Print header if requested:
-  if (query->header()) {
-    for (auto& dim_col : query->dimension_cols()) {
-      code_<<" row["<<std::to_string(dim_col.index())
-        <<"] = table.dimension("<<std::to_string(dim_col.dim()->index())<<")->name();\n";
-    }
-    for (auto& metric_col : query->metric_cols()) {
-      code_<<" row["<<std::to_string(metric_col.index())
-        <<"] = table.metric("<<std::to_string(metric_col.metric()->index())<<")->name();\n";
-    }
-    code_<<" output.Send(row);\n";
+  code_<<" if (header) {\n";
+  size_t col_num = 0;
+  for (auto& dim_col : query->dimension_cols()) {
+    code_<<"  row[columns["<<std::to_string(col_num++)
+      <<"]] = table.dimension("<<std::to_string(dim_col.dim()->index())<<")->name();\n";
   }
+  for (auto& metric_col : query->metric_cols()) {
+    code_<<"  row[columns["<<std::to_string(col_num++)
+      <<"]] = table.metric("<<std::to_string(metric_col.metric()->index())<<")->name();\n";
+  }
+  for (size_t i = 0; i < error_metrics.size(); ++i) {
+    code_<<"  row["<<std::to_string(selected_cols + i)
+      <<"] = table.metric("<<std::to_string(error_metrics[i]->index())<<")->name() + \"_error\";\n";
+  }
+  code_<<"  output.Send(row);\n";
+  code_<<" }\n";
 
-  // Iterate on agg_map, and materialize output records:
-  code_<<" for (; agg_it != agg_end; ++agg_it) {\n";
+  // Iterate on (sorted) aggregated records, and materialize output records:
+  code_<<" for (size_t sorted_idx = skip; sorted_idx < sort_end; ++sorted_idx) {\n";
+  code_<<"  auto agg_it = sorted[sorted_idx];\n";
 
+  col_num = 0;
   for (auto& dim_col : query->dimension_cols()) {
     auto dimension = dim_col.dim();
     auto dim_idx = std::to_string(dimension->index());
-    auto col_idx = std::to_string(dim_col.index());
+    auto col_idx = "columns[" + std::to_string(col_num++) + "]";
 
     if (dimension->dim_type() == db::Dimension::DimType::STRING) {
       code_<<"  dict"<<dim_idx<<"->lock().lock_shared();\n";
@@ -218,28 +756,37 @@ void ScanGenerator::Materialize(query::AggregateQuery* query) {
   for (auto& metric_col : query->metric_cols()) {
     auto metric = metric_col.metric();
     auto metric_idx = std::to_string(metric->index());
-    code_<<"  row["<<std::to_string(metric_col.index())<<"] = fmt.num(agg_it->second._"<<metric_idx;
-    if (metric->agg_type() == db::Metric::AggregationType::BITSET) {
-      code_<<".cardinality()";
+    code_<<"  row[columns["<<std::to_string(col_num++)<<"]] = fmt.num(";
+    if (query->sampled() && metric->additive()) {
+      // Scale the sampled value to the estimate of the whole:
+      if (metric->sort_type() == db::Column::SortType::FLOAT) {
+        code_<<"agg_it->second._"<<metric_idx<<" / sample";
+      } else {
+        code_<<"("<<metric->num_type().cpp_type()<<") std::round(agg_it->second._"<<metric_idx<<" / sample)";
+      }
+    } else {
+      code_<<"agg_it->second._"<<metric_idx;
+      if (metric->agg_type() == db::Metric::AggregationType::BITSET) {
+        code_<<".cardinality()";
+      }
     }
     code_<<");\n";
   }
-  if (sort_columns.empty()) {
-    code_<<"  output.Send(row);\n";
-    code_<<"  ++stats.output_recs;\n";
-  } else {
-    code_<<"  post_agg.push_back(row);\n";
+  for (size_t i = 0; i < error_metrics.size(); ++i) {
+    auto metric_idx = std::to_string(error_metrics[i]->index());
+    code_<<"  row["<<std::to_string(selected_cols + i)<<"] = fmt.num(std::sqrt((1.0 - sample) * agg_it->second._"
+      <<metric_idx<<"_sq) / sample);\n";
   }
+  code_<<"  output.Send(row);\n";
+  code_<<"  ++stats.output_recs;\n";
   code_<<" }\n";
-
-  SortResults(query);
   code_<<" output.Flush();\n";
 }
 
 void ScanGenerator::Visit(query::AggregateQuery* query) {
   code_.AddHeaders({
-    "unordered_map", "query/output.h", "query/stats.h", "db/table.h",
-      "db/dictionary.h", "db/store.h", "util/format.h", "util/string.h"
+    "thread", "atomic", "exception", "query/output.h", "query/stats.h", "query/cache.h", "db/table.h",
+      "db/dictionary.h", "db/store.h", "util/format.h", "algorithm", "utility", "memory", "cmath"
   });
 
   code_<<"namespace query = viya::query;\n";
@@ -256,14 +803,21 @@ void ScanGenerator::Visit(query::AggregateQuery* query) {
   for (auto& metric_col : query->metric_cols()) {
     metrics.push_back(metric_col.metric());
   }
-  MetricsStruct metrics_struct(metrics, "AggMetrics");
+  MetricsStruct metrics_struct(metrics, "AggMetrics", query->sampled());
   code_<<metrics_struct.GenerateCode();
 
+  AggTableStruct agg_table("AggMap", "AggDimensions", "AggMetrics");
+  code_<<agg_table.GenerateCode();
+
   code_<<"extern \"C\" void viya_query_agg(db::Table& table, query::RowOutput& output, "
-    <<"query::QueryStats& stats, std::vector<db::AnyNum> fargs, size_t skip, size_t limit) __attribute__((__visibility__(\"default\")));\n";
+    <<"query::QueryStats& stats, std::vector<db::AnyNum> fargs, size_t skip, size_t limit, size_t threads, "
+    <<"bool header, const std::vector<size_t>& columns, const std::vector<std::pair<size_t, bool>>& sort, "
+    <<"query::SegmentPartials* partials, double sample) __attribute__((__visibility__(\"default\")));\n";
 
   code_<<"extern \"C\" void viya_query_agg(db::Table& table, query::RowOutput& output, "
-    <<"query::QueryStats& stats, std::vector<db::AnyNum> fargs, size_t skip, size_t limit) {\n";
+    <<"query::QueryStats& stats, std::vector<db::AnyNum> fargs, size_t skip, size_t limit, size_t threads, "
+    <<"bool header, const std::vector<size_t>& columns, const std::vector<std::pair<size_t, bool>>& sort, "
+    <<"query::SegmentPartials* partials, double sample) {\n";
 
   UnpackArguments(query);
   Scan(query);
@@ -357,5 +911,31 @@ query::SearchQueryFn QueryGenerator::SearchQueryFunction() {
   return GenerateFunction<query::SearchQueryFn>(std::string("viya_query_search"));
 }
 
+query::AggQueryFn QueryGenerator::AggQueryFunctionAsync() {
+  return GenerateFunctionAsync<query::AggQueryFn>(std::string("viya_query_agg"));
+}
+
+query::SearchQueryFn QueryGenerator::SearchQueryFunctionAsync() {
+  return GenerateFunctionAsync<query::SearchQueryFn>(std::string("viya_query_search"));
+}
+
+void QueryGenerator::Compile() {
+  class FunctionCompiler: public query::QueryVisitor {
+    public:
+      FunctionCompiler(QueryGenerator& generator):generator_(generator) {}
+
+      void Visit(query::AggregateQuery* query __attribute__((unused))) { generator_.AggQueryFunction(); }
+      void Visit(query::SearchQuery* query __attribute__((unused))) { generator_.SearchQueryFunction(); }
+
+    private:
+      QueryGenerator& generator_;
+  };
+
+  // Queries are compiled ahead of time, so they're optimized right away:
+  tiered_ = false;
+  FunctionCompiler function_compiler(*this);
+  query_.Accept(function_compiler);
+}
+
 }}
 
@@ -18,8 +18,24 @@ class ScanGenerator: public query::QueryVisitor {
     void Visit(query::SearchQuery* query);
 
   private:
-    void IterationStart(query::FilterBasedQuery* query);
-    void IterationEnd();
+    void IterationStart(query::FilterBasedQuery* query, bool parallel = false, bool batched = false);
+    void SegmentStart(query::FilterBasedQuery* query, bool parallel);
+    void TupleStart(query::FilterBasedQuery* query, bool batched);
+    void SelectionEnd();
+    void TupleEnd(bool batched);
+    void IterationEnd(bool batched = false);
+
+    void AggDomain(query::AggregateQuery* query);
+    void AggEstimate(query::AggregateQuery* query);
+    void AggKeys(query::AggregateQuery* query);
+    void AggValues(query::AggregateQuery* query);
+    void DirectAggregation(query::AggregateQuery* query);
+    void HashAggregation(query::AggregateQuery* query);
+    void PartialScan(query::AggregateQuery* query);
+    void SampledAggregation(query::AggregateQuery* query);
+    void CachedPartials(query::AggregateQuery* query);
+    void StarTreeVisitor(query::AggregateQuery* query);
+    void StarTreeScan(query::AggregateQuery* query);
 
     void UnpackArguments(query::FilterBasedQuery* query);
 
@@ -33,19 +49,46 @@ class ScanGenerator: public query::QueryVisitor {
     void Materialize(query::SearchQuery* query);
 
   private:
+    // Number of tuples, which filter is evaluated on at once in batched mode:
+    static const size_t SCAN_BLOCK_SIZE = 1024;
+
+    // How many selected tuples ahead aggregation hash table slots are prefetched:
+    static const size_t AGG_PREFETCH_DISTANCE = 8;
+
+    // Number of groups aggregation hash table is sized for before the scan starts:
+    static const size_t AGG_INITIAL_CAPACITY = 4096;
+
+    // Upper bound on the number of groups aggregation hash table is presized for:
+    static const size_t AGG_PRESIZE_LIMIT = 262144;
+
+    // Maximal number of cells in aggregation arrays (of all scan workers), which are used
+    // instead of hash tables when key space is small enough:
+    static const size_t AGG_DIRECT_LIMIT = 1048576;
+
+    // How many times aggregation array may be larger than the number of records a scan worker
+    // is expected to aggregate into it:
+    static const size_t AGG_DIRECT_SPARSITY = 4;
+
     Code& code_;
 };
 
 class QueryGenerator: public FunctionGenerator {
   public:
     QueryGenerator(Compiler& compiler, query::Query& query)
-      :FunctionGenerator(compiler),query_(query) {}
+      :FunctionGenerator(compiler, true),query_(query) {}
 
     QueryGenerator(const QueryGenerator& other) = delete;
 
     Code GenerateCode() const;
     query::AggQueryFn AggQueryFunction();
     query::SearchQueryFn SearchQueryFunction();
+    query::AggQueryFn AggQueryFunctionAsync();
+    query::SearchQueryFn SearchQueryFunctionAsync();
+
+    /**
+     * Compiles the query function ahead of running the query
+     */
+    void Compile();
 
   private:
     query::Query& query_;
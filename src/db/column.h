@@ -46,14 +46,14 @@ class UIntType: public NumericType {
 
 class AnyNum {
   public:
-    AnyNum() {}
-    AnyNum(uint8_t num) { *reinterpret_cast<uint8_t*>(s_.data()) = num; }
-    AnyNum(uint16_t num) { *reinterpret_cast<uint16_t*>(s_.data()) = num; }
-    AnyNum(uint32_t num) { *reinterpret_cast<uint32_t*>(s_.data()) = num; }
-    AnyNum(uint64_t num) { *reinterpret_cast<uint64_t*>(s_.data()) = num; }
-    AnyNum(int32_t num) { *reinterpret_cast<int32_t*>(s_.data()) = num; }
-    AnyNum(int64_t num) { *reinterpret_cast<int64_t*>(s_.data()) = num; }
-    AnyNum(double num) { *reinterpret_cast<double*>(s_.data()) = num; }
+    AnyNum():s_() {}
+    AnyNum(uint8_t num):s_() { *reinterpret_cast<uint8_t*>(s_.data()) = num; }
+    AnyNum(uint16_t num):s_() { *reinterpret_cast<uint16_t*>(s_.data()) = num; }
+    AnyNum(uint32_t num):s_() { *reinterpret_cast<uint32_t*>(s_.data()) = num; }
+    AnyNum(uint64_t num):s_() { *reinterpret_cast<uint64_t*>(s_.data()) = num; }
+    AnyNum(int32_t num):s_() { *reinterpret_cast<int32_t*>(s_.data()) = num; }
+    AnyNum(int64_t num):s_() { *reinterpret_cast<int64_t*>(s_.data()) = num; }
+    AnyNum(double num):s_() { *reinterpret_cast<double*>(s_.data()) = num; }
 
     uint8_t get_uint8_t() { return *reinterpret_cast<uint8_t*>(s_.data()); }
     uint16_t get_uint16_t() { return *reinterpret_cast<uint16_t*>(s_.data()); }
@@ -63,6 +63,9 @@ class AnyNum {
     int64_t get_int64_t() { return *reinterpret_cast<int64_t*>(s_.data()); }
     double get_double() { return *reinterpret_cast<double*>(s_.data()); }
 
+    const char* data() const { return s_.data(); }
+    static constexpr size_t size() { return sizeof(s_); }
+
   private:
     std::array<char, 8> s_;
 };
@@ -176,6 +179,11 @@ class Metric: public Column {
 
     AggregationType agg_type() const { return agg_type_; }
 
+    /**
+     * Whether aggregated value grows with the number of aggregated tuples
+     */
+    bool additive() const { return agg_type_ == SUM || agg_type_ == COUNT; }
+
   private:
     const AggregationType agg_type_;
 };
@@ -1,8 +1,12 @@
+#include <thread>
+#include <memory>
+#include <exception>
 #include <json.hpp>
 #include <glog/logging.h>
 #include "db/database.h"
 #include "db/table.h"
 #include "query/runner.h"
+#include "codegen/query/query.h"
 #include "input/loader.h"
 
 namespace viya {
@@ -12,11 +16,36 @@ Database::Database(const util::Config& config)
   :compiler_(config.sub("compiler")),
   write_pool_(1),
   read_pool_(config.num("query_threads", 1)),
-  watcher_(*this) {
+  watcher_(*this),
+  query_parallelism_(config.num("query_parallelism", 1)),
+  scan_threads_(config.num("scan_threads", std::thread::hardware_concurrency())),
+  scan_threads_used_(0),
+  interpret_cold_queries_(config.boolean("interpret_cold_queries", false)),
+  result_cache_(config.num("query_cache_size", 0)),
+  partial_cache_(config.num("partial_cache_size", 0)),
+  ingest_pool_(config.num("ingest_threads", 1)) {
 
   if (config.exists("tables")) {
-    for (const util::Config& table_conf : config.sublist("tables")) {
-      CreateTable(table_conf);
+    // Code of different tables is generated and compiled in parallel:
+    auto tables_conf = config.sublist("tables");
+    std::vector<std::exception_ptr> errors(tables_conf.size());
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < tables_conf.size(); ++i) {
+      threads.emplace_back([this, &tables_conf, &errors, i] {
+        try {
+          CreateTable(tables_conf[i]);
+        } catch (...) {
+          errors[i] = std::current_exception();
+        }
+      });
+    }
+    for (auto& t : threads) {
+      t.join();
+    }
+    for (auto& error : errors) {
+      if (error) {
+        std::rethrow_exception(error);
+      }
     }
   }
 
@@ -26,22 +55,52 @@ Database::Database(const util::Config& config)
 }
 
 Database::~Database() {
+  // Pending loads are dropped, and running ones are waited for:
+  ingest_pool_.stop();
+
   for (auto& it : tables_) {
     delete it.second;
   }
 }
 
 void Database::CreateTable(const util::Config& table_conf) {
-  lock_.lock();
   std::string name = table_conf.str("name");
   LOG(INFO)<<"Creating table: "<<name;
-  auto it = tables_.find(name);
-  if (it != tables_.end()) {
+  lock_.lock_shared();
+  bool exists = tables_.find(name) != tables_.end();
+  lock_.unlock_shared();
+  if (exists) {
+    throw std::runtime_error("Table already exists: " + name);
+  }
+
+  // Table code is compiled without holding the lock, so other tables remain accessible:
+  auto table = new Table(table_conf, *this);
+
+  lock_.lock();
+  if (!tables_.insert(std::make_pair(name, table)).second) {
     lock_.unlock();
+    delete table;
     throw std::runtime_error("Table already exists: " + name);
   }
-  tables_.insert(std::make_pair(name, new Table(table_conf, *this)));
   lock_.unlock();
+
+  // Files can only be loaded once the table is accessible by name:
+  if (table_conf.exists("watch")) {
+    try {
+      watcher_.AddWatch(table_conf.sub("watch"), table);
+    } catch (...) {
+      DropTable(name);
+      throw;
+    }
+  }
+
+  if (table_conf.exists("warmup_queries")) {
+    try {
+      Warmup(name, table_conf.sublist("warmup_queries"));
+    } catch (std::exception& e) {
+      LOG(WARNING)<<"Error warming up table "<<name<<": "<<e.what();
+    }
+  }
 }
 
 void Database::DropTable(const std::string& name) {
@@ -54,8 +113,16 @@ void Database::DropTable(const std::string& name) {
   }
   auto table = it->second;
   tables_.erase(it);
+  std::vector<std::string> names { name };
+  for (auto view : table->views()) {
+    names.push_back(view->name());
+  }
   delete table;
   lock_.unlock();
+  for (auto& dropped : names) {
+    result_cache_.Invalidate(dropped);
+    partial_cache_.Invalidate(dropped);
+  }
 }
 
 Table* Database::GetTable(const std::string& name) {
@@ -82,9 +149,50 @@ void Database::PrintMetadata(std::string& metadata) {
     meta["tables"].push_back(table_meta);
   }
   lock_.unlock_shared();
+
+  auto compiler_stats = compiler_.stats();
+  meta["compiler"] = {
+    {"libraries", compiler_stats.libraries},
+    {"hits", compiler_stats.hits},
+    {"misses", compiler_stats.misses},
+    {"evictions", compiler_stats.evictions},
+    {"disk_evictions", compiler_stats.disk_evictions}
+  };
+  auto cache_stats = result_cache_.stats();
+  meta["query_cache"] = {
+    {"entries", cache_stats.entries},
+    {"size", cache_stats.size},
+    {"hits", cache_stats.hits},
+    {"misses", cache_stats.misses},
+    {"evictions", cache_stats.evictions}
+  };
+  cache_stats = partial_cache_.stats();
+  meta["partial_cache"] = {
+    {"entries", cache_stats.entries},
+    {"size", cache_stats.size},
+    {"hits", cache_stats.hits},
+    {"misses", cache_stats.misses},
+    {"evictions", cache_stats.evictions}
+  };
   metadata = meta.dump();
 }
 
+size_t Database::AcquireScanThreads(size_t requested) {
+  size_t wanted = requested > 1 ? requested - 1 : 0;
+  size_t used = scan_threads_used_.load();
+  size_t granted;
+  do {
+    granted = std::min(wanted, scan_threads_ > used ? scan_threads_ - used : 0);
+  } while (granted > 0 && !scan_threads_used_.compare_exchange_weak(used, used + granted));
+  return granted + 1;
+}
+
+void Database::ReleaseScanThreads(size_t threads) {
+  if (threads > 1) {
+    scan_threads_used_ -= threads - 1;
+  }
+}
+
 query::QueryStats Database::Query(const util::Config& query_conf, query::RowOutput& output) {
   query::QueryFactory query_factory;
   auto* q = query_factory.Create(query_conf, *this);
@@ -94,6 +202,39 @@ query::QueryStats Database::Query(const util::Config& query_conf, query::RowOutp
   return query_runner.stats();
 }
 
+void Database::Warmup(const std::string& table_name, const std::vector<util::Config>& queries) {
+  LOG(INFO)<<"Warming up "<<std::to_string(queries.size())<<" queries on table: "<<table_name;
+
+  // There's no point in running more workers than the number of parallel compilations:
+  std::vector<std::exception_ptr> errors(queries.size());
+  std::atomic<size_t> next_query(0);
+  auto warmup_worker = [this, &table_name, &queries, &errors, &next_query] {
+    for (size_t i = next_query++; i < queries.size(); i = next_query++) {
+      try {
+        util::Config query_conf(queries[i]);
+        query_conf.set_str("table", table_name.c_str());
+        std::unique_ptr<query::Query> query(query::QueryFactory().Create(query_conf, *this));
+        cg::QueryGenerator(compiler_, *query).Compile();
+      } catch (...) {
+        errors[i] = std::current_exception();
+      }
+    }
+  };
+  std::vector<std::thread> threads;
+  for (size_t worker = 0; worker < std::min(compiler_.max_parallel(), queries.size()); ++worker) {
+    threads.emplace_back(warmup_worker);
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  for (auto& error : errors) {
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+}
+
 void Database::Load(const util::Config& load_conf) {
   input::LoaderFactory loader_factory;
   auto loader = loader_factory.Create(load_conf, *this);
@@ -2,10 +2,12 @@
 #define VIYA_DB_DATABASE_H_
 
 #include <unordered_map>
+#include <atomic>
 #include <CTPL/ctpl.h>
 #include "db/dictionary.h"
 #include "query/output.h"
 #include "query/stats.h"
+#include "query/cache.h"
 #include "codegen/compiler.h"
 #include "input/watcher.h"
 #include "util/config.h"
@@ -37,10 +39,41 @@ class Database {
     Dictionaries& dicts() { return dicts_; }
     ctpl::thread_pool& read_pool() { return read_pool_; }
     ctpl::thread_pool& write_pool() { return write_pool_; }
+    ctpl::thread_pool& ingest_pool() { return ingest_pool_; }
     input::Watcher& watcher() { return watcher_; }
     const util::Statsd& statsd() const { return statsd_; }
 
+    /**
+     * Admission of intra-query scan parallelism: returns the number of threads (including
+     * the calling one) a query may scan with, which is less than requested when other queries
+     * have already used up the "scan_threads" budget. Granted threads must be released.
+     */
+    size_t AcquireScanThreads(size_t requested);
+    void ReleaseScanThreads(size_t threads);
+    size_t query_parallelism() const { return query_parallelism_; }
+
+    /**
+     * Whether queries, which are not compiled yet, are interpreted while being compiled in background
+     */
+    bool interpret_cold_queries() const { return interpret_cold_queries_; }
+
+    /**
+     * Results of queries on tables, which didn't change since the query was run
+     */
+    query::ResultCache& result_cache() { return result_cache_; }
+
+    /**
+     * Partial aggregations of full segments, which are reused by queries of the same shape and arguments
+     */
+    query::QueryCache& partial_cache() { return partial_cache_; }
+
     query::QueryStats Query(const util::Config& query_conf, query::RowOutput& output);
+
+    /**
+     * Compiles queries on the given table in parallel without running them, so they're ready
+     * by the time they're requested. Throws the first error after all queries are processed.
+     */
+    void Warmup(const std::string& table_name, const std::vector<util::Config>& queries);
     void Load(const util::Config& load_conf);
 
   private:
@@ -54,6 +87,16 @@ class Database {
 
     input::Watcher watcher_;
     util::Statsd statsd_;
+
+    size_t query_parallelism_;      // default number of scan threads per query
+    size_t scan_threads_;           // additional scan threads shared by all running queries
+    std::atomic<size_t> scan_threads_used_;
+    bool interpret_cold_queries_;
+    query::ResultCache result_cache_;
+    query::QueryCache partial_cache_;
+
+    // Runs loads of watched files; its size is the global ingestion threads budget:
+    ctpl::thread_pool ingest_pool_;
 };
 
 }}
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include "db/dictionary.h"
 
 namespace viya {
@@ -63,6 +64,78 @@ AnyNum DimensionDict::Decode(const std::string& value) {
   return code;
 }
 
+AnyNum DimensionDict::TypedCode(uint64_t code) const {
+  switch (code_type_.size()) {
+    case NumericType::Size::_1:
+      return AnyNum((uint8_t) code);
+    case NumericType::Size::_2:
+      return AnyNum((uint16_t) code);
+    case NumericType::Size::_4:
+      return AnyNum((uint32_t) code);
+    default:
+      return AnyNum((uint64_t) code);
+  }
+}
+
+std::shared_ptr<const DictOrder> DimensionDict::Order() {
+  std::lock_guard<std::mutex> guard(order_mutex_);
+  size_t prev_size = order_ ? order_->ranks.size() : 0;
+
+  lock_.lock_shared();
+  size_t size = c2v_.size();
+  if (order_ && size == prev_size) {
+    lock_.unlock_shared();
+    return order_;
+  }
+
+  // Sort new values, and merge them with previously ordered ones:
+  auto order = std::make_shared<DictOrder>();
+  std::vector<uint64_t> added(size - prev_size);
+  for (size_t i = 0; i < added.size(); ++i) {
+    added[i] = prev_size + i;
+  }
+  auto value_cmp = [this](uint64_t a, uint64_t b) { return c2v_[a] < c2v_[b]; };
+  std::sort(added.begin(), added.end(), value_cmp);
+  order->sorted.resize(size);
+  if (order_) {
+    std::merge(order_->sorted.begin(), order_->sorted.end(), added.begin(), added.end(),
+               order->sorted.begin(), value_cmp);
+  } else {
+    std::copy(added.begin(), added.end(), order->sorted.begin());
+  }
+  lock_.unlock_shared();
+
+  order->ranks.resize(size);
+  for (size_t rank = 0; rank < size; ++rank) {
+    order->ranks[order->sorted[rank]] = rank;
+  }
+  order_ = order;
+  return order_;
+}
+
+AnyNum DimensionDict::DecodeBound(const std::string& value, bool below, bool inclusive) {
+  auto order = Order();
+  auto& sorted = order->sorted;
+
+  lock_.lock_shared();
+  size_t pos;
+  if (below != inclusive) {
+    // First value, which is not less than the given one:
+    pos = std::lower_bound(sorted.begin(), sorted.end(), value,
+                           [this](uint64_t code, const std::string& v) { return c2v_[code] < v; }) - sorted.begin();
+  } else {
+    // First value, which is greater than the given one:
+    pos = std::upper_bound(sorted.begin(), sorted.end(), value,
+                           [this](const std::string& v, uint64_t code) { return v < c2v_[code]; }) - sorted.begin();
+  }
+  lock_.unlock_shared();
+
+  if (below) {
+    return pos > 0 ? TypedCode(sorted[pos - 1]) : TypedCode(UINT64_MAX);
+  }
+  return pos < sorted.size() ? TypedCode(sorted[pos]) : TypedCode(UINT64_MAX);
+}
+
 DimensionDict::~DimensionDict() {
   switch (code_type_.size()) {
     case NumericType::Size::_1:
@@ -2,6 +2,8 @@
 #define VIYA_DB_DICTIONARY_H_
 
 #include <vector>
+#include <memory>
+#include <mutex>
 #include <unordered_map>
 #include "util/rwlock.h"
 #include "db/column.h"
@@ -17,6 +19,15 @@ class DictImpl: public std::unordered_map<std::string, V> {
     }
 };
 
+/**
+ * Order of dictionary values: codes sorted by their values, and rank of every code
+ * in this sorted list. Covers codes that existed when the order was built.
+ */
+struct DictOrder {
+  std::vector<uint32_t> ranks;  // code to rank
+  std::vector<uint64_t> sorted; // rank to code
+};
+
 class DimensionDict {
   public:
     DimensionDict(const NumericType& code_type);
@@ -28,11 +39,29 @@ class DimensionDict {
 
     AnyNum Decode(const std::string& value);
 
+    /**
+     * Returns code of the greatest value below the given one (or the smallest value above it),
+     * including the value itself if requested. If there's no such value, the code returned
+     * for missing values by Decode() is returned instead.
+     */
+    AnyNum DecodeBound(const std::string& value, bool below, bool inclusive);
+
+    /**
+     * Returns current order of dictionary values. New values are merged into the order
+     * lazily, when it's requested after they were added.
+     */
+    std::shared_ptr<const DictOrder> Order();
+
+  private:
+    AnyNum TypedCode(uint64_t code) const;
+
   private:
     const NumericType& code_type_;
     folly::RWSpinLock lock_;
     std::vector<std::string> c2v_; // code to value
     void* v2c_;                    // value to code
+    std::mutex order_mutex_;
+    std::shared_ptr<const DictOrder> order_;
 };
 
 class Dictionaries {
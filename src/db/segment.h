@@ -2,14 +2,27 @@
 #define VIYA_DB_SEGMENT_H_
 
 #include <cstdio>
+#include <vector>
+#include <atomic>
+#include <memory>
 #include "util/rwlock.h"
 
 namespace viya {
 namespace db {
 
+/**
+ * Describes where tuple fields are placed in generated segment structures
+ */
+struct SegmentLayout {
+  size_t dims_size;                  // size of dimensions structure
+  size_t metrics_size;               // size of metrics structure
+  std::vector<size_t> dim_offsets;   // offset of every dimension by its index
+  std::vector<size_t> metric_offsets; // offset of every metric by its index
+};
+
 class SegmentBase {
   public:
-    SegmentBase(size_t capacity):size_(0),capacity_(capacity) {};
+    SegmentBase(size_t capacity):size_(0),capacity_(capacity),version_(0) {};
 
     SegmentBase(const SegmentBase& other) = delete;
     virtual ~SegmentBase() {}
@@ -25,6 +38,30 @@ class SegmentBase {
 
     size_t capacity() const  { return capacity_; }
 
+    /**
+     * Changes whenever tuples of the segment are updated in place
+     */
+    uint64_t version() const { return version_.load(std::memory_order_acquire); }
+
+    /**
+     * Called by the (single) writer after updating a tuple
+     */
+    void Touch() { version_.store(version_.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+    /**
+     * Star-tree index of the segment (see db/star_tree.h), if the table defines one. It's built
+     * by the writer once the segment is full, and rebuilt after its tuples are updated, so readers
+     * must check the version it was built on.
+     */
+    std::shared_ptr<const void> star_tree() const { return std::atomic_load(&star_tree_); }
+    void set_star_tree(std::shared_ptr<const void> star_tree) { std::atomic_store(&star_tree_, star_tree); }
+
+    /**
+     * Raw arrays of dimensions and metrics structures (see SegmentLayout)
+     */
+    virtual const char* dims_data() const = 0;
+    virtual const char* metrics_data() const = 0;
+
 #if ENABLE_PERSISTENCE
     virtual size_t save(FILE* fp) = 0;
     virtual size_t load(FILE* fp) = 0;
@@ -33,6 +70,8 @@ class SegmentBase {
   protected:
     size_t size_;
     size_t capacity_;
+    std::atomic<uint64_t> version_;
+    std::shared_ptr<const void> star_tree_;
     folly::RWSpinLock lock_;
 };
 
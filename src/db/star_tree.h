@@ -0,0 +1,221 @@
+#ifndef VIYA_DB_STAR_TREE_H_
+#define VIYA_DB_STAR_TREE_H_
+
+#include <vector>
+#include <numeric>
+#include <algorithm>
+#include <cstdint>
+
+namespace viya {
+namespace db {
+
+/**
+ * Star-tree index of a full segment.
+ *
+ * Every level of the tree splits records on a single dimension, in the configured order.
+ * Besides a child per dimension value, a node has a "star" child, which aggregates records
+ * of all the values of that dimension. Every node holds aggregated metrics of its records,
+ * and nodes having not more than the given number of records aren't split further.
+ *
+ * Records are segment tuples aggregated on the indexed dimensions, so values of other
+ * dimensions are meaningless in them.
+ *
+ * The accessor translates tree levels into fields of the dimensions structure:
+ *   static const size_t levels;
+ *   static uint64_t Get(const Dims& dims, size_t level);
+ *   static void Set(Dims& dims, size_t level, uint64_t value);
+ */
+template<typename Dims, typename Metrics, typename Accessor>
+class StarTree {
+  public:
+    StarTree(const Dims* dims, const Metrics* metrics, size_t size, size_t max_leaf_records, uint64_t version)
+      :version_(version),max_leaf_records_(std::max(max_leaf_records, (size_t) 1)) {
+
+      std::vector<size_t> order(size);
+      std::iota(order.begin(), order.end(), 0);
+      std::sort(order.begin(), order.end(), [dims](size_t a, size_t b) {
+        return Less(dims[a], dims[b], 0);
+      });
+      dims_.reserve(size);
+      metrics_.reserve(size);
+      for (auto idx : order) {
+        if (!dims_.empty() && !Less(dims_.back(), dims[idx], 0)) {
+          metrics_.back().Update(metrics[idx]);
+        } else {
+          dims_.push_back(dims[idx]);
+          metrics_.push_back(metrics[idx]);
+        }
+      }
+
+      nodes_.push_back(Node(0, 0, 0, dims_.size()));
+      Build(0);
+    }
+
+    StarTree(const StarTree& other) = delete;
+
+    /**
+     * Version of the segment, which the tree was built on
+     */
+    uint64_t version() const { return version_; }
+
+    size_t memory_size() const {
+      return sizeof(*this) + nodes_.capacity() * sizeof(Node)
+        + dims_.capacity() * sizeof(Dims) + metrics_.capacity() * sizeof(Metrics);
+    }
+
+    /**
+     * Visits aggregated records, which answer a query on the indexed dimensions. Values of the
+     * needed levels (dimensions the query groups or filters by) are enumerated, while other
+     * levels are aggregated through star nodes. Once there are no needed levels left below
+     * a node, its metrics are visited instead of its records.
+     *
+     * Prune is called on the path to a node whenever a needed level value is set in it, and
+     * tells whether records below it may match the query.
+     *
+     * Visitor receives dimensions and metrics of every record; only needed levels are set in
+     * the former. Returns the number of visited records.
+     */
+    template<typename Prune, typename Visitor>
+    size_t Traverse(const bool* needed, Prune prune, Visitor visit) const {
+      size_t needed_end = 0;
+      for (size_t level = 0; level < Accessor::levels; ++level) {
+        if (needed[level]) {
+          needed_end = level + 1;
+        }
+      }
+      Dims path = Dims();
+      return Traverse(0, needed, needed_end, path, prune, visit);
+    }
+
+  private:
+    struct Node {
+      Node(size_t level, uint64_t value, size_t records_start, size_t records_end)
+        :level(level),value(value),records_start(records_start),records_end(records_end),
+        children_start(0),children_end(0),star_child(0) {}
+
+      size_t level;          // level, which children of this node split on
+      uint64_t value;        // value of the parent level dimension
+      size_t records_start;  // records of the node are ordered by this level and below
+      size_t records_end;
+      size_t children_start; // children are placed contiguously, ordered by value
+      size_t children_end;
+      size_t star_child;     // zero if there's no star child
+      Metrics metrics;
+    };
+
+    static bool Less(const Dims& a, const Dims& b, size_t from_level) {
+      for (size_t level = from_level; level < Accessor::levels; ++level) {
+        auto va = Accessor::Get(a, level);
+        auto vb = Accessor::Get(b, level);
+        if (va != vb) {
+          return va < vb;
+        }
+      }
+      return false;
+    }
+
+    void Build(size_t node_idx) {
+      size_t level = nodes_[node_idx].level;
+      size_t start = nodes_[node_idx].records_start;
+      size_t end = nodes_[node_idx].records_end;
+
+      for (size_t i = start; i < end; ++i) {
+        nodes_[node_idx].metrics.Update(metrics_[i]);
+      }
+      if (end - start <= max_leaf_records_ || level == Accessor::levels) {
+        return;
+      }
+
+      // Records are ordered by this level value, so every child takes a range of them:
+      size_t children_start = nodes_.size();
+      for (size_t i = start; i < end;) {
+        auto value = Accessor::Get(dims_[i], level);
+        size_t j = i + 1;
+        while (j < end && Accessor::Get(dims_[j], level) == value) {
+          ++j;
+        }
+        nodes_.push_back(Node(level + 1, value, i, j));
+        i = j;
+      }
+      size_t children_end = nodes_.size();
+
+      // Star child gets new records, which aggregate all values of this level:
+      size_t star_child = 0;
+      if (children_end - children_start > 1) {
+        std::vector<size_t> order(end - start);
+        std::iota(order.begin(), order.end(), start);
+        std::sort(order.begin(), order.end(), [this, level](size_t a, size_t b) {
+          return Less(dims_[a], dims_[b], level + 1);
+        });
+        size_t star_start = dims_.size();
+        dims_.reserve(star_start + order.size());
+        metrics_.reserve(star_start + order.size());
+        for (auto idx : order) {
+          if (dims_.size() > star_start && !Less(dims_.back(), dims_[idx], level + 1)) {
+            metrics_.back().Update(metrics_[idx]);
+          } else {
+            dims_.push_back(dims_[idx]);
+            Accessor::Set(dims_.back(), level, 0);
+            metrics_.push_back(metrics_[idx]);
+          }
+        }
+        star_child = nodes_.size();
+        nodes_.push_back(Node(level + 1, 0, star_start, dims_.size()));
+      }
+
+      nodes_[node_idx].children_start = children_start;
+      nodes_[node_idx].children_end = children_end;
+      nodes_[node_idx].star_child = star_child;
+
+      for (size_t child = children_start; child < children_end; ++child) {
+        Build(child);
+      }
+      if (star_child != 0) {
+        Build(star_child);
+      }
+    }
+
+    template<typename Prune, typename Visitor>
+    size_t Traverse(size_t node_idx, const bool* needed, size_t needed_end, Dims& path,
+                    Prune& prune, Visitor& visit) const {
+      const Node& node = nodes_[node_idx];
+      if (node.level >= needed_end) {
+        visit(path, node.metrics);
+        return 1;
+      }
+      if (node.children_start == node.children_end) {
+        for (size_t i = node.records_start; i < node.records_end; ++i) {
+          visit(dims_[i], metrics_[i]);
+        }
+        return node.records_end - node.records_start;
+      }
+
+      size_t visited = 0;
+      if (needed[node.level]) {
+        for (size_t child = node.children_start; child < node.children_end; ++child) {
+          Accessor::Set(path, node.level, nodes_[child].value);
+          if (prune(path, node.level)) {
+            visited += Traverse(child, needed, needed_end, path, prune, visit);
+          }
+        }
+      } else if (node.star_child != 0) {
+        visited += Traverse(node.star_child, needed, needed_end, path, prune, visit);
+      } else {
+        for (size_t child = node.children_start; child < node.children_end; ++child) {
+          visited += Traverse(child, needed, needed_end, path, prune, visit);
+        }
+      }
+      return visited;
+    }
+
+  private:
+    uint64_t version_;
+    size_t max_leaf_records_;
+    std::vector<Node> nodes_;
+    std::vector<Dims> dims_;
+    std::vector<Metrics> metrics_;
+};
+
+}}
+
+#endif // VIYA_DB_STAR_TREE_H_
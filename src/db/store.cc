@@ -9,7 +9,10 @@ namespace db {
 namespace cg = viya::codegen;
 
 SegmentStore::SegmentStore(Database& database, Table& table) {
-  create_segment_ = cg::CreateSegment(database.compiler(), table).Function();
+  cg::CreateSegment create_segment(database.compiler(), table);
+  create_segment_ = create_segment.Function();
+  create_segment.LayoutFunction()(layout_);
+  library_ = create_segment.library();
 }
 
 SegmentStore::~SegmentStore() {
@@ -2,15 +2,18 @@
 #define VIYA_DB_STORE_H_
 
 #include <vector>
+#include <memory>
 #include "db/segment.h"
 #include "util/rwlock.h"
 
 namespace viya {
+namespace codegen { class SharedLibrary; }
 namespace db {
 
 class Table;
 
 using CreateSegmentFn = SegmentBase* (*)();
+using SegmentLayoutFn = void (*)(SegmentLayout&);
 
 class SegmentStore {
   public:
@@ -36,10 +39,14 @@ class SegmentStore {
       return segments_.back();
     }
 
+    const SegmentLayout& layout() const { return layout_; }
+
   private:
     std::vector<SegmentBase*> segments_;
     folly::RWSpinLock lock_;
+    std::shared_ptr<codegen::SharedLibrary> library_; // segments are instances of its classes
     CreateSegmentFn create_segment_;
+    SegmentLayout layout_;
 };
 
 }}
@@ -1,5 +1,10 @@
 #include <stdexcept>
+#include <algorithm>
 #include <chrono>
+#include <future>
+#include <exception>
+#include <json.hpp>
+#include <glog/logging.h>
 #include "codegen/db/metadata.h"
 #include "codegen/db/upsert.h"
 #include "db/table.h"
@@ -26,8 +31,24 @@ CardinalityGuard::CardinalityGuard(const util::Config& config, const Dimension*
   limit_ = config.num("limit");
 }
 
+StarTreeIndex::StarTreeIndex(const util::Config& config, const Table& table)
+  :max_leaf_records_(config.num("max_leaf_records", 1000L)),
+  max_memory_size_(std::max(config.num("max_memory_size", 1L << 30), 0L)) {
+  for (auto d : config.strlist("dimensions")) {
+    auto dim = table.dimension(d);
+    if (std::find(dimensions_.begin(), dimensions_.end(), dim) != dimensions_.end()) {
+      throw std::invalid_argument("Dimension appears twice in star-tree index: " + d);
+    }
+    dimensions_.push_back(dim);
+  }
+  if (dimensions_.empty()) {
+    throw std::invalid_argument("No dimensions are defined for star-tree index");
+  }
+}
+
 Table::Table(const util::Config& config, Database& database)
-  :database_(database),segment_size_(config.num("segment_size", 1000000L)) {
+  :database_(database),segment_size_(config.num("segment_size", 1000000L)),version_(0),
+  star_tree_requested_(0),star_tree_built_(0),star_tree_stop_(false) {
 
   name_ = config.str("name");
   util::check_legal_string("Table name", name_);
@@ -66,17 +87,63 @@ Table::Table(const util::Config& config, Database& database)
     }
   }
 
-  GenerateFunctions();
+  if (config.exists("star_tree")) {
+    star_tree_ = StarTreeIndex(config.sub("star_tree"), *this);
+  }
 
-  store_ = new SegmentStore(database, *this);
+  // Upsert and segment code are compiled in parallel, along with the code of views:
+  auto generate_functions = std::async(std::launch::async, [this] { GenerateFunctions(); });
+  auto create_views = std::async(std::launch::async, [this, &config] { CreateViews(config); });
+  std::exception_ptr error;
+  store_ = nullptr;
+  try {
+    store_ = new SegmentStore(database, *this);
+  } catch (...) {
+    error = std::current_exception();
+  }
 
-  if (config.exists("watch")) {
-    database_.watcher().AddWatch(config.sub("watch"), this);
+  // Both tasks access this table, so they're waited for whatever fails:
+  bool functions_generated = false;
+  try {
+    generate_functions.get();
+    functions_generated = true;
+  } catch (...) {
+    error = error ? error : std::current_exception();
+  }
+  try {
+    create_views.get();
+  } catch (...) {
+    error = error ? error : std::current_exception();
+  }
+
+  if (error) {
+    for (auto view : views_) { delete view; }
+    if (functions_generated) {
+      upsert_destroy_(upsert_ctx_);
+    }
+    for (auto d : dimensions_) { delete d; }
+    for (auto m : metrics_) { delete m; }
+    delete store_;
+    std::rethrow_exception(error);
+  }
+
+  if (!star_tree_.empty()) {
+    star_tree_thread_ = std::thread(&Table::BuildStarTrees, this);
   }
 }
 
 Table::~Table() {
   database_.watcher().RemoveWatch(this);
+  if (star_tree_thread_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(star_tree_mutex_);
+      star_tree_stop_ = true;
+    }
+    star_tree_cv_.notify_all();
+    star_tree_thread_.join();
+  }
+  for (auto view : views_) { delete view; }
+  upsert_destroy_(upsert_ctx_);
 
   for (auto d : dimensions_) { delete d; }
   for (auto m : metrics_) { delete m; }
@@ -89,7 +156,11 @@ void Table::GenerateFunctions() {
   before_upsert_ = upsert_gen.BeforeFunction();
   after_upsert_ = upsert_gen.AfterFunction();
   upsert_ = upsert_gen.Function();
-  upsert_gen.SetupFunction()(*this);
+  upsert_binary_ = upsert_gen.BinaryFunction();
+  upsert_destroy_ = upsert_gen.DestroyFunction();
+  build_star_trees_ = star_tree_.empty() ? nullptr : upsert_gen.BuildStarTreesFunction();
+  upsert_ctx_ = upsert_gen.SetupFunction()(*this);
+  upsert_library_ = upsert_gen.library();
 }
 
 const Column* Table::column(const std::string& name) const {
@@ -124,25 +195,186 @@ const Metric* Table::metric(const std::string& name) const {
   throw std::invalid_argument("No such metric: " + name);
 }
 
+void Table::CreateViews(const util::Config& config) {
+  if (!config.exists("views")) {
+    return;
+  }
+  if (!cardinality_guards_.empty()) {
+    throw std::invalid_argument("Views can't be defined on a table having cardinality guards");
+  }
+
+  // Position of every column in the input (count metrics don't take an input field):
+  std::vector<size_t> metric_fields;
+  size_t field = dimensions_.size();
+  for (auto metric : metrics_) {
+    metric_fields.push_back(field);
+    if (metric->agg_type() != Metric::AggregationType::COUNT) {
+      ++field;
+    }
+  }
+
+  // View columns are configured the same as the columns of this table:
+  using json = nlohmann::json;
+  auto table_json = json::parse(config.dump());
+  std::vector<util::Config> view_configs;
+  for (util::Config& view_conf : config.sublist("views")) {
+    View view;
+    json view_json;
+    view_json["name"] = name_ + "." + view_conf.str("name");
+    view_json["segment_size"] = view_conf.num("segment_size", segment_size_);
+
+    Granularity granularity;
+    if (view_conf.exists("granularity")) {
+      granularity = Granularity(view_conf.str("granularity"));
+    }
+    view_json["dimensions"] = json::array();
+    for (auto& dim_name : view_conf.strlist("dimensions")) {
+      auto dim = dimension(dim_name);
+      auto dim_json = table_json["dimensions"][dim->index()];
+      if (dim->dim_type() == Dimension::DimType::TIME && !granularity.empty()) {
+        auto& dim_granularity = static_cast<const TimeDimension*>(dim)->granularity();
+        if (dim_granularity.empty() || dim_granularity.time_unit() > granularity.time_unit()) {
+          dim_json.erase("rollup_rules");
+          dim_json["granularity"] = view_conf.str("granularity");
+        }
+      }
+      view_json["dimensions"].push_back(dim_json);
+      view.fields.push_back(dim->index());
+    }
+
+    view_json["metrics"] = json::array();
+    for (auto& metric_name : view_conf.strlist("metrics")) {
+      auto m = metric(metric_name);
+      view_json["metrics"].push_back(table_json["metrics"][m->index()]);
+      if (m->agg_type() != Metric::AggregationType::COUNT) {
+        view.fields.push_back(metric_fields[m->index()]);
+      }
+    }
+
+    view.values.resize(view.fields.size());
+    view.binary_fields.resize(view.fields.size());
+    view_inputs_.push_back(std::move(view));
+    view_configs.push_back(util::Config(view_json.dump()));
+  }
+
+  // Views are independent tables, so their code is generated in parallel:
+  std::vector<std::future<Table*>> views;
+  for (auto& view_conf : view_configs) {
+    views.push_back(std::async(std::launch::async, [this, &view_conf] {
+      return new Table(view_conf, database_);
+    }));
+  }
+  std::exception_ptr error;
+  for (size_t i = 0; i < views.size(); ++i) {
+    try {
+      view_inputs_[i].table = views[i].get();
+      views_.push_back(view_inputs_[i].table);
+    } catch (...) {
+      error = std::current_exception();
+    }
+  }
+  if (error) {
+    for (auto view : views_) { delete view; }
+    views_.clear();
+    std::rethrow_exception(error);
+  }
+}
+
+void Table::LoadViews(std::vector<std::string>& values) {
+  for (auto& view : view_inputs_) {
+    for (size_t i = 0; i < view.fields.size(); ++i) {
+      view.values[i] = values[view.fields[i]];
+    }
+    view.table->Load(view.values);
+  }
+}
+
+void Table::LoadViewsBinary(const std::vector<const char*>& fields) {
+  for (auto& view : view_inputs_) {
+    for (size_t i = 0; i < view.fields.size(); ++i) {
+      view.binary_fields[i] = fields[view.fields[i]];
+    }
+    view.table->LoadBinary(view.binary_fields);
+  }
+}
+
+size_t Table::size() {
+  size_t size = 0;
+  for (auto segment : store_->segments_copy()) {
+    size += segment->size();
+  }
+  return size;
+}
+
 void Table::BeforeLoad() {
-  before_upsert_();
+  ++version_;
+  before_upsert_(upsert_ctx_);
+  for (auto view : views_) {
+    view->BeforeLoad();
+  }
 }
 
 UpsertStats Table::AfterLoad() {
-  return after_upsert_();
+  UpsertStats stats;
+  try {
+    stats = after_upsert_(upsert_ctx_);
+    for (auto view : views_) {
+      view->AfterLoad();
+    }
+  } catch (...) {
+    ++version_;
+    throw;
+  }
+  ++version_;
+
+  if (!star_tree_.empty()) {
+    // Trees are built in background, so that neither this load nor the next one waits for them:
+    std::lock_guard<std::mutex> lock(star_tree_mutex_);
+    star_tree_requested_ = version_;
+    star_tree_cv_.notify_all();
+  }
+  return stats;
+}
+
+void Table::BuildStarTrees() {
+  std::unique_lock<std::mutex> lock(star_tree_mutex_);
+  while (true) {
+    star_tree_cv_.wait(lock, [this] { return star_tree_stop_ || star_tree_built_ != star_tree_requested_; });
+    if (star_tree_stop_) {
+      return;
+    }
+    uint64_t version = star_tree_requested_;
+    lock.unlock();
+    try {
+      // Queries don't use a tree built on an older version of the segment, so segments
+      // may be updated concurrently:
+      build_star_trees_(upsert_ctx_);
+    } catch (const std::exception& e) {
+      LOG(ERROR)<<"Can't build star-tree indices of table "<<name_<<": "<<e.what();
+    }
+    lock.lock();
+    star_tree_built_ = version;
+    star_tree_cv_.notify_all();
+  }
+}
+
+void Table::WaitStarTrees() {
+  std::unique_lock<std::mutex> lock(star_tree_mutex_);
+  star_tree_cv_.wait(lock, [this] { return star_tree_stop_ || star_tree_built_ == star_tree_requested_; });
 }
 
 void Table::Load(std::initializer_list<std::vector<std::string>> rows) {
+  std::lock_guard<std::mutex> lock(load_lock_);
   BeforeLoad();
   for (auto row : rows) {
-    upsert_(row);
+    Load(row);
   }
   AfterLoad();
 }
 
 void Table::PrintMetadata(std::string& output) {
-  auto table_metadata = cg::TableMetadata(database_.compiler(), *this).Function();
-  table_metadata(*this, output);
+  cg::TableMetadata table_metadata(database_.compiler(), *this);
+  table_metadata.Function()(*this, output);
 }
 
 }}
@@ -3,10 +3,16 @@
 
 #include <string>
 #include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
 #include "util/config.h"
 #include "db/stats.h"
 
 namespace viya {
+namespace codegen { class SharedLibrary; }
 namespace db {
 
 namespace util = viya::util;
@@ -32,11 +38,40 @@ class CardinalityGuard {
     size_t limit_;
 };
 
+/**
+ * Dimensions, which star-tree index of full segments is built on (see db/star_tree.h)
+ */
+class StarTreeIndex {
+  public:
+    StarTreeIndex():max_leaf_records_(0),max_memory_size_(0) {}
+    StarTreeIndex(const util::Config& config, const Table& table);
+
+    bool empty() const { return dimensions_.empty(); }
+    const std::vector<const Dimension*>& dimensions() const { return dimensions_; }
+    size_t max_leaf_records() const { return max_leaf_records_; }
+
+    /**
+     * Memory all trees of the table may take (unlimited if 0). It's checked before building
+     * a tree, so it can be exceeded by the size of a single tree.
+     */
+    size_t max_memory_size() const { return max_memory_size_; }
+
+  private:
+    std::vector<const Dimension*> dimensions_;
+    size_t max_leaf_records_;
+    size_t max_memory_size_;
+};
+
 using TableMetadataFn = void (*)(Table&, std::string&);
-using UpsertSetupFn = void (*)(Table&);
-using BeforeUpsertFn = void (*)();
-using AfterUpsertFn = UpsertStats (*)();
-using UpsertFn = void (*)(std::vector<std::string>&);
+// Upsert functions operate on the context returned by the setup function, so that tables
+// having the same schema can share them:
+using UpsertSetupFn = void* (*)(Table&);
+using UpsertDestroyFn = void (*)(void*);
+using BeforeUpsertFn = void (*)(void*);
+using AfterUpsertFn = UpsertStats (*)(void*);
+using BuildStarTreesFn = void (*)(void*);
+using UpsertFn = void (*)(void*, std::vector<std::string>&);
+using UpsertBinaryFn = void (*)(void*, const std::vector<const char*>&);
 
 class Table {
   public:
@@ -58,15 +93,69 @@ class Table {
     SegmentStore* store() { return store_; }
     size_t segment_size() const { return segment_size_; }
     const std::vector<CardinalityGuard>& cardinality_guards() const { return cardinality_guards_; }
+    const StarTreeIndex& star_tree() const { return star_tree_; }
+
+    /**
+     * Must be held from BeforeLoad() till AfterLoad(), as upserts can't run concurrently
+     */
+    std::mutex& load_lock() { return load_lock_; }
 
     void BeforeLoad();
     UpsertStats AfterLoad();
-    void Load(std::vector<std::string>& values) { upsert_(values); }
+
+    /**
+     * Version of the table data, which changes on every load. It's odd while a load is in progress.
+     */
+    uint64_t version() const { return version_.load(); }
+
+    /**
+     * Star-tree indices are built in background after loads. Waits until they're built on
+     * the data of the last load.
+     */
+    void WaitStarTrees();
+
+    void Load(std::vector<std::string>& values) {
+      upsert_(upsert_ctx_, values);
+      if (!views_.empty()) {
+        LoadViews(values);
+      }
+    }
+
+    void LoadBinary(const std::vector<const char*>& fields) {
+      upsert_binary_(upsert_ctx_, fields);
+      if (!views_.empty()) {
+        LoadViewsBinary(fields);
+      }
+    }
+
     void Load(std::initializer_list<std::vector<std::string>> rows);
     void PrintMetadata(std::string&);
 
+    /**
+     * Rollup views: tables aggregating a subset of this table columns (possibly at coarser
+     * time granularity), which are loaded along with it. Queries are answered from the
+     * smallest view covering them.
+     */
+    const std::vector<Table*>& views() const { return views_; }
+
+    /**
+     * Number of tuples currently stored in the table
+     */
+    size_t size();
+
   private:
+    struct View {
+      Table* table;
+      std::vector<size_t> fields;           // input fields of this table, which the view is loaded with
+      std::vector<std::string> values;      // buffers for view input
+      std::vector<const char*> binary_fields;
+    };
+
     void GenerateFunctions();
+    void BuildStarTrees();
+    void CreateViews(const util::Config& config);
+    void LoadViews(std::vector<std::string>& values);
+    void LoadViewsBinary(const std::vector<const char*>& fields);
 
   private:
     class Database& database_;
@@ -76,10 +165,28 @@ class Table {
     SegmentStore* store_;
     size_t segment_size_;
     std::vector<CardinalityGuard> cardinality_guards_;
-
+    StarTreeIndex star_tree_;
+    std::mutex load_lock_;
+    std::atomic<uint64_t> version_;
+
+    std::thread star_tree_thread_;
+    std::mutex star_tree_mutex_;
+    std::condition_variable star_tree_cv_;
+    uint64_t star_tree_requested_;  // table version, which trees should be built on
+    uint64_t star_tree_built_;      // table version, which trees were last built on
+    bool star_tree_stop_;
+
+    std::shared_ptr<codegen::SharedLibrary> upsert_library_;
+    void* upsert_ctx_;
+    UpsertDestroyFn upsert_destroy_;
     BeforeUpsertFn before_upsert_;
     AfterUpsertFn after_upsert_;
+    BuildStarTreesFn build_star_trees_;
     UpsertFn upsert_;
+    UpsertBinaryFn upsert_binary_;
+
+    std::vector<Table*> views_;
+    std::vector<View> view_inputs_;
 };
 
 }}
@@ -1,18 +1,390 @@
 #include <fcntl.h>
+#include <mutex>
 #include <cstdio>
-#include <cassert>
 #include <cstring>
 #include <glog/logging.h>
+#include "db/column.h"
 #include "input/file.h"
+#include "input/pipeline.h"
+#include "util/varint.h"
 
 namespace viya {
 namespace input {
 
 namespace util = viya::util;
 
+static const char BINARY_MAGIC[] = {'V', 'I', 'Y', 'A'};
+static const uint8_t BINARY_VERSION = 1;
+
+/**
+ * Binary input field type as it appears in the file header
+ */
+struct BinaryType {
+  BinaryType():kind(0),width(0) {}
+  BinaryType(char kind, uint8_t width):kind(kind),width(width) {}
+
+  bool operator==(const BinaryType& other) const {
+    return kind == other.kind && width == other.width;
+  }
+
+  std::string str() const {
+    return std::string(1, kind) + std::to_string(width);
+  }
+
+  char kind;
+  uint8_t width;
+};
+
+class BinaryTypeResolver: public db::ColumnVisitor {
+  public:
+    void Visit(const db::StrDimension* dimension __attribute__((unused))) {
+      type_ = BinaryType('s', 0);
+    }
+
+    void Visit(const db::NumDimension* dimension) {
+      type_ = BinaryType('u', dimension->num_type().size());
+    }
+
+    void Visit(const db::TimeDimension* dimension) {
+      type_ = BinaryType('t', dimension->num_type().size());
+    }
+
+    void Visit(const db::BoolDimension* dimension __attribute__((unused))) {
+      type_ = BinaryType('b', 1);
+    }
+
+    void Visit(const db::ValueMetric* metric) {
+      auto& num_type = static_cast<const db::MetricType&>(metric->num_type());
+      switch (num_type.type()) {
+        case db::MetricType::Type::INT:
+        case db::MetricType::Type::LONG:
+          type_ = BinaryType('i', num_type.size());
+          break;
+        case db::MetricType::Type::UINT:
+        case db::MetricType::Type::ULONG:
+          type_ = BinaryType('u', num_type.size());
+          break;
+        case db::MetricType::Type::DOUBLE:
+          type_ = BinaryType('f', num_type.size());
+          break;
+      }
+    }
+
+    void Visit(const db::BitsetMetric* metric) {
+      type_ = BinaryType('u', metric->num_type().size());
+    }
+
+    const BinaryType& type() const { return type_; }
+
+  private:
+    BinaryType type_;
+};
+
+struct BinaryColumn {
+  std::string name;
+  BinaryType type;
+  int target_idx;
+};
+
+/**
+ * Buffered reader, which guarantees that requested number of bytes is available contiguously
+ */
+class InputBuffer {
+  public:
+    InputBuffer(InputStream& stream)
+      :stream_(stream),buf_(65536),start_(0),end_(0) {}
+
+    const char* data() const { return buf_.data() + start_; }
+    size_t available() const { return end_ - start_; }
+    void Consume(size_t bytes) { start_ += bytes; }
+
+    /**
+     * Reads more data until at least given number of bytes is available.
+     * Returns false if the end of file was reached before that.
+     */
+    bool Fill(size_t bytes) {
+      if (available() >= bytes) {
+        return true;
+      }
+      if (start_ > 0) {
+        std::memmove(buf_.data(), data(), available());
+        end_ -= start_;
+        start_ = 0;
+      }
+      if (bytes > buf_.size()) {
+        buf_.resize(std::max(bytes, buf_.size() * 2));
+      }
+      while (end_ < bytes) {
+        size_t bytes_read = stream_.Read(buf_.data() + end_, buf_.size() - end_);
+        if (bytes_read == 0) {
+          return false;
+        }
+        end_ += bytes_read;
+      }
+      return true;
+    }
+
+  private:
+    InputStream& stream_;
+    std::vector<char> buf_;
+    size_t start_;
+    size_t end_;
+};
+
+/**
+ * Parses binary file header. Returns false if the header is incomplete.
+ */
+static bool parse_binary_header(const char* p, const char* end, std::vector<BinaryColumn>& columns,
+                                size_t& header_size) {
+  const char* begin = p;
+  if (end - p < (long) sizeof(BINARY_MAGIC) + 1) {
+    return false;
+  }
+  if (std::memcmp(p, BINARY_MAGIC, sizeof(BINARY_MAGIC)) != 0) {
+    throw std::runtime_error("Not a binary input file");
+  }
+  p += sizeof(BINARY_MAGIC);
+  if (static_cast<uint8_t>(*p++) != BINARY_VERSION) {
+    throw std::runtime_error("Unsupported binary input version");
+  }
+
+  uint64_t columns_num;
+  if (!util::read_varint(p, end, columns_num)) {
+    return false;
+  }
+  columns.clear();
+  for (uint64_t i = 0; i < columns_num; ++i) {
+    uint64_t name_length;
+    if (!util::read_varint(p, end, name_length) || (uint64_t)(end - p) < name_length + 2) {
+      return false;
+    }
+    BinaryColumn column;
+    column.name.assign(p, name_length);
+    p += name_length;
+    column.type.kind = *p++;
+    column.type.width = static_cast<uint8_t>(*p++);
+    column.target_idx = -1;
+    columns.push_back(column);
+  }
+  header_size = p - begin;
+  return true;
+}
+
+/**
+ * Finds offsets of all the fields of a single record. Returns false if the record is incomplete.
+ */
+static bool parse_binary_record(const char* p, const char* end, const std::vector<BinaryColumn>& columns,
+                                std::vector<size_t>& offsets, size_t& record_size) {
+  const char* begin = p;
+  for (size_t i = 0; i < columns.size(); ++i) {
+    offsets[i] = p - begin;
+    if (columns[i].type.kind == 's') {
+      uint64_t length;
+      if (!util::read_varint(p, end, length)) {
+        if (p < end) {
+          throw std::runtime_error("Malformed string length");
+        }
+        return false;
+      }
+      if ((uint64_t)(end - p) < length) {
+        return false;
+      }
+      p += length;
+    } else {
+      if (end - p < columns[i].type.width) {
+        return false;
+      }
+      p += columns[i].type.width;
+    }
+  }
+  record_size = p - begin;
+  return true;
+}
+
+/**
+ * Base for pipelines loading into a table. Concurrent loads into the same table
+ * serialize on the table load lock, but only for the duration of their upsert stage.
+ */
+class TablePipeline: public Pipeline {
+  public:
+    TablePipeline(InputStream& stream, LoaderStats& stats, size_t parser_threads, db::Table& table)
+      :Pipeline(stream, stats, parser_threads),table_(table),stats_(stats) {}
+
+  protected:
+    void BeforeUpsert() {
+      lock_ = std::unique_lock<std::mutex>(table_.load_lock());
+      table_.BeforeLoad();
+    }
+
+    void AfterUpsert() {
+      stats_.upsert_stats = table_.AfterLoad();
+      lock_.unlock();
+    }
+
+  protected:
+    db::Table& table_;
+
+  private:
+    LoaderStats& stats_;
+    std::unique_lock<std::mutex> lock_;
+};
+
+/**
+ * Tab separated values: records are lines, which are split into fields by parsers
+ */
+class TsvPipeline: public TablePipeline {
+  public:
+    TsvPipeline(InputStream& stream, LoaderStats& stats, size_t parser_threads,
+                db::Table& table, size_t cols_num, const std::vector<int>& tuple_idx_map)
+      :TablePipeline(stream, stats, parser_threads, table),cols_num_(cols_num),
+      tuple_idx_map_(tuple_idx_map),tuple_(cols_num) {}
+
+  protected:
+    size_t Frame(const char* data, size_t size, bool eof) {
+      if (eof) {
+        return size;
+      }
+      auto eol = static_cast<const char*>(memrchr(data, '\n', size));
+      return eol == nullptr ? 0 : eol - data + 1;
+    }
+
+    void Parse(Batch& batch) {
+      batch.records = 0;
+      size_t file_cols_num = tuple_idx_map_.size();
+      const char* p = batch.data.data();
+      const char* end = p + batch.size;
+
+      while (p < end) {
+        auto eol = static_cast<const char*>(std::memchr(p, '\n', end - p));
+        if (eol == nullptr) {
+          eol = end;
+        }
+        if (eol > p) {
+          if (batch.values.size() < (batch.records + 1) * cols_num_) {
+            batch.values.resize((batch.records + 1) * cols_num_);
+          }
+          std::string* tuple = &batch.values[batch.records * cols_num_];
+          for (size_t i = 0; i < cols_num_; ++i) {
+            tuple[i].clear();
+          }
+
+          size_t tuple_idx = 0;
+          const char* field = p;
+          while (true) {
+            auto tab = static_cast<const char*>(std::memchr(field, '\t', eol - field));
+            auto field_end = tab == nullptr ? eol : tab;
+            if (tab == nullptr && field_end == field) {
+              break;
+            }
+            if (tuple_idx >= file_cols_num) {
+              throw std::runtime_error("number of input columns is too big");
+            }
+            auto target_idx = tuple_idx_map_[tuple_idx];
+            if (target_idx != -1) {
+              tuple[target_idx].assign(field, field_end - field);
+            }
+            ++tuple_idx;
+            if (tab == nullptr) {
+              break;
+            }
+            field = tab + 1;
+          }
+          ++batch.records;
+        }
+        p = eol + 1;
+      }
+    }
+
+    void Upsert(Batch& batch) {
+      for (size_t r = 0; r < batch.records; ++r) {
+        // Swap parsed values in and out, so their memory is reused by the next batch:
+        std::string* values = &batch.values[r * cols_num_];
+        for (size_t i = 0; i < cols_num_; ++i) {
+          tuple_[i].swap(values[i]);
+        }
+        table_.Load(tuple_);
+        for (size_t i = 0; i < cols_num_; ++i) {
+          tuple_[i].swap(values[i]);
+        }
+      }
+    }
+
+  private:
+    const size_t cols_num_;
+    const std::vector<int>& tuple_idx_map_;
+    std::vector<std::string> tuple_;
+};
+
+/**
+ * Binary records: the reader has to walk through records in order to find their boundaries,
+ * parsers find where every field is, so the upsert stage just passes pointers along.
+ */
+class BinaryPipeline: public TablePipeline {
+  public:
+    BinaryPipeline(InputStream& stream, LoaderStats& stats, size_t parser_threads,
+                   db::Table& table, const std::vector<BinaryColumn>& file_cols,
+                   size_t table_cols_num, const std::string& fname)
+      :TablePipeline(stream, stats, parser_threads, table),file_cols_(file_cols),
+      table_cols_num_(table_cols_num),fname_(fname),frame_offsets_(file_cols.size()),
+      fields_(table_cols_num) {}
+
+  protected:
+    size_t Frame(const char* data, size_t size, bool eof) {
+      const char* p = data;
+      const char* end = data + size;
+      size_t record_size;
+      while (parse_binary_record(p, end, file_cols_, frame_offsets_, record_size)) {
+        p += record_size;
+      }
+      if (eof && p < end) {
+        throw std::runtime_error("Truncated binary record in: " + fname_);
+      }
+      return p - data;
+    }
+
+    void Parse(Batch& batch) {
+      batch.records = 0;
+      std::vector<size_t> offsets(file_cols_.size());
+      const char* p = batch.data.data();
+      const char* end = p + batch.size;
+      size_t record_size;
+
+      while (p < end && parse_binary_record(p, end, file_cols_, offsets, record_size)) {
+        if (batch.fields.size() < (batch.records + 1) * table_cols_num_) {
+          batch.fields.resize((batch.records + 1) * table_cols_num_);
+        }
+        const char** fields = &batch.fields[batch.records * table_cols_num_];
+        for (size_t fc_idx = 0; fc_idx < file_cols_.size(); ++fc_idx) {
+          auto target_idx = file_cols_[fc_idx].target_idx;
+          if (target_idx != -1) {
+            fields[target_idx] = p + offsets[fc_idx];
+          }
+        }
+        ++batch.records;
+        p += record_size;
+      }
+    }
+
+    void Upsert(Batch& batch) {
+      for (size_t r = 0; r < batch.records; ++r) {
+        auto fields = batch.fields.begin() + r * table_cols_num_;
+        std::copy(fields, fields + table_cols_num_, fields_.begin());
+        table_.LoadBinary(fields_);
+      }
+    }
+
+  private:
+    const std::vector<BinaryColumn>& file_cols_;
+    const size_t table_cols_num_;
+    const std::string& fname_;
+    std::vector<size_t> frame_offsets_;
+    std::vector<const char*> fields_;
+};
+
 FileLoader::FileLoader(db::Table& table, Format format, const std::string& fname,
-                       std::vector<int>& tuple_idx_map)
-  :Loader(table, format),fname_(fname),tuple_idx_map_(tuple_idx_map) {
+                       std::vector<int>& tuple_idx_map, size_t parser_threads,
+                       const ReaderOptions& reader_options)
+  :Loader(table, format),fname_(fname),tuple_idx_map_(tuple_idx_map),parser_threads_(parser_threads) {
 
   fd_ = open(fname_.c_str(), O_RDONLY);
   if (fd_ == -1) {
@@ -21,9 +393,16 @@ FileLoader::FileLoader(db::Table& table, Format format, const std::string& fname
 #ifdef __linux__
   posix_fadvise(fd_, 0, 0, 1); // FDADVICE_SEQUENTIAL
 #endif
+  try {
+    stream_ = create_input_stream(fd_, fname_, reader_options);
+  } catch (...) {
+    close(fd_);
+    throw;
+  }
 }
 
 FileLoader::~FileLoader() {
+  stream_.reset();
   if (fd_ != -1) {
     close(fd_);
   }
@@ -39,88 +418,75 @@ void FileLoader::LoadTsv() {
     }
   }
 
-  static const size_t BUFFER_SIZE = 16384;
-  static const size_t MAX_TUPLE_SIZE = 1024000;
-
-  static char buf[BUFFER_SIZE + 1];
-  static char line[MAX_TUPLE_SIZE];
+  TsvPipeline pipeline(*stream_, stats_, parser_threads_, table_, cols_num, tuple_idx_map_);
+  pipeline.Run();
+  stats_.total_recs += stats_.upsert_stage.records;
+}
 
-  size_t file_cols_num = tuple_idx_map_.size();
+void FileLoader::LoadBinary() {
+  LOG(INFO)<<"Loading "<<fname_<<" (binary) into table: "<<table_.name();
 
-  std::vector<std::string> tuple(cols_num);
-  for (auto& s: tuple) {
-    s.reserve(MAX_TUPLE_SIZE / cols_num);
+  std::vector<const db::Column*> table_cols;
+  for (auto dimension : table_.dimensions()) {
+    table_cols.push_back(dimension);
+  }
+  for (auto metric : table_.metrics()) {
+    if (metric->agg_type() != db::Metric::AggregationType::COUNT) {
+      table_cols.push_back(metric);
+    }
   }
 
-  size_t remaining = 0, start = 0;
-  char* f;
+  InputBuffer buffer(*stream_);
 
-  while (size_t bytes_read = read(fd_, buf, BUFFER_SIZE)) {
-    if (bytes_read == (size_t) - 1) {
-      throw std::runtime_error("I/O error reading from: " + fname_);
+  // Read the header, and map file columns to the table columns:
+  std::vector<BinaryColumn> file_cols;
+  size_t header_size;
+  while (!parse_binary_header(buffer.data(), buffer.data() + buffer.available(), file_cols, header_size)) {
+    if (!buffer.Fill(buffer.available() + 1)) {
+      throw std::runtime_error("Truncated binary header in: " + fname_);
     }
-    if (!bytes_read) {
-      break;
-    }
-
-    // Read line:
-    for(char *p = buf; (f = (char*) memchr(p, '\n', (buf + bytes_read) - p)); ++p) {
-      assert(f - p + 1 + start < MAX_TUPLE_SIZE);
-      memcpy(line + start, p, f - p + 1);
-      line[f - p + start] = '\0';
+  }
+  buffer.Consume(header_size);
 
-      // Parse tuples:
-      size_t tuple_idx = 0;
-      char *tp = line;
-      char *tp_start = line;
-      while (*tp) {
-        if (*tp == '\t') {
-          *tp = '\0';
-          if (tuple_idx >= file_cols_num) {
-            throw std::runtime_error("number of input columns is too big");
-          }
-          auto target_idx = tuple_idx_map_[tuple_idx];
-          if (target_idx != -1) {
-            tuple[target_idx].assign(tp_start, tp - tp_start);
-          }
-          tp_start = tp + 1;
-          tuple_idx++;
-        }
-        tp++;
-      }
-      if (tp > tp_start) {
-        if (tuple_idx >= file_cols_num) {
-          throw std::runtime_error("number of input columns is too big");
-        }
-        auto target_idx = tuple_idx_map_[tuple_idx];
-        if (target_idx != -1) {
-          tuple[target_idx].assign(tp_start, tp - tp_start);
+  std::vector<bool> mapped(table_cols.size(), false);
+  for (auto& file_col : file_cols) {
+    if (file_col.type.kind != 's' && file_col.type.width == 0) {
+      throw std::invalid_argument("Binary input column '" + file_col.name + "' has zero width");
+    }
+    for (size_t tc_idx = 0; tc_idx < table_cols.size(); ++tc_idx) {
+      if (table_cols[tc_idx]->name() == file_col.name) {
+        BinaryTypeResolver type_resolver;
+        table_cols[tc_idx]->Accept(type_resolver);
+        if (!(type_resolver.type() == file_col.type)) {
+          throw std::invalid_argument("Binary input column '" + file_col.name + "' has type "
+                                      + file_col.type.str() + ", expected: " + type_resolver.type().str());
         }
+        file_col.target_idx = tc_idx;
+        mapped[tc_idx] = true;
+        break;
       }
-
-      table_.Load(tuple);
-      ++stats_.total_recs;
-
-      p = f;
-      start = 0;
-      remaining = p - buf + 1;
     }
-    if (remaining < bytes_read) {
-      memcpy(line, buf + remaining, bytes_read - remaining);
-      start = bytes_read - remaining;
+  }
+  for (size_t tc_idx = 0; tc_idx < table_cols.size(); ++tc_idx) {
+    if (!mapped[tc_idx]) {
+      throw std::invalid_argument("Column '" + table_cols[tc_idx]->name() + "' is missing in: " + fname_);
     }
   }
+
+  BinaryPipeline pipeline(*stream_, stats_, parser_threads_, table_, file_cols, table_cols.size(), fname_);
+  pipeline.Run(buffer.data(), buffer.available());
+  stats_.total_recs += stats_.upsert_stage.records;
 }
 
 void FileLoader::LoadData() {
   stats_.OnBegin();
-  table_.BeforeLoad();
 
   if (format_ == Format::TSV) {
     LoadTsv();
+  } else if (format_ == Format::BINARY) {
+    LoadBinary();
   }
 
-  stats_.upsert_stats = table_.AfterLoad();
   stats_.OnEnd();
 }
 
@@ -1,15 +1,45 @@
 #ifndef VIYA_INPUT_FILE_H_
 #define VIYA_INPUT_FILE_H_
 
+#include <memory>
 #include "input/loader.h"
+#include "input/stream.h"
 
 namespace viya {
 namespace input {
 
+/**
+ * Loads data from a file. Supported file formats are:
+ *
+ *  tsv    - Tab separated values. Column order is either the table's one (dimensions,
+ *           then non-count metrics), or it's given using the "columns" load parameter.
+ *
+ *  binary - Schema header followed by rows of fields, no text parsing is involved:
+ *
+ *           header := "VIYA" version:u8 columns_num:varint column*
+ *           column := name_length:varint name type:u8 width:u8
+ *           row    := field*  (one per header column, in the header order)
+ *
+ *           Field types are: 's' (string: varint length followed by the bytes),
+ *           'b' (boolean: 1 byte), 'u' / 'i' (unsigned / signed little-endian integer),
+ *           'f' (little-endian IEEE double), 't' (little-endian epoch timestamp in
+ *           seconds, or in microseconds for microtime dimensions). Field width must match
+ *           the table column type exactly. Columns unknown to the table are skipped.
+ *
+ * Files ending with .gz, .zst or .lz4 are decompressed on the fly, while being read.
+ *
+ * Reading, parsing and upserting run as separate pipeline stages (see input/pipeline.h),
+ * where the number of parser threads is set using the "parser_threads" load parameter.
+ *
+ * Setting "io_uring" load parameter makes the file to be read asynchronously (falling back
+ * to blocking reads on kernels without io_uring), and "direct_io" keeps the file contents
+ * out of the page cache, which is useful for files that are read once and deleted.
+ */
 class FileLoader: public Loader {
   public:
     FileLoader(db::Table& table, Format format, const std::string& fname,
-               std::vector<int>& tuple_idx_map);
+               std::vector<int>& tuple_idx_map, size_t parser_threads = 2,
+               const ReaderOptions& reader_options = ReaderOptions());
     FileLoader(const FileLoader&) = delete;
     ~FileLoader();
 
@@ -17,11 +47,14 @@ class FileLoader: public Loader {
 
   protected:
     void LoadTsv();
+    void LoadBinary();
 
   private:
     std::string fname_;
     int fd_;
+    std::unique_ptr<InputStream> stream_;
     const std::vector<int> tuple_idx_map_;
+    const size_t parser_threads_;
 };
 
 }}
@@ -11,6 +11,9 @@ Loader::Format parse_format(const std::string& format) {
   if (format == "tsv") {
     return Loader::Format::TSV;
   }
+  if (format == "binary") {
+    return Loader::Format::BINARY;
+  }
   throw std::invalid_argument("Unsupported input format: " + format);
 }
 
@@ -49,9 +52,16 @@ Loader* LoaderFactory::Create(const util::Config& config, db::Database& database
     } 
   }
 
+  ReaderOptions reader_options;
+  reader_options.io_uring = config.boolean("io_uring", false);
+  reader_options.direct_io = config.boolean("direct_io", false);
+  reader_options.queue_depth = config.num("io_depth", reader_options.queue_depth);
+  reader_options.block_size = config.num("io_block_size", reader_options.block_size);
+
   std::string type = config.str("type");
   if (type == "file") {
-    return new FileLoader(*table, format, config.str("file"), tuple_idx_map);
+    return new FileLoader(*table, format, config.str("file"), tuple_idx_map,
+                          config.num("parser_threads", 2), reader_options);
   }
   throw std::invalid_argument("Unsupported input type: " + type);
 }
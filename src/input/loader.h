@@ -14,7 +14,7 @@ namespace util = viya::util;
 
 class Loader {
   public:
-    enum Format { TSV };
+    enum Format { TSV, BINARY };
 
     Loader(db::Table& table, Format format):
       table_(table),stats_(table.database().statsd(), table.name()),
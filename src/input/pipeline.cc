@@ -0,0 +1,250 @@
+#include <thread>
+#include <map>
+#include <cstring>
+#include <stdexcept>
+#include "input/pipeline.h"
+
+namespace viya {
+namespace input {
+
+using clock = cr::steady_clock;
+
+static size_t queue_size(size_t parser_threads) {
+  return std::max((size_t) 4, parser_threads * 2);
+}
+
+static void backoff(size_t& spins) {
+  if (++spins < 64) {
+    std::this_thread::yield();
+  } else {
+    std::this_thread::sleep_for(cr::microseconds(50));
+  }
+}
+
+Pipeline::Pipeline(InputStream& stream, LoaderStats& stats, size_t parser_threads, size_t batch_size)
+  :stream_(stream),stats_(stats),
+  parser_threads_(std::max(parser_threads, (size_t) 1)),
+  batch_size_(batch_size),
+  free_queue_(queue_size(parser_threads_) * 2 + parser_threads_ + 2),
+  parse_queue_(queue_size(parser_threads_)),
+  upsert_queue_(queue_size(parser_threads_)),
+  failed_(false) {
+
+  // Every batch is either in one of the queues, or is being processed by one of the stages:
+  size_t batches_num = queue_size(parser_threads_) * 2 + parser_threads_ + 2;
+  for (size_t i = 0; i < batches_num; ++i) {
+    batches_.emplace_back(new Batch());
+    free_queue_.TryPush(batches_.back().get());
+  }
+}
+
+void Pipeline::Fail(std::exception_ptr error) {
+  std::lock_guard<std::mutex> lock(error_mutex_);
+  if (!error_) {
+    error_ = error;
+  }
+  failed_ = true;
+}
+
+bool Pipeline::Push(Queue& queue, Batch* batch, StageStats& stage_stats, QueueStats* queue_stats) {
+  if (queue_stats != nullptr) {
+    queue_stats->Sample(queue.size());
+  }
+  if (queue.TryPush(batch)) {
+    return true;
+  }
+  auto wait_start = clock::now();
+  size_t spins = 0;
+  bool pushed;
+  while (!(pushed = queue.TryPush(batch)) && !failed_) {
+    backoff(spins);
+  }
+  stage_stats.wait_time += clock::now() - wait_start;
+  return pushed;
+}
+
+bool Pipeline::Pop(Queue& queue, Batch*& batch, StageStats& stage_stats) {
+  if (queue.TryPop(batch)) {
+    return true;
+  }
+  auto wait_start = clock::now();
+  size_t spins = 0;
+  bool popped;
+  while (!(popped = queue.TryPop(batch)) && !failed_) {
+    backoff(spins);
+  }
+  stage_stats.wait_time += clock::now() - wait_start;
+  return popped;
+}
+
+void Pipeline::ReadStage(const char* prefix, size_t prefix_size) {
+  StageStats& stage_stats = stats_.read_stage;
+  std::vector<char> carry(prefix, prefix + prefix_size);
+  size_t seq = 0;
+  bool eof = false;
+
+  try {
+    while (!eof) {
+      Batch* batch;
+      if (!Pop(free_queue_, batch, stage_stats)) {
+        return;
+      }
+      auto busy_start = clock::now();
+
+      batch->seq = seq;
+      if (batch->data.size() < std::max(batch_size_, carry.size() * 2)) {
+        batch->data.resize(std::max(batch_size_, carry.size() * 2));
+      }
+      std::memcpy(batch->data.data(), carry.data(), carry.size());
+      batch->size = carry.size();
+
+      size_t framed;
+      while (true) {
+        while (!eof && batch->size < batch->data.size()) {
+          size_t bytes_read = stream_.Read(batch->data.data() + batch->size, batch->data.size() - batch->size);
+          if (bytes_read == 0) {
+            eof = true;
+          }
+          batch->size += bytes_read;
+          stage_stats.bytes += bytes_read;
+        }
+        framed = Frame(batch->data.data(), batch->size, eof);
+        if (framed > 0 || eof) {
+          break;
+        }
+        // Not even a single record fits into the batch:
+        batch->data.resize(batch->data.size() * 2);
+      }
+      if (eof && framed < batch->size) {
+        throw std::runtime_error("Truncated input record");
+      }
+      carry.assign(batch->data.data() + framed, batch->data.data() + batch->size);
+      batch->size = framed;
+      stage_stats.busy_time += clock::now() - busy_start;
+
+      if (framed == 0) {
+        free_queue_.TryPush(batch);
+        continue;
+      }
+      ++seq;
+      ++stage_stats.batches;
+      if (!Push(parse_queue_, batch, stage_stats, &stats_.parse_queue)) {
+        return;
+      }
+    }
+  } catch (...) {
+    Fail(std::current_exception());
+    return;
+  }
+
+  // Signal end of input to every parser:
+  for (size_t i = 0; i < parser_threads_; ++i) {
+    if (!Push(parse_queue_, nullptr, stage_stats, nullptr)) {
+      return;
+    }
+  }
+}
+
+void Pipeline::ParseStage(StageStats& stage_stats) {
+  while (true) {
+    Batch* batch;
+    if (!Pop(parse_queue_, batch, stage_stats)) {
+      return;
+    }
+    if (batch == nullptr) {
+      Push(upsert_queue_, nullptr, stage_stats, nullptr);
+      return;
+    }
+
+    auto busy_start = clock::now();
+    try {
+      Parse(*batch);
+    } catch (...) {
+      Fail(std::current_exception());
+      return;
+    }
+    stage_stats.busy_time += clock::now() - busy_start;
+    ++stage_stats.batches;
+    stage_stats.records += batch->records;
+    stage_stats.bytes += batch->size;
+
+    if (!Push(upsert_queue_, batch, stage_stats, nullptr)) {
+      return;
+    }
+  }
+}
+
+void Pipeline::UpsertStage() {
+  StageStats& stage_stats = stats_.upsert_stage;
+  // Parsers complete batches out of order, so they're buffered until it's their turn:
+  std::map<size_t, Batch*> pending;
+  size_t next_seq = 0;
+  size_t finished_parsers = 0;
+  bool started = false;
+
+  while (finished_parsers < parser_threads_) {
+    stats_.upsert_queue.Sample(upsert_queue_.size());
+    Batch* batch;
+    if (!Pop(upsert_queue_, batch, stage_stats)) {
+      return;
+    }
+    if (batch == nullptr) {
+      ++finished_parsers;
+      continue;
+    }
+    pending[batch->seq] = batch;
+
+    for (auto it = pending.begin(); it != pending.end() && it->first == next_seq; ++next_seq) {
+      batch = it->second;
+      if (!started) {
+        BeforeUpsert();
+        started = true;
+      }
+      auto busy_start = clock::now();
+      Upsert(*batch);
+      stage_stats.busy_time += clock::now() - busy_start;
+      ++stage_stats.batches;
+      stage_stats.records += batch->records;
+      stage_stats.bytes += batch->size;
+
+      it = pending.erase(it);
+      free_queue_.TryPush(batch);
+    }
+  }
+
+  if (!started) {
+    BeforeUpsert();
+  }
+  AfterUpsert();
+}
+
+void Pipeline::Run(const char* prefix, size_t prefix_size) {
+  stats_.parser_threads = parser_threads_;
+  stats_.parse_queue.capacity = parse_queue_.capacity();
+  stats_.upsert_queue.capacity = upsert_queue_.capacity();
+
+  std::vector<StageStats> parser_stats(parser_threads_);
+  std::vector<std::thread> threads;
+  threads.emplace_back(&Pipeline::ReadStage, this, prefix, prefix_size);
+  for (size_t i = 0; i < parser_threads_; ++i) {
+    threads.emplace_back(&Pipeline::ParseStage, this, std::ref(parser_stats[i]));
+  }
+
+  try {
+    UpsertStage();
+  } catch (...) {
+    Fail(std::current_exception());
+  }
+
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  for (auto& stage_stats : parser_stats) {
+    stats_.parse_stage.Add(stage_stats);
+  }
+  if (error_) {
+    std::rethrow_exception(error_);
+  }
+}
+
+}}
@@ -0,0 +1,105 @@
+#ifndef VIYA_INPUT_PIPELINE_H_
+#define VIYA_INPUT_PIPELINE_H_
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <exception>
+#include "input/stats.h"
+#include "input/stream.h"
+#include "util/queue.h"
+
+namespace viya {
+namespace input {
+
+namespace util = viya::util;
+
+/**
+ * Chunk of complete input records, which is passed between pipeline stages
+ */
+struct Batch {
+  Batch():seq(0),size(0),records(0) {}
+
+  size_t seq;
+  std::vector<char> data;
+  size_t size;
+  size_t records;
+
+  // Parsing results (which one is used depends on the input format):
+  std::vector<std::string> values;
+  std::vector<const char*> fields;
+};
+
+/**
+ * Staged ingestion: the reader thread splits input into batches of complete records,
+ * parser threads process these batches concurrently, and the calling thread upserts
+ * them in the original order. Stages are connected using bounded lock-free queues,
+ * and batches are recycled, so memory usage is bounded as well.
+ */
+class Pipeline {
+  public:
+    Pipeline(InputStream& stream, LoaderStats& stats, size_t parser_threads,
+             size_t batch_size = 1048576);
+    Pipeline(const Pipeline& other) = delete;
+    virtual ~Pipeline() {}
+
+    /**
+     * Runs the pipeline till the end of input. Given prefix is treated as input
+     * data preceding whatever is going to be read from the stream.
+     */
+    void Run(const char* prefix = nullptr, size_t prefix_size = 0);
+
+  protected:
+    /**
+     * Returns size of the leading part of data, which consists of complete records only.
+     * If eof is set, the data must be consumed completely.
+     */
+    virtual size_t Frame(const char* data, size_t size, bool eof) = 0;
+
+    /**
+     * Parses records of a batch. This is called from multiple threads concurrently.
+     */
+    virtual void Parse(Batch& batch) = 0;
+
+    /**
+     * Upserts records of a batch. This is called from the calling thread, in batch order.
+     */
+    virtual void Upsert(Batch& batch) = 0;
+
+    /**
+     * Called on the calling thread right before the first batch is upserted, and after
+     * the last one. Reading and parsing may already be running ahead at this point.
+     */
+    virtual void BeforeUpsert() {}
+    virtual void AfterUpsert() {}
+
+  private:
+    using Queue = util::BoundedQueue<Batch*>;
+
+    void ReadStage(const char* prefix, size_t prefix_size);
+    void ParseStage(StageStats& stage_stats);
+    void UpsertStage();
+
+    bool Push(Queue& queue, Batch* batch, StageStats& stage_stats, QueueStats* queue_stats);
+    bool Pop(Queue& queue, Batch*& batch, StageStats& stage_stats);
+    void Fail(std::exception_ptr error);
+
+  private:
+    InputStream& stream_;
+    LoaderStats& stats_;
+    const size_t parser_threads_;
+    const size_t batch_size_;
+    std::vector<std::unique_ptr<Batch>> batches_;
+    Queue free_queue_;
+    Queue parse_queue_;
+    Queue upsert_queue_;
+    std::atomic<bool> failed_;
+    std::exception_ptr error_;
+    std::mutex error_mutex_;
+};
+
+}}
+
+#endif // VIYA_INPUT_PIPELINE_H_
@@ -1,11 +1,24 @@
 #include <glog/logging.h>
 #include <sstream>
+#include <vector>
 #include "input/stats.h"
 #include "util/statsd.h"
 
 namespace viya {
 namespace input {
 
+static int64_t to_ms(const cr::duration<float>& duration) {
+  return cr::duration_cast<cr::milliseconds>(duration).count();
+}
+
+void StageStats::Add(const StageStats& other) {
+  batches += other.batches;
+  records += other.records;
+  bytes += other.bytes;
+  busy_time += other.busy_time;
+  wait_time += other.wait_time;
+}
+
 void LoaderStats::OnBegin() {
   begin_work_ = cr::steady_clock::now();
 }
@@ -24,6 +37,27 @@ void LoaderStats::OnEnd() {
   prefix<<"loader."<<table_<<".";
   statsd_.Timing(prefix.str() + "time", load_time);
   statsd_.Count(prefix.str() + "rows", total_recs);
+
+  if (parser_threads > 0) {
+    LOG(INFO)<<"Load stages busy/wait: "
+      <<"read="<<to_ms(read_stage.busy_time)<<"/"<<to_ms(read_stage.wait_time)<<" ms"
+      <<",parse="<<to_ms(parse_stage.busy_time)<<"/"<<to_ms(parse_stage.wait_time)<<" ms"
+      <<" ("<<parser_threads<<" threads)"
+      <<",upsert="<<to_ms(upsert_stage.busy_time)<<"/"<<to_ms(upsert_stage.wait_time)<<" ms"
+      <<"; queue depth avg/max: "
+      <<"parse="<<parse_queue.avg_depth()<<"/"<<parse_queue.max_depth
+      <<",upsert="<<upsert_queue.avg_depth()<<"/"<<upsert_queue.max_depth<<std::endl;
+
+    std::vector<std::pair<std::string, const StageStats*>> stages = {
+      {"read", &read_stage}, {"parse", &parse_stage}, {"upsert", &upsert_stage}
+    };
+    for (auto& stage : stages) {
+      statsd_.Timing(prefix.str() + stage.first + ".busy", to_ms(stage.second->busy_time));
+      statsd_.Timing(prefix.str() + stage.first + ".wait", to_ms(stage.second->wait_time));
+    }
+    statsd_.Gauge(prefix.str() + "parse_queue.max_depth", parse_queue.max_depth);
+    statsd_.Gauge(prefix.str() + "upsert_queue.max_depth", upsert_queue.max_depth);
+  }
 }
 
 }}
@@ -2,6 +2,7 @@
 #define VIYA_INPUT_STATS_H_
 
 #include <chrono>
+#include <algorithm>
 #include "db/stats.h"
 
 namespace viya { namespace util { class Statsd; } }
@@ -13,10 +14,47 @@ namespace db = viya::db;
 namespace cr = std::chrono;
 namespace util = viya::util;
 
+/**
+ * Ingestion pipeline stage statistics. Times are summed over all the stage threads.
+ */
+class StageStats {
+  public:
+    StageStats():batches(0),records(0),bytes(0),busy_time(0),wait_time(0) {}
+
+    void Add(const StageStats& other);
+
+    size_t batches;
+    size_t records;
+    size_t bytes;
+    cr::duration<float> busy_time;
+    cr::duration<float> wait_time; // blocked on an empty input or a full output queue
+};
+
+/**
+ * Depth of a queue between pipeline stages, sampled as batches pass through it
+ */
+class QueueStats {
+  public:
+    QueueStats():capacity(0),max_depth(0),depth_sum(0),samples(0) {}
+
+    void Sample(size_t depth) {
+      max_depth = std::max(max_depth, depth);
+      depth_sum += depth;
+      ++samples;
+    }
+
+    float avg_depth() const { return samples > 0 ? (float) depth_sum / samples : 0.0f; }
+
+    size_t capacity;
+    size_t max_depth;
+    size_t depth_sum;
+    size_t samples;
+};
+
 class LoaderStats {
   public:
     LoaderStats(const util::Statsd& statsd, const std::string& table):
-      statsd_(statsd),table_(table),total_recs(0),failed_recs(0) {}
+      statsd_(statsd),table_(table),total_recs(0),failed_recs(0),parser_threads(0) {}
 
     void OnBegin();
     void OnEnd();
@@ -29,6 +67,13 @@ class LoaderStats {
     cr::duration<float> whole_time;
     db::UpsertStats upsert_stats;
 
+    size_t parser_threads;
+    StageStats read_stage;
+    StageStats parse_stage;
+    StageStats upsert_stage;
+    QueueStats parse_queue;
+    QueueStats upsert_queue;
+
   private:
     cr::steady_clock::time_point begin_work_;
 };
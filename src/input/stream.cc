@@ -0,0 +1,599 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+#include <zlib.h>
+#include <glog/logging.h>
+#include <boost/algorithm/string/predicate.hpp>
+#include "db/defs.h"
+#include "input/stream.h"
+
+#if HAVE_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#endif
+
+#if HAVE_ZSTD
+#include <zstd.h>
+#endif
+#if HAVE_LZ4
+#include <lz4frame.h>
+#endif
+
+namespace viya {
+namespace input {
+
+// Page cache is dropped by chunks of this size:
+static const size_t DROP_CACHE_CHUNK = 8 * 1048576;
+
+static const size_t DIRECT_IO_ALIGNMENT = 4096;
+
+size_t FdStream::Read(char* buf, size_t size) {
+  ssize_t bytes_read;
+  do {
+    bytes_read = read(fd_, buf, size);
+  } while (bytes_read == -1 && errno == EINTR);
+  if (bytes_read == -1) {
+    throw std::runtime_error("I/O error reading from: " + fname_);
+  }
+  offset_ += bytes_read;
+  if (drop_cache_ && (offset_ - dropped_offset_ >= DROP_CACHE_CHUNK || bytes_read == 0)) {
+    posix_fadvise(fd_, dropped_offset_, offset_ - dropped_offset_, POSIX_FADV_DONTNEED);
+    dropped_offset_ = offset_;
+  }
+  return bytes_read;
+}
+
+#if HAVE_IO_URING
+static int io_uring_setup(unsigned entries, struct io_uring_params* params) {
+  return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+  return syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+static int io_uring_register(int ring_fd, unsigned opcode, const void* arg, unsigned nr_args) {
+  return syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args);
+}
+
+template<typename T>
+static T* ring_field(void* ring, uint32_t offset) {
+  return reinterpret_cast<T*>(static_cast<char*>(ring) + offset);
+}
+
+bool UringStream::Supported() {
+  static const bool supported = [] {
+    struct io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    int ring_fd = io_uring_setup(1, &params);
+    if (ring_fd == -1) {
+      return false;
+    }
+    close(ring_fd);
+    return true;
+  }();
+  return supported;
+}
+
+UringStream::UringStream(int fd, const std::string& fname, const ReaderOptions& options)
+  :fd_(fd),fname_(fname),block_size_(options.block_size),direct_(false),drop_cache_(false),
+  next_offset_(0),current_(0),slots_(std::max(options.queue_depth, (size_t) 1)),
+  ring_fd_(-1),sq_ring_(MAP_FAILED),cq_ring_(MAP_FAILED),sqes_(MAP_FAILED),registered_(false) {
+
+  struct stat st;
+  if (fstat(fd_, &st) == -1) {
+    throw std::runtime_error("Can't stat: " + fname_);
+  }
+  file_size_ = st.st_size;
+
+  // Direct I/O requires aligned buffers, offsets and sizes:
+  block_size_ = (std::max(block_size_, (size_t) 1) + DIRECT_IO_ALIGNMENT - 1) & ~(DIRECT_IO_ALIGNMENT - 1);
+  if (options.direct_io) {
+    int flags = fcntl(fd_, F_GETFL);
+    direct_ = flags != -1 && fcntl(fd_, F_SETFL, flags | O_DIRECT) != -1;
+    if (!direct_) {
+      LOG(WARNING)<<"Direct I/O is not supported for: "<<fname_<<", dropping cached pages instead";
+      drop_cache_ = true;
+    }
+  }
+
+  for (auto& slot : slots_) {
+    slot.buf = nullptr;
+    slot.in_flight = false;
+    slot.offset = slot.length = slot.filled = slot.consumed = slot.start = 0;
+  }
+  for (auto& slot : slots_) {
+    void* buf;
+    if (posix_memalign(&buf, DIRECT_IO_ALIGNMENT, block_size_) != 0) {
+      Close();
+      throw std::bad_alloc();
+    }
+    slot.buf = static_cast<char*>(buf);
+  }
+
+  struct io_uring_params params;
+  std::memset(&params, 0, sizeof(params));
+  ring_fd_ = io_uring_setup(slots_.size(), &params);
+  if (ring_fd_ == -1) {
+    auto error = std::string(std::strerror(errno));
+    Close();
+    throw std::runtime_error("Can't initialize io_uring: " + error);
+  }
+
+  sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+  cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+  }
+  sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+
+  sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  ring_fd_, IORING_OFF_SQ_RING);
+  if (sq_ring_ != MAP_FAILED) {
+    cq_ring_ = (params.features & IORING_FEAT_SINGLE_MMAP) ? sq_ring_
+      : mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+             ring_fd_, IORING_OFF_CQ_RING);
+    sqes_ = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                 ring_fd_, IORING_OFF_SQES);
+  }
+  if (sq_ring_ == MAP_FAILED || cq_ring_ == MAP_FAILED || sqes_ == MAP_FAILED) {
+    Close();
+    throw std::runtime_error("Can't map io_uring queues");
+  }
+  sq_tail_ = ring_field<uint32_t>(sq_ring_, params.sq_off.tail);
+  sq_mask_ = ring_field<uint32_t>(sq_ring_, params.sq_off.ring_mask);
+  sq_array_ = ring_field<uint32_t>(sq_ring_, params.sq_off.array);
+  cq_head_ = ring_field<uint32_t>(cq_ring_, params.cq_off.head);
+  cq_tail_ = ring_field<uint32_t>(cq_ring_, params.cq_off.tail);
+  cq_mask_ = ring_field<uint32_t>(cq_ring_, params.cq_off.ring_mask);
+  cqes_ = ring_field<struct io_uring_cqe>(cq_ring_, params.cq_off.cqes);
+
+  // Registered buffers save mapping pages on every read, but may fail due to RLIMIT_MEMLOCK:
+  std::vector<struct iovec> iovecs(slots_.size());
+  for (size_t i = 0; i < slots_.size(); ++i) {
+    iovecs[i].iov_base = slots_[i].buf;
+    iovecs[i].iov_len = block_size_;
+  }
+  registered_ = io_uring_register(ring_fd_, IORING_REGISTER_BUFFERS, iovecs.data(), iovecs.size()) == 0;
+
+  for (size_t i = 0; i < slots_.size() && next_offset_ < file_size_; ++i) {
+    slots_[i].offset = next_offset_;
+    slots_[i].length = std::min(block_size_, file_size_ - next_offset_);
+    next_offset_ += slots_[i].length;
+    Submit(i);
+  }
+}
+
+UringStream::~UringStream() {
+  Close();
+}
+
+void UringStream::Close() {
+  if (ring_fd_ != -1) {
+    // Buffers can't be released while the kernel may still write into them:
+    bool drained = true;
+    try {
+      while (std::any_of(slots_.begin(), slots_.end(), [](const Slot& slot) { return slot.in_flight; })) {
+        Reap(true);
+      }
+    } catch (const std::exception& e) {
+      LOG(ERROR)<<e.what()<<", leaking read buffers of: "<<fname_;
+      drained = false;
+    }
+    if (sqes_ != MAP_FAILED) {
+      munmap(sqes_, sqes_size_);
+    }
+    if (cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_) {
+      munmap(cq_ring_, cq_ring_size_);
+    }
+    if (sq_ring_ != MAP_FAILED) {
+      munmap(sq_ring_, sq_ring_size_);
+    }
+    close(ring_fd_);
+    ring_fd_ = -1;
+    if (!drained) {
+      slots_.clear();
+    }
+  }
+  for (auto& slot : slots_) {
+    free(slot.buf);
+  }
+  slots_.clear();
+}
+
+void UringStream::Submit(size_t slot_idx) {
+  Slot& slot = slots_[slot_idx];
+  // Direct I/O can't continue a short read from where it stopped, so the last aligned
+  // block is read again:
+  slot.start = direct_ ? slot.filled & ~(DIRECT_IO_ALIGNMENT - 1) : slot.filled;
+  size_t length = slot.length - slot.start;
+  if (direct_) {
+    length = (length + DIRECT_IO_ALIGNMENT - 1) & ~(DIRECT_IO_ALIGNMENT - 1);
+  }
+
+  uint32_t tail = *sq_tail_;
+  uint32_t index = tail & *sq_mask_;
+  auto sqe = static_cast<struct io_uring_sqe*>(sqes_) + index;
+  std::memset(sqe, 0, sizeof(*sqe));
+  sqe->fd = fd_;
+  sqe->off = slot.offset + slot.start;
+  sqe->user_data = slot_idx;
+  if (registered_) {
+    sqe->opcode = IORING_OP_READ_FIXED;
+    sqe->addr = reinterpret_cast<uint64_t>(slot.buf + slot.start);
+    sqe->len = length;
+    sqe->buf_index = slot_idx;
+  } else {
+    // Unlike IORING_OP_READ, vectored read is supported by all io_uring kernels (5.1+):
+    slot.iov.iov_base = slot.buf + slot.start;
+    slot.iov.iov_len = length;
+    sqe->opcode = IORING_OP_READV;
+    sqe->addr = reinterpret_cast<uint64_t>(&slot.iov);
+    sqe->len = 1;
+  }
+  sq_array_[index] = index;
+  __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+
+  while (io_uring_enter(ring_fd_, 1, 0, 0) == -1) {
+    if (errno != EINTR) {
+      throw std::runtime_error("Can't submit read request: " + std::string(std::strerror(errno)));
+    }
+  }
+  slot.in_flight = true;
+}
+
+void UringStream::Reap(bool closing) {
+  uint32_t head = *cq_head_;
+  while (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+    if (io_uring_enter(ring_fd_, 0, 1, IORING_ENTER_GETEVENTS) == -1 && errno != EINTR) {
+      throw std::runtime_error("Can't wait for read completion: " + std::string(std::strerror(errno)));
+    }
+  }
+  auto cqe = static_cast<struct io_uring_cqe*>(cqes_) + (head & *cq_mask_);
+  size_t slot_idx = cqe->user_data;
+  int res = cqe->res;
+  __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+
+  Slot& slot = slots_[slot_idx];
+  slot.in_flight = false;
+  if (closing) {
+    return;
+  }
+  if (res < 0) {
+    throw std::runtime_error("I/O error reading from: " + fname_ + " (" + std::strerror(-res) + ")");
+  }
+  size_t filled = std::min(slot.length, slot.start + res);
+  if (filled <= slot.filled && slot.filled < slot.length) {
+    // File was truncated while being read:
+    slot.length = slot.filled;
+    file_size_ = next_offset_ = slot.offset + slot.filled;
+  }
+  slot.filled = std::max(slot.filled, filled);
+  if (slot.filled < slot.length) {
+    Submit(slot_idx);
+  }
+}
+
+size_t UringStream::Read(char* buf, size_t size) {
+  Slot* slot = &slots_[current_];
+  if (slot->length > 0 && slot->consumed == slot->length) {
+    // Reuse consumed slot for the next block, and move on to the next slot:
+    if (drop_cache_) {
+      posix_fadvise(fd_, slot->offset, slot->length, POSIX_FADV_DONTNEED);
+    }
+    slot->length = slot->filled = slot->consumed = 0;
+    if (next_offset_ < file_size_) {
+      slot->offset = next_offset_;
+      slot->length = std::min(block_size_, file_size_ - next_offset_);
+      next_offset_ += slot->length;
+      Submit(current_);
+    }
+    current_ = (current_ + 1) % slots_.size();
+    slot = &slots_[current_];
+  }
+  if (slot->length == 0) {
+    return 0;
+  }
+  while (slot->filled < slot->length) {
+    Reap();
+  }
+  size_t bytes = std::min(size, slot->length - slot->consumed);
+  std::memcpy(buf, slot->buf + slot->consumed, bytes);
+  slot->consumed += bytes;
+  return bytes;
+}
+#else
+bool UringStream::Supported() {
+  return false;
+}
+
+UringStream::UringStream(int fd __attribute__((unused)), const std::string& fname,
+                         const ReaderOptions& options __attribute__((unused))) {
+  throw std::runtime_error("Can't read " + fname + ": io_uring support is not compiled in");
+}
+
+UringStream::~UringStream() {}
+
+void UringStream::Close() {}
+
+size_t UringStream::Read(char* buf __attribute__((unused)), size_t size __attribute__((unused))) {
+  return 0;
+}
+#endif
+
+bool DecompressStream::FillInput() {
+  if (in_pos_ < in_size_) {
+    return true;
+  }
+  if (eof_) {
+    return false;
+  }
+  in_pos_ = 0;
+  in_size_ = source_->Read(in_.data(), in_.size());
+  eof_ = in_size_ == 0;
+  return !eof_;
+}
+
+GzipStream::GzipStream(std::unique_ptr<InputStream> source, const std::string& fname)
+  :DecompressStream(std::move(source), fname),member_started_(false),member_finished_(false) {
+  z_stream* zs = new z_stream();
+  // Detect gzip or zlib header automatically:
+  if (inflateInit2(zs, 15 + 32) != Z_OK) {
+    delete zs;
+    throw std::runtime_error("Can't initialize gzip decompression");
+  }
+  zstream_ = zs;
+}
+
+GzipStream::~GzipStream() {
+  z_stream* zs = static_cast<z_stream*>(zstream_);
+  inflateEnd(zs);
+  delete zs;
+}
+
+size_t GzipStream::Read(char* buf, size_t size) {
+  z_stream* zs = static_cast<z_stream*>(zstream_);
+  zs->next_out = reinterpret_cast<Bytef*>(buf);
+  zs->avail_out = size;
+
+  while (zs->avail_out == size && (FillInput() || pending_)) {
+    if (member_finished_) {
+      // Concatenated gzip members are allowed:
+      inflateReset(zs);
+      member_finished_ = false;
+    }
+    zs->next_in = reinterpret_cast<Bytef*>(in_.data() + in_pos_);
+    zs->avail_in = in_size_ - in_pos_;
+    member_started_ = true;
+
+    int ret = inflate(zs, Z_NO_FLUSH);
+    in_pos_ = in_size_ - zs->avail_in;
+    pending_ = zs->avail_out == 0;
+    if (ret == Z_STREAM_END) {
+      member_finished_ = true;
+    } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+      throw std::runtime_error("Corrupted gzip data in: " + fname_);
+    }
+  }
+
+  size_t produced = size - zs->avail_out;
+  if (produced == 0 && member_started_ && !member_finished_) {
+    throw std::runtime_error("Truncated gzip data in: " + fname_);
+  }
+  return produced;
+}
+
+#if HAVE_ZSTD
+ZstdStream::ZstdStream(std::unique_ptr<InputStream> source, const std::string& fname)
+  :DecompressStream(std::move(source), fname, ZSTD_DStreamInSize()),last_ret_(0) {
+  dctx_ = ZSTD_createDCtx();
+  if (dctx_ == nullptr) {
+    throw std::runtime_error("Can't initialize zstd decompression");
+  }
+}
+
+ZstdStream::~ZstdStream() {
+  ZSTD_freeDCtx(static_cast<ZSTD_DCtx*>(dctx_));
+}
+
+size_t ZstdStream::Read(char* buf, size_t size) {
+  ZSTD_outBuffer out = { buf, size, 0 };
+  while (out.pos == 0 && (FillInput() || pending_)) {
+    ZSTD_inBuffer in = { in_.data(), in_size_, in_pos_ };
+    last_ret_ = ZSTD_decompressStream(static_cast<ZSTD_DCtx*>(dctx_), &out, &in);
+    if (ZSTD_isError(last_ret_)) {
+      throw std::runtime_error("Corrupted zstd data in: " + fname_ + " ("
+                               + ZSTD_getErrorName(last_ret_) + ")");
+    }
+    in_pos_ = in.pos;
+    pending_ = out.pos == out.size;
+  }
+  if (out.pos == 0 && last_ret_ != 0) {
+    throw std::runtime_error("Truncated zstd data in: " + fname_);
+  }
+  return out.pos;
+}
+#else
+ZstdStream::ZstdStream(std::unique_ptr<InputStream> source, const std::string& fname)
+  :DecompressStream(std::move(source), fname, 0) {
+  throw std::runtime_error("Can't read " + fname + ": zstd support is not compiled in");
+}
+
+ZstdStream::~ZstdStream() {}
+
+size_t ZstdStream::Read(char* buf __attribute__((unused)), size_t size __attribute__((unused))) {
+  return 0;
+}
+#endif
+
+#if HAVE_LZ4
+Lz4Stream::Lz4Stream(std::unique_ptr<InputStream> source, const std::string& fname)
+  :DecompressStream(std::move(source), fname),last_ret_(0) {
+  LZ4F_dctx* dctx;
+  if (LZ4F_isError(LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION))) {
+    throw std::runtime_error("Can't initialize lz4 decompression");
+  }
+  dctx_ = dctx;
+}
+
+Lz4Stream::~Lz4Stream() {
+  LZ4F_freeDecompressionContext(static_cast<LZ4F_dctx*>(dctx_));
+}
+
+size_t Lz4Stream::Read(char* buf, size_t size) {
+  size_t produced = 0;
+  while (produced == 0 && (FillInput() || pending_)) {
+    size_t dst_size = size;
+    size_t src_size = in_size_ - in_pos_;
+    last_ret_ = LZ4F_decompress(static_cast<LZ4F_dctx*>(dctx_), buf, &dst_size,
+                                in_.data() + in_pos_, &src_size, nullptr);
+    if (LZ4F_isError(last_ret_)) {
+      throw std::runtime_error("Corrupted lz4 data in: " + fname_ + " ("
+                               + LZ4F_getErrorName(last_ret_) + ")");
+    }
+    in_pos_ += src_size;
+    produced = dst_size;
+    pending_ = produced == size;
+  }
+  if (produced == 0 && last_ret_ != 0) {
+    throw std::runtime_error("Truncated lz4 data in: " + fname_);
+  }
+  return produced;
+}
+#else
+Lz4Stream::Lz4Stream(std::unique_ptr<InputStream> source, const std::string& fname)
+  :DecompressStream(std::move(source), fname, 0) {
+  throw std::runtime_error("Can't read " + fname + ": lz4 support is not compiled in");
+}
+
+Lz4Stream::~Lz4Stream() {}
+
+size_t Lz4Stream::Read(char* buf __attribute__((unused)), size_t size __attribute__((unused))) {
+  return 0;
+}
+#endif
+
+AsyncStream::AsyncStream(std::unique_ptr<InputStream> source, size_t buffers_num, size_t buffer_size)
+  :source_(std::move(source)),chunks_(buffers_num),current_(nullptr),current_pos_(0),stop_(false) {
+
+  for (auto& chunk : chunks_) {
+    chunk.data.resize(buffer_size);
+    chunk.size = 0;
+    free_.push_back(&chunk);
+  }
+  thread_ = std::thread(&AsyncStream::Run, this);
+}
+
+AsyncStream::~AsyncStream() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  free_cv_.notify_all();
+  thread_.join();
+}
+
+void AsyncStream::Run() {
+  while (true) {
+    Chunk* chunk;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      free_cv_.wait(lock, [this] { return stop_ || !free_.empty(); });
+      if (stop_) {
+        return;
+      }
+      chunk = free_.front();
+      free_.pop_front();
+    }
+
+    // Fill the whole chunk, so the consumer gets large contiguous reads:
+    chunk->size = 0;
+    std::exception_ptr error;
+    try {
+      while (chunk->size < chunk->data.size()) {
+        size_t bytes_read = source_->Read(chunk->data.data() + chunk->size, chunk->data.size() - chunk->size);
+        if (bytes_read == 0) {
+          break;
+        }
+        chunk->size += bytes_read;
+      }
+    } catch (...) {
+      error = std::current_exception();
+    }
+
+    bool done = error || chunk->size < chunk->data.size();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (chunk->size > 0) {
+        ready_.push_back(chunk);
+      }
+      if (done) {
+        // Null chunk marks the end of stream:
+        error_ = error;
+        ready_.push_back(nullptr);
+      }
+    }
+    ready_cv_.notify_one();
+    if (done) {
+      return;
+    }
+  }
+}
+
+size_t AsyncStream::Read(char* buf, size_t size) {
+  if (current_ == nullptr || current_pos_ == current_->size) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (current_ != nullptr) {
+      free_.push_back(current_);
+      free_cv_.notify_one();
+      current_ = nullptr;
+    }
+    ready_cv_.wait(lock, [this] { return !ready_.empty(); });
+    if (ready_.front() == nullptr) {
+      if (error_) {
+        std::rethrow_exception(error_);
+      }
+      return 0;
+    }
+    current_ = ready_.front();
+    ready_.pop_front();
+    current_pos_ = 0;
+  }
+
+  size_t bytes = std::min(size, current_->size - current_pos_);
+  std::memcpy(buf, current_->data.data() + current_pos_, bytes);
+  current_pos_ += bytes;
+  return bytes;
+}
+
+std::unique_ptr<InputStream> create_input_stream(int fd, const std::string& fname,
+                                                 const ReaderOptions& options) {
+  std::unique_ptr<InputStream> stream;
+  if (options.io_uring && UringStream::Supported()) {
+    stream.reset(new UringStream(fd, fname, options));
+  } else {
+    if (options.io_uring) {
+      LOG(WARNING)<<"io_uring is not supported, falling back to blocking reads";
+    }
+    stream.reset(new FdStream(fd, fname, options.direct_io));
+  }
+
+  if (boost::algorithm::ends_with(fname, ".gz")) {
+    stream.reset(new GzipStream(std::move(stream), fname));
+  } else if (boost::algorithm::ends_with(fname, ".zst")) {
+    stream.reset(new ZstdStream(std::move(stream), fname));
+  } else if (boost::algorithm::ends_with(fname, ".lz4")) {
+    stream.reset(new Lz4Stream(std::move(stream), fname));
+  } else {
+    return stream;
+  }
+  return std::unique_ptr<InputStream>(new AsyncStream(std::move(stream)));
+}
+
+}}
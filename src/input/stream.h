@@ -0,0 +1,236 @@
+#ifndef VIYA_INPUT_STREAM_H_
+#define VIYA_INPUT_STREAM_H_
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <cstdint>
+#include <sys/uio.h>
+
+namespace viya {
+namespace input {
+
+/**
+ * Sequential source of bytes
+ */
+class InputStream {
+  public:
+    InputStream() {}
+    InputStream(const InputStream& other) = delete;
+    virtual ~InputStream() {}
+
+    /**
+     * Reads up to the given number of bytes into the buffer.
+     * Returns number of bytes read, or zero when the end of stream is reached.
+     */
+    virtual size_t Read(char* buf, size_t size) = 0;
+};
+
+/**
+ * File reading options
+ */
+struct ReaderOptions {
+  ReaderOptions():io_uring(false),direct_io(false),queue_depth(4),block_size(1048576) {}
+
+  bool io_uring;       // read asynchronously using io_uring, if supported by the kernel
+  bool direct_io;      // don't leave file contents in the page cache
+  size_t queue_depth;  // number of reads in flight (io_uring only)
+  size_t block_size;   // size of a single read (io_uring only)
+};
+
+/**
+ * Reads raw file contents using blocking reads
+ */
+class FdStream: public InputStream {
+  public:
+    FdStream(int fd, const std::string& fname, bool drop_cache = false)
+      :fd_(fd),fname_(fname),drop_cache_(drop_cache),offset_(0),dropped_offset_(0) {}
+
+    size_t Read(char* buf, size_t size);
+
+  protected:
+    int fd_;
+    const std::string fname_;
+    bool drop_cache_;
+    size_t offset_;
+    size_t dropped_offset_;
+};
+
+/**
+ * Reads raw file contents using io_uring: several large reads into registered buffers
+ * are kept in flight, while the consumer processes completed ones in file order.
+ * With direct I/O the file is read using O_DIRECT, bypassing the page cache.
+ */
+class UringStream: public InputStream {
+  public:
+    UringStream(int fd, const std::string& fname, const ReaderOptions& options);
+    ~UringStream();
+
+    size_t Read(char* buf, size_t size);
+
+    /**
+     * Returns whether io_uring is usable on this system
+     */
+    static bool Supported();
+
+  private:
+    struct Slot {
+      char* buf;
+      size_t offset;
+      size_t length;   // expected number of bytes
+      size_t filled;   // bytes read so far
+      size_t consumed; // bytes passed to the consumer
+      size_t start;    // position in buffer, which the request in flight reads into
+      struct iovec iov; // the request buffer, unless buffers are registered
+      bool in_flight;
+    };
+
+    void Submit(size_t slot_idx);
+    /**
+     * Waits for a single completion. While closing, short reads aren't resubmitted,
+     * and failed reads aren't reported
+     */
+    void Reap(bool closing = false);
+    void Close();
+
+  private:
+    int fd_;
+    const std::string fname_;
+    size_t block_size_;
+    bool direct_;
+    bool drop_cache_;
+    size_t file_size_;
+    size_t next_offset_;
+    size_t current_;
+    std::vector<Slot> slots_;
+    int ring_fd_;
+    void* sq_ring_;
+    void* cq_ring_;
+    void* sqes_;
+    uint32_t* sq_tail_;
+    uint32_t* sq_mask_;
+    uint32_t* sq_array_;
+    uint32_t* cq_head_;
+    uint32_t* cq_tail_;
+    uint32_t* cq_mask_;
+    void* cqes_;
+    size_t sq_ring_size_;
+    size_t cq_ring_size_;
+    size_t sqes_size_;
+    bool registered_;
+};
+
+/**
+ * Base class for compressed file readers
+ */
+class DecompressStream: public InputStream {
+  public:
+    DecompressStream(std::unique_ptr<InputStream> source, const std::string& fname,
+                     size_t buffer_size = 262144)
+      :source_(std::move(source)),fname_(fname),in_(buffer_size),in_pos_(0),in_size_(0),
+      eof_(false),pending_(false) {}
+
+  protected:
+    /**
+     * Makes sure there's some compressed input available.
+     * Returns false when there's no more input.
+     */
+    bool FillInput();
+
+  protected:
+    std::unique_ptr<InputStream> source_;
+    const std::string fname_;
+    std::vector<char> in_;
+    size_t in_pos_;
+    size_t in_size_;
+    bool eof_;
+    // Decompressor may hold more output, which didn't fit into the last buffer:
+    bool pending_;
+};
+
+class GzipStream: public DecompressStream {
+  public:
+    GzipStream(std::unique_ptr<InputStream> source, const std::string& fname);
+    ~GzipStream();
+
+    size_t Read(char* buf, size_t size);
+
+  private:
+    void* zstream_;
+    bool member_started_;
+    bool member_finished_;
+};
+
+class ZstdStream: public DecompressStream {
+  public:
+    ZstdStream(std::unique_ptr<InputStream> source, const std::string& fname);
+    ~ZstdStream();
+
+    size_t Read(char* buf, size_t size);
+
+  private:
+    void* dctx_;
+    size_t last_ret_;
+};
+
+class Lz4Stream: public DecompressStream {
+  public:
+    Lz4Stream(std::unique_ptr<InputStream> source, const std::string& fname);
+    ~Lz4Stream();
+
+    size_t Read(char* buf, size_t size);
+
+  private:
+    void* dctx_;
+    size_t last_ret_;
+};
+
+/**
+ * Reads the underlying stream on a separate thread ahead of the consumer,
+ * and passes filled buffers to it through a bounded queue.
+ */
+class AsyncStream: public InputStream {
+  public:
+    AsyncStream(std::unique_ptr<InputStream> source, size_t buffers_num = 4, size_t buffer_size = 1048576);
+    ~AsyncStream();
+
+    size_t Read(char* buf, size_t size);
+
+  private:
+    struct Chunk {
+      std::vector<char> data;
+      size_t size;
+    };
+
+    void Run();
+
+  private:
+    std::unique_ptr<InputStream> source_;
+    std::vector<Chunk> chunks_;
+    std::deque<Chunk*> free_;
+    std::deque<Chunk*> ready_;
+    Chunk* current_;
+    size_t current_pos_;
+    bool stop_;
+    std::exception_ptr error_;
+    std::mutex mutex_;
+    std::condition_variable free_cv_;
+    std::condition_variable ready_cv_;
+    std::thread thread_;
+};
+
+/**
+ * Creates stream for reading file contents. Compressed files are recognized by
+ * their extension (.gz, .zst, .lz4), and are decompressed on a separate thread.
+ */
+std::unique_ptr<InputStream> create_input_stream(int fd, const std::string& fname,
+                                                 const ReaderOptions& options = ReaderOptions());
+
+}}
+
+#endif // VIYA_INPUT_STREAM_H_
@@ -1,9 +1,14 @@
 #include <glog/logging.h>
 #include <dirent.h>
 #include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <cerrno>
 #include <cstring>
+#include <ctime>
+#include <sstream>
 #include <stdexcept>
 #include <algorithm>
 #include <boost/algorithm/string/predicate.hpp>
@@ -19,15 +24,20 @@ Watcher::Watcher(db::Database& db):db_(db) {
   if (fd_ == -1) {
     throw std::runtime_error(std::strerror(errno));
   }
+  stop_fd_ = eventfd(0, 0);
+  if (stop_fd_ == -1) {
+    close(fd_);
+    throw std::runtime_error(std::strerror(errno));
+  }
 }
 
 void Watcher::AddWatch(const util::Config& config, db::Table* table) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
   if (!thread_.joinable()) {
     thread_ = std::thread(&Watcher::Run, this);
   }
 
-  std::lock_guard<std::mutex> lock(mutex_);
-
   char* dir = realpath(config.str("directory").c_str(), nullptr);
   LOG(INFO)<<"Watching directory for new files: "<<dir;
 
@@ -36,15 +46,38 @@ void Watcher::AddWatch(const util::Config& config, db::Table* table) {
     free(dir);
     throw std::runtime_error(std::strerror(errno));
   }
-  watches_.emplace_back(table, std::string(dir), config.strlist("extensions", {".tsv"}), wd);
+  util::Config load_conf;
+  load_conf.set_str("type", "file");
+  load_conf.set_str("format", config.str("format", "tsv").c_str());
+  load_conf.set_str("table", table->name().c_str());
+  for (auto key : {"parser_threads", "io_depth", "io_block_size"}) {
+    if (config.exists(key)) {
+      load_conf.set_num(key, config.num(key));
+    }
+  }
+  for (auto key : {"io_uring", "direct_io"}) {
+    if (config.exists(key)) {
+      load_conf.set_boolean(key, config.boolean(key));
+    }
+  }
+
+  watches_.push_back(std::make_shared<Watch>(
+      table, std::string(dir), config.strlist("extensions", {".tsv", ".tsv.gz", ".tsv.zst", ".tsv.lz4"}), load_conf,
+      config.num("concurrency", 1), config.num("queue_size", 100), wd));
   free(dir);
 }
 
 void Watcher::RemoveWatch(db::Table* table) {
   std::lock_guard<std::mutex> lock(mutex_);
 
-  watches_.erase(std::remove_if(watches_.begin(), watches_.end(), [table](Watch& w) {
-    return w.table == table;
+  watches_.erase(std::remove_if(watches_.begin(), watches_.end(), [table](std::shared_ptr<Watch>& w) {
+    if (w->table == table) {
+      // Loads that are already running will complete, but nothing new is started:
+      w->removed = true;
+      w->queue.clear();
+      return true;
+    }
+    return false;
   }), watches_.end());
 }
 
@@ -67,35 +100,108 @@ std::vector<std::string> Watcher::ScanFiles(Watch& watch) {
   return files;
 }
 
-void Watcher::ProcessEvent(Watch& watch) {
+void Watcher::Enqueue(Watch& watch) {
+  watch.held_back = 0;
   for (auto& file : ScanFiles(watch)) {
     if (watch.last_file.empty() || watch.last_file < file) {
-      db_.write_pool().push([=](int id __attribute__((unused))) {
-        try {
-          util::Config load_conf;
-          load_conf.set_str("type", "file");
-          load_conf.set_str("file", file.c_str());
-          load_conf.set_str("format", "tsv");
-          load_conf.set_str("table", watch.table->name().c_str());
-          db_.Load(load_conf);
-        } catch (std::exception& e) {
-          LOG(ERROR)<<"Error loading file "<<file<<": "<<e.what();
-        }
-      });
+      if (watch.queue.size() >= watch.queue_size) {
+        ++watch.held_back;
+        continue;
+      }
+      watch.queue.push_back(file);
       watch.last_file = file;
     }
   }
 }
 
+void Watcher::Dispatch(std::shared_ptr<Watch> watch) {
+  while (!watch->removed && watch->running.size() < watch->concurrency && !watch->queue.empty()) {
+    std::string file = watch->queue.front();
+    watch->queue.pop_front();
+    watch->running.insert(file);
+
+    util::Config load_conf = watch->load_conf;
+    load_conf.set_str("file", file.c_str());
+    db_.ingest_pool().push([=](int id __attribute__((unused))) {
+      try {
+        db_.Load(load_conf);
+      } catch (std::exception& e) {
+        LOG(ERROR)<<"Error loading file "<<file<<": "<<e.what();
+      }
+      OnLoaded(watch, file);
+    });
+  }
+}
+
+void Watcher::OnLoaded(std::shared_ptr<Watch> watch, const std::string& file) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  watch->running.erase(file);
+  if (watch->removed) {
+    return;
+  }
+  if (watch->held_back > 0) {
+    Enqueue(*watch);
+  }
+  Dispatch(watch);
+  ReportLag(*watch);
+}
+
+void Watcher::ReportLag(Watch& watch) {
+  // Age of the oldest file, which is not loaded yet:
+  std::string oldest_file;
+  if (!watch.running.empty()) {
+    oldest_file = *watch.running.begin();
+  } else if (!watch.queue.empty()) {
+    oldest_file = watch.queue.front();
+  }
+  long lag = 0;
+  struct stat st;
+  if (!oldest_file.empty() && stat(oldest_file.c_str(), &st) == 0) {
+    lag = std::max(0L, (long) (std::time(nullptr) - st.st_mtime));
+  }
+
+  std::ostringstream prefix;
+  prefix<<"watcher."<<watch.table->name()<<".";
+  auto& statsd = db_.statsd();
+  statsd.Gauge(prefix.str() + "running", watch.running.size());
+  statsd.Gauge(prefix.str() + "queued", watch.queue.size());
+  statsd.Gauge(prefix.str() + "held_back", watch.held_back);
+  statsd.Gauge(prefix.str() + "lag_seconds", lag);
+}
+
+void Watcher::ProcessEvent(std::shared_ptr<Watch> watch) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (watch->removed) {
+    return;
+  }
+  Enqueue(*watch);
+  Dispatch(watch);
+  ReportLag(*watch);
+}
+
 void Watcher::Run() {
   static const size_t EVENT_SIZE = sizeof(struct inotify_event);
   static const size_t BUF_LEN = 1024 * (EVENT_SIZE + 16);
   char buffer[BUF_LEN];
 
+  struct pollfd fds[2] = {{fd_, POLLIN, 0}, {stop_fd_, POLLIN, 0}};
+
   while (true) {
+    if (poll(fds, 2, -1) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      LOG(ERROR)<<"Error waiting for watcher events: "<<std::strerror(errno);
+      return;
+    }
+    if (fds[1].revents != 0) {
+      return;
+    }
+
     ssize_t length = read(fd_, buffer, BUF_LEN);
     if (length == -1) {
-      throw std::runtime_error(std::strerror(errno));
+      LOG(ERROR)<<"Error reading watcher events: "<<std::strerror(errno);
+      return;
     }
 
     ssize_t i = 0;
@@ -105,12 +211,16 @@ void Watcher::Run() {
       if (event->len > 0) {
         if ((event->mask & IN_MOVED_TO) != 0 && (event->mask & IN_ISDIR) == 0) {
           std::unique_lock<std::mutex> lock(mutex_);
-          auto it = std::find_if(watches_.begin(), watches_.end(), [event](Watch& w) {
-            return w.wd == event->wd;
+          auto it = std::find_if(watches_.begin(), watches_.end(), [event](std::shared_ptr<Watch>& w) {
+            return w->wd == event->wd;
           });
-          lock.unlock();
+          std::shared_ptr<Watch> watch;
           if (it != watches_.end()) {
-            ProcessEvent(*it);
+            watch = *it;
+          }
+          lock.unlock();
+          if (watch) {
+            ProcessEvent(watch);
           }
         }
       }
@@ -120,16 +230,21 @@ void Watcher::Run() {
 }
 
 Watcher::~Watcher() {
+  if (thread_.joinable()) {
+    uint64_t stop = 1;
+    if (write(stop_fd_, &stop, sizeof(stop)) == -1) {
+      LOG(ERROR)<<"Can't stop watcher thread: "<<std::strerror(errno);
+    }
+    thread_.join();
+  }
+  close(stop_fd_);
+
   if (fd_ != -1) {
     for (auto& watch : watches_) {
-      inotify_rm_watch(fd_, watch.wd);
+      inotify_rm_watch(fd_, watch->wd);
     }
     close(fd_);
   }
-
-  if (thread_.joinable()) {
-    thread_.join();
-  }
 }
 
 }}
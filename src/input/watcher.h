@@ -2,6 +2,9 @@
 #define VIYA_INPUT_WATCHER_H_
 
 #include <vector>
+#include <deque>
+#include <set>
+#include <memory>
 #include <thread>
 #include <mutex>
 #include "util/config.h"
@@ -20,15 +23,29 @@ namespace input {
 namespace db = viya::db;
 namespace util = viya::util;
 
+/**
+ * Watched directory, and its ingestion queue. Files are loaded in the order of their names,
+ * with up to "concurrency" files being loaded at the same time. Up to "queue_size" files
+ * are queued, while the rest are held back in the directory, until there's room for them.
+ */
 struct Watch {
-  Watch(db::Table* table, std::string dir, std::vector<std::string> exts, int wd):
-    table(table),dir(dir),exts(exts),wd(wd) {}
+  Watch(db::Table* table, std::string dir, std::vector<std::string> exts, util::Config load_conf,
+        size_t concurrency, size_t queue_size, int wd):
+    table(table),dir(dir),exts(exts),load_conf(load_conf),concurrency(concurrency),
+    queue_size(queue_size),wd(wd),held_back(0),removed(false) {}
 
   db::Table* table;
   std::string dir;
   std::vector<std::string> exts;
+  util::Config load_conf;          // load parameters, except for the file name
+  size_t concurrency;
+  size_t queue_size;
   int wd;
-  std::string last_file;
+  std::string last_file;           // last file that was queued
+  std::deque<std::string> queue;   // files waiting for an ingestion thread
+  std::set<std::string> running;   // files being loaded
+  size_t held_back;                // files left in the directory due to a full queue
+  bool removed;
 };
 
 class Watcher {
@@ -41,15 +58,20 @@ class Watcher {
 
   private:
     std::vector<std::string> ScanFiles(Watch& watch);
-    void ProcessEvent(Watch& watch);
+    void ProcessEvent(std::shared_ptr<Watch> watch);
+    void Enqueue(Watch& watch);
+    void Dispatch(std::shared_ptr<Watch> watch);
+    void OnLoaded(std::shared_ptr<Watch> watch, const std::string& file);
+    void ReportLag(Watch& watch);
     void Run();
 
   private:
     db::Database& db_;
     int fd_;
+    int stop_fd_;
     std::thread thread_;
     std::mutex mutex_;
-    std::vector<Watch> watches_;
+    std::vector<std::shared_ptr<Watch>> watches_;
 };
 
 }}
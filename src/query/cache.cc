@@ -0,0 +1,138 @@
+#include "query/cache.h"
+
+namespace viya {
+namespace query {
+
+void RecordingRowOutput::Record(const Row& row, bool as_col) {
+  if (!result_) {
+    return;
+  }
+  size_t row_size = sizeof(Row);
+  for (auto& v : row) {
+    row_size += sizeof(std::string) + v.size();
+  }
+  if (result_->size + row_size > max_size_) {
+    result_.reset();
+    return;
+  }
+  result_->rows.push_back(row);
+  result_->as_col.push_back(as_col);
+  result_->size += row_size;
+}
+
+/**
+ * Memory taken by the cache entry: the value, the key which is held by both the map and
+ * the LRU list, and approximate overhead of their nodes
+ */
+static size_t entry_size(const std::string& key, size_t value_size) {
+  return value_size + 2 * (sizeof(std::string) + key.size()) + 64;
+}
+
+std::shared_ptr<const void> QueryCache::Get(const std::string& key, uint64_t version) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(key);
+  if (it == entries_.end()) {
+    ++stats_.misses;
+    return nullptr;
+  }
+  if (it->second.version != version) {
+    // Data has changed since the value was computed:
+    Remove(it);
+    ++stats_.misses;
+    return nullptr;
+  }
+  ++stats_.hits;
+  lru_.splice(lru_.begin(), lru_, it->second.lru_it);
+  return it->second.value;
+}
+
+void QueryCache::Put(const std::string& table, const std::string& key, uint64_t version,
+                     std::shared_ptr<const void> value, size_t size) {
+  size = entry_size(key, size);
+  if (size > max_entry_size()) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(key);
+  if (it != entries_.end()) {
+    Remove(it);
+  }
+  lru_.push_front(key);
+  entries_.insert(std::make_pair(key, Entry {table, version, value, size, lru_.begin()}));
+  size_ += size;
+
+  while (size_ > max_size_) {
+    Remove(entries_.find(lru_.back()));
+    ++stats_.evictions;
+  }
+}
+
+void QueryCache::Invalidate(const std::string& table) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto it = entries_.begin(); it != entries_.end();) {
+    auto next = std::next(it);
+    if (it->second.table == table) {
+      Remove(it);
+    }
+    it = next;
+  }
+}
+
+void QueryCache::Remove(std::unordered_map<std::string,Entry>::iterator it) {
+  size_ -= it->second.size;
+  lru_.erase(it->second.lru_it);
+  entries_.erase(it);
+}
+
+CacheStats QueryCache::stats() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  CacheStats stats = stats_;
+  stats.entries = entries_.size();
+  stats.size = size_;
+  return stats;
+}
+
+void ResultCache::Send(const CachedResult& result, RowOutput& output) {
+  output.Start();
+  for (size_t i = 0; i < result.rows.size(); ++i) {
+    if (result.as_col[i]) {
+      output.SendAsCol(result.rows[i]);
+    } else {
+      output.Send(result.rows[i]);
+    }
+  }
+  output.Flush();
+}
+
+/**
+ * Partial along with the library, which its class comes from
+ */
+struct PinnedPartial {
+  std::shared_ptr<codegen::SharedLibrary> library;
+  std::shared_ptr<const void> partial;
+};
+
+std::string SegmentPartials::SegmentKey(size_t segment_idx) const {
+  std::string key = key_;
+  key.push_back('\0');
+  key.append(std::to_string(segment_idx));
+  return key;
+}
+
+std::shared_ptr<const void> SegmentPartials::Get(size_t segment_idx, uint64_t version) {
+  auto pinned = std::static_pointer_cast<const PinnedPartial>(cache_.Get(SegmentKey(segment_idx), version));
+  if (!pinned) {
+    return nullptr;
+  }
+  // The returned pointer holds the library as well:
+  return std::shared_ptr<const void>(pinned, pinned->partial.get());
+}
+
+void SegmentPartials::Put(size_t segment_idx, uint64_t version, std::shared_ptr<const void> partial,
+                          size_t size) {
+  auto pinned = std::make_shared<PinnedPartial>(PinnedPartial {library_, partial});
+  cache_.Put(table_, SegmentKey(segment_idx), version, pinned, sizeof(PinnedPartial) + size);
+}
+
+}}
@@ -0,0 +1,162 @@
+#ifndef VIYA_QUERY_CACHE_H_
+#define VIYA_QUERY_CACHE_H_
+
+#include <unordered_map>
+#include <list>
+#include <memory>
+#include <mutex>
+#include "query/output.h"
+
+namespace viya {
+namespace codegen { class SharedLibrary; }
+namespace query {
+
+/**
+ * Query result as it was sent to the output
+ */
+struct CachedResult {
+  std::vector<RowOutput::Row> rows;
+  std::vector<bool> as_col; // whether the row was sent using SendAsCol()
+  size_t size;              // approximate memory footprint in bytes
+};
+
+struct CacheStats {
+  size_t entries;   // entries currently in cache
+  size_t size;      // their total size in bytes
+  size_t hits;
+  size_t misses;
+  size_t evictions;
+};
+
+/**
+ * Passes rows through to the real output, and records them until they exceed the given size
+ */
+class RecordingRowOutput: public RowOutput {
+  public:
+    RecordingRowOutput(RowOutput& output, size_t max_size)
+      :output_(output),max_size_(max_size),result_(new CachedResult {{}, {}, 0}) {}
+
+    void Start() { output_.Start(); }
+    void Send(const Row& row) { output_.Send(row); Record(row, false); }
+    void SendAsCol(const Row& col) { output_.SendAsCol(col); Record(col, true); }
+    void Flush() { output_.Flush(); }
+
+    /**
+     * Returns nullptr if the result was too large to record
+     */
+    std::shared_ptr<const CachedResult> result() const { return result_; }
+
+  private:
+    void Record(const Row& row, bool as_col);
+
+  private:
+    RowOutput& output_;
+    size_t max_size_;
+    std::shared_ptr<CachedResult> result_;
+};
+
+/**
+ * Caches values by key, which must identify the query (or its part) along with its arguments.
+ * Every value is tagged with the version of the data it was computed on, and is only returned
+ * for the same version. Least recently used values are evicted once their total size exceeds
+ * the memory budget.
+ */
+class QueryCache {
+  public:
+    QueryCache(size_t max_size)
+      :max_size_(max_size),size_(0),stats_ {0, 0, 0, 0, 0} {}
+
+    QueryCache(const QueryCache& other) = delete;
+
+    bool enabled() const { return max_size_ > 0; }
+
+    /**
+     * Single value may not take more than a quarter of the budget
+     */
+    size_t max_entry_size() const { return max_size_ / 4; }
+
+    std::shared_ptr<const void> Get(const std::string& key, uint64_t version);
+    void Put(const std::string& table, const std::string& key, uint64_t version,
+             std::shared_ptr<const void> value, size_t size);
+
+    /**
+     * Removes all values of the given table
+     */
+    void Invalidate(const std::string& table);
+
+    CacheStats stats();
+
+  private:
+    struct Entry {
+      std::string table;
+      uint64_t version;
+      std::shared_ptr<const void> value;
+      size_t size;
+      std::list<std::string>::iterator lru_it;
+    };
+
+    void Remove(std::unordered_map<std::string,Entry>::iterator it);
+
+  private:
+    size_t max_size_;
+    size_t size_;
+    std::mutex mutex_;
+    std::unordered_map<std::string,Entry> entries_;
+    std::list<std::string> lru_; // most recently used values first
+    CacheStats stats_;
+};
+
+/**
+ * Caches whole query results, which are valid for as long as the table data doesn't change
+ */
+class ResultCache: public QueryCache {
+  public:
+    ResultCache(size_t max_size):QueryCache(max_size) {}
+
+    std::shared_ptr<const CachedResult> Get(const std::string& key, uint64_t version) {
+      return std::static_pointer_cast<const CachedResult>(QueryCache::Get(key, version));
+    }
+
+    void Put(const std::string& table, const std::string& key, uint64_t version,
+             std::shared_ptr<const CachedResult> result) {
+      QueryCache::Put(table, key, version, result, sizeof(CachedResult) + result->size);
+    }
+
+    /**
+     * Replays the cached result into the given output
+     */
+    static void Send(const CachedResult& result, RowOutput& output);
+};
+
+/**
+ * Partial aggregations of a query, computed on single segments. These are only cached for
+ * full segments, which don't get new tuples anymore, and are tagged with the segment version,
+ * which changes when its tuples are updated in place.
+ *
+ * Partials are instances of generated classes, so the library they came from is kept loaded
+ * for as long as they're in cache.
+ */
+class SegmentPartials {
+  public:
+    SegmentPartials(QueryCache& cache, const std::string& table, const std::string& key,
+                    std::shared_ptr<codegen::SharedLibrary> library)
+      :cache_(cache),table_(table),key_(key),library_(library) {}
+
+    SegmentPartials(const SegmentPartials& other) = delete;
+
+    std::shared_ptr<const void> Get(size_t segment_idx, uint64_t version);
+    void Put(size_t segment_idx, uint64_t version, std::shared_ptr<const void> partial, size_t size);
+
+  private:
+    std::string SegmentKey(size_t segment_idx) const;
+
+  private:
+    QueryCache& cache_;
+    std::string table_;
+    std::string key_;
+    std::shared_ptr<codegen::SharedLibrary> library_;
+};
+
+}}
+
+#endif // VIYA_QUERY_CACHE_H_
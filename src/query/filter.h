@@ -123,6 +123,26 @@ class FilterVisitor {
     virtual void Visit(const NotFilter* filter) = 0;
 };
 
+/**
+ * Collects columns, which the filter is evaluated on
+ */
+class FilterColumns: public FilterVisitor {
+  public:
+    void Visit(const RelOpFilter* filter) { columns_.push_back(filter->column()); }
+    void Visit(const InFilter* filter) { columns_.push_back(filter->column()); }
+    void Visit(const CompositeFilter* filter) {
+      for (auto f : filter->filters()) {
+        f->Accept(*this);
+      }
+    }
+    void Visit(const NotFilter* filter) { filter->filter()->Accept(*this); }
+
+    const std::vector<const db::Column*>& columns() const { return columns_; }
+
+  private:
+    std::vector<const db::Column*> columns_;
+};
+
 class FilterFactory {
   public:
     Filter* Create(const util::Config& config, const db::Table& table);
@@ -0,0 +1,674 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include "db/table.h"
+#include "db/store.h"
+#include "db/dictionary.h"
+#include "codegen/query/filter.h"
+#include "util/bitset.h"
+#include "util/format.h"
+#include "util/time.h"
+#include "query/interpreter.h"
+
+namespace viya {
+namespace query {
+
+namespace cg = viya::codegen;
+
+// Number of tuples, which filter is evaluated on at once:
+static const size_t BLOCK_SIZE = 1024;
+
+template<typename T>
+static T read_value(const char* ptr) {
+  T value;
+  std::memcpy(&value, ptr, sizeof(T));
+  return value;
+}
+
+static uint64_t read_uint(const char* ptr, size_t size) {
+  switch (size) {
+    case 1: return read_value<uint8_t>(ptr);
+    case 2: return read_value<uint16_t>(ptr);
+    case 4: return read_value<uint32_t>(ptr);
+    default: return read_value<uint64_t>(ptr);
+  }
+}
+
+static uint64_t get_uint(db::AnyNum& num, size_t size) {
+  switch (size) {
+    case 1: return num.get_uint8_t();
+    case 2: return num.get_uint16_t();
+    case 4: return num.get_uint32_t();
+    default: return num.get_uint64_t();
+  }
+}
+
+/**
+ * Consecutive tuples of a segment
+ */
+struct TupleBlock {
+  const char* dims;
+  const char* metrics;
+  size_t size;
+};
+
+/**
+ * Filter, which is evaluated on a block of tuples at once
+ */
+class Predicate {
+  public:
+    virtual ~Predicate() {}
+
+    /**
+     * Sets result[i] to 1 for every tuple that matches the filter, and to 0 otherwise
+     */
+    virtual void Eval(const TupleBlock& block, uint8_t* result) const = 0;
+};
+
+template<typename T, typename Cmp>
+class ComparePredicate: public Predicate {
+  public:
+    ComparePredicate(bool metric, size_t offset, size_t stride, T value)
+      :metric_(metric),offset_(offset),stride_(stride),value_(value) {}
+
+    void Eval(const TupleBlock& block, uint8_t* result) const {
+      const char* ptr = (metric_ ? block.metrics : block.dims) + offset_;
+      Cmp cmp;
+      for (size_t i = 0; i < block.size; ++i, ptr += stride_) {
+        result[i] = cmp(read_value<T>(ptr), value_);
+      }
+    }
+
+  private:
+    bool metric_;
+    size_t offset_;
+    size_t stride_;
+    T value_;
+};
+
+/**
+ * Range comparison on ranks of string dimension codes
+ */
+class RankPredicate: public Predicate {
+  public:
+    RankPredicate(size_t offset, size_t stride, size_t code_size,
+                  std::shared_ptr<const db::DictOrder> order, uint64_t bound, bool below)
+      :offset_(offset),stride_(stride),code_size_(code_size),order_(order),below_(below) {
+      // Missing bound code matches nothing:
+      rank_ = bound < order_->ranks.size() ? (int64_t) order_->ranks[bound] : (below ? -1 : INT64_MAX);
+    }
+
+    void Eval(const TupleBlock& block, uint8_t* result) const {
+      const char* ptr = block.dims + offset_;
+      auto& ranks = order_->ranks;
+      for (size_t i = 0; i < block.size; ++i, ptr += stride_) {
+        // Codes that appeared after ranks were calculated never match:
+        uint64_t code = read_uint(ptr, code_size_);
+        int64_t rank = code < ranks.size() ? (int64_t) ranks[code] : (below_ ? INT64_MAX : -1);
+        result[i] = below_ ? rank <= rank_ : rank >= rank_;
+      }
+    }
+
+  private:
+    size_t offset_;
+    size_t stride_;
+    size_t code_size_;
+    std::shared_ptr<const db::DictOrder> order_;
+    bool below_;
+    int64_t rank_;
+};
+
+class CompositePredicate: public Predicate {
+  public:
+    CompositePredicate(bool conjunction):conjunction_(conjunction),buf_(BLOCK_SIZE) {}
+
+    void Add(Predicate* predicate) {
+      predicates_.emplace_back(predicate);
+    }
+
+    void Eval(const TupleBlock& block, uint8_t* result) const {
+      predicates_[0]->Eval(block, result);
+      for (size_t p = 1; p < predicates_.size(); ++p) {
+        predicates_[p]->Eval(block, buf_.data());
+        if (conjunction_) {
+          for (size_t i = 0; i < block.size; ++i) result[i] &= buf_[i];
+        } else {
+          for (size_t i = 0; i < block.size; ++i) result[i] |= buf_[i];
+        }
+      }
+    }
+
+  private:
+    bool conjunction_;
+    std::vector<std::unique_ptr<Predicate>> predicates_;
+    mutable std::vector<uint8_t> buf_;
+};
+
+class NotPredicate: public Predicate {
+  public:
+    NotPredicate(Predicate* predicate):predicate_(predicate) {}
+
+    void Eval(const TupleBlock& block, uint8_t* result) const {
+      predicate_->Eval(block, result);
+      for (size_t i = 0; i < block.size; ++i) {
+        result[i] = !result[i];
+      }
+    }
+
+  private:
+    std::unique_ptr<Predicate> predicate_;
+};
+
+template<typename T>
+static Predicate* make_compare(RelOpFilter::Operator op, bool metric, size_t offset, size_t stride, T value) {
+  switch (op) {
+    case RelOpFilter::Operator::EQUAL:
+      return new ComparePredicate<T, std::equal_to<T>>(metric, offset, stride, value);
+    case RelOpFilter::Operator::NOT_EQUAL:
+      return new ComparePredicate<T, std::not_equal_to<T>>(metric, offset, stride, value);
+    case RelOpFilter::Operator::LESS:
+      return new ComparePredicate<T, std::less<T>>(metric, offset, stride, value);
+    case RelOpFilter::Operator::LESS_EQUAL:
+      return new ComparePredicate<T, std::less_equal<T>>(metric, offset, stride, value);
+    case RelOpFilter::Operator::GREATER:
+      return new ComparePredicate<T, std::greater<T>>(metric, offset, stride, value);
+    case RelOpFilter::Operator::GREATER_EQUAL:
+      return new ComparePredicate<T, std::greater_equal<T>>(metric, offset, stride, value);
+  }
+  throw std::runtime_error("Unsupported operator");
+}
+
+/**
+ * Builds predicates from a filter, consuming filter arguments in the same order
+ * as they were packed by FilterArgsPacker
+ */
+class PredicateBuilder: public FilterVisitor {
+  public:
+    PredicateBuilder(const db::SegmentLayout& layout, std::vector<db::AnyNum>& args)
+      :layout_(layout),args_(args),argidx_(0) {}
+
+    void Visit(const RelOpFilter* filter) {
+      auto column = filter->column();
+      if (column->type() == db::Column::Type::DIMENSION
+          && static_cast<const db::Dimension*>(column)->dim_type() == db::Dimension::DimType::STRING
+          && filter->op() != RelOpFilter::Operator::EQUAL
+          && filter->op() != RelOpFilter::Operator::NOT_EQUAL) {
+        auto dim = static_cast<const db::StrDimension*>(column);
+        bool below = filter->op() == RelOpFilter::Operator::LESS
+          || filter->op() == RelOpFilter::Operator::LESS_EQUAL;
+        uint64_t bound = get_uint(args_[argidx_++], dim->num_type().size());
+        predicate_ = new RankPredicate(layout_.dim_offsets[dim->index()], layout_.dims_size,
+                                       dim->num_type().size(), dim->dict()->Order(), bound, below);
+        return;
+      }
+      predicate_ = Compare(column, filter->op());
+    }
+
+    void Visit(const InFilter* filter) {
+      auto composite = new CompositePredicate(false);
+      for (size_t i = 0; i < filter->values().size(); ++i) {
+        composite->Add(Compare(filter->column(), RelOpFilter::Operator::EQUAL));
+      }
+      predicate_ = composite;
+    }
+
+    void Visit(const CompositeFilter* filter) {
+      auto composite = new CompositePredicate(filter->op() == CompositeFilter::Operator::AND);
+      for (auto f : filter->filters()) {
+        f->Accept(*this);
+        composite->Add(predicate_);
+      }
+      predicate_ = composite;
+    }
+
+    void Visit(const NotFilter* filter) {
+      filter->filter()->Accept(*this);
+      predicate_ = new NotPredicate(predicate_);
+    }
+
+    Predicate* predicate() const { return predicate_; }
+
+  private:
+    Predicate* Compare(const db::Column* column, RelOpFilter::Operator op) {
+      auto& arg = args_[argidx_++];
+      if (column->type() == db::Column::Type::DIMENSION) {
+        size_t offset = layout_.dim_offsets[column->index()];
+        size_t stride = layout_.dims_size;
+        switch (column->num_type().size()) {
+          case 1: return make_compare(op, false, offset, stride, arg.get_uint8_t());
+          case 2: return make_compare(op, false, offset, stride, arg.get_uint16_t());
+          case 4: return make_compare(op, false, offset, stride, arg.get_uint32_t());
+          default: return make_compare(op, false, offset, stride, arg.get_uint64_t());
+        }
+      }
+
+      if (static_cast<const db::Metric*>(column)->agg_type() == db::Metric::AggregationType::BITSET) {
+        throw std::invalid_argument("Unsupported filter on bitset metric: " + column->name());
+      }
+      size_t offset = layout_.metric_offsets[column->index()];
+      size_t stride = layout_.metrics_size;
+      switch (static_cast<const db::MetricType&>(column->num_type()).type()) {
+        case db::MetricType::Type::INT: return make_compare(op, true, offset, stride, arg.get_int32_t());
+        case db::MetricType::Type::UINT: return make_compare(op, true, offset, stride, arg.get_uint32_t());
+        case db::MetricType::Type::LONG: return make_compare(op, true, offset, stride, arg.get_int64_t());
+        case db::MetricType::Type::ULONG: return make_compare(op, true, offset, stride, arg.get_uint64_t());
+        case db::MetricType::Type::DOUBLE: return make_compare(op, true, offset, stride, arg.get_double());
+      }
+      throw std::runtime_error("Unsupported type");
+    }
+
+  private:
+    const db::SegmentLayout& layout_;
+    std::vector<db::AnyNum>& args_;
+    size_t argidx_;
+    Predicate* predicate_;
+};
+
+static std::unique_ptr<Predicate> build_predicate(FilterBasedQuery* query) {
+  cg::FilterArgsPacker args_packer;
+  query->filter()->Accept(args_packer);
+  auto args = args_packer.args();
+
+  PredicateBuilder builder(query->table().store()->layout(), args);
+  query->filter()->Accept(builder);
+  return std::unique_ptr<Predicate>(builder.predicate());
+}
+
+/**
+ * Calls the function on every tuple matching the predicate, until the function returns false
+ */
+template<typename Func>
+static void scan(db::Table& table, const Predicate& predicate, QueryStats& stats, Func func) {
+  auto& layout = table.store()->layout();
+  std::vector<uint8_t> selected(BLOCK_SIZE);
+
+  for (auto* segment : table.store()->segments_copy()) {
+    auto segment_size = segment->size();
+    stats.scanned_recs += segment_size;
+    stats.scanned_segments++;
+
+    for (size_t block_start = 0; block_start < segment_size; block_start += BLOCK_SIZE) {
+      TupleBlock block {
+        segment->dims_data() + block_start * layout.dims_size,
+        segment->metrics_data() + block_start * layout.metrics_size,
+        std::min(segment_size - block_start, BLOCK_SIZE)
+      };
+      predicate.Eval(block, selected.data());
+
+      for (size_t i = 0; i < block.size; ++i) {
+        if (selected[i]
+            && !func(block.dims + i * layout.dims_size, block.metrics + i * layout.metrics_size)) {
+          return;
+        }
+      }
+    }
+  }
+}
+
+template<typename Time>
+static void truncate(Time& time, util::TimeUnit unit) {
+  switch (unit) {
+    case util::TimeUnit::YEAR: time.template trunc<util::TimeUnit::YEAR>(); break;
+    case util::TimeUnit::MONTH: time.template trunc<util::TimeUnit::MONTH>(); break;
+    case util::TimeUnit::DAY: time.template trunc<util::TimeUnit::DAY>(); break;
+    case util::TimeUnit::HOUR: time.template trunc<util::TimeUnit::HOUR>(); break;
+    case util::TimeUnit::MINUTE: time.template trunc<util::TimeUnit::MINUTE>(); break;
+    case util::TimeUnit::SECOND: time.template trunc<util::TimeUnit::SECOND>(); break;
+    default: throw std::invalid_argument("Unsupported time granularity");
+  }
+}
+
+/**
+ * Extracts a value of a dimension from a tuple, as it appears in aggregation key
+ */
+class DimKey {
+  public:
+    DimKey(const DimOutputColumn& dim_col, const db::SegmentLayout& layout)
+      :offset_(layout.dim_offsets[dim_col.dim()->index()]),size_(dim_col.dim()->num_type().size()),
+      granularity_(dim_col.granularity().time_unit()),rollup_(false) {
+
+      if (dim_col.dim()->dim_type() == db::Dimension::DimType::TIME) {
+        auto time_dim = static_cast<const db::TimeDimension*>(dim_col.dim());
+        rollup_ = !time_dim->rollup_rules().empty() || !dim_col.granularity().empty();
+
+        // Timestamps older than rollup rule bound are truncated to rule granularity:
+        char* test_ts = getenv("VIYA_TEST_ROLLUP_TS");
+        uint32_t now = test_ts != nullptr ? std::stoul(test_ts) : std::time(nullptr);
+        for (auto& rule : time_dim->rollup_rules()) {
+          uint64_t bound = rule.after().add_to(now, -1);
+          if (time_dim->micro_precision()) {
+            bound *= 1000000L;
+          }
+          rules_.push_back(std::make_pair(bound, rule.granularity().time_unit()));
+        }
+      }
+    }
+
+    uint64_t Extract(const char* dims) const {
+      uint64_t value = read_uint(dims + offset_, size_);
+      if (!rollup_) {
+        return value;
+      }
+      return size_ == 8 ? Rollup<util::Time64>(value) : Rollup<util::Time32>(value);
+    }
+
+  private:
+    template<typename Time>
+    uint64_t Rollup(uint64_t value) const {
+      Time time;
+      time.set_ts(value);
+      for (auto& rule : rules_) {
+        if (value < rule.first) {
+          truncate(time, rule.second);
+          break;
+        }
+      }
+      if (granularity_ != util::TimeUnit::_UNDEFINED) {
+        truncate(time, granularity_);
+      }
+      return time.get_ts();
+    }
+
+  private:
+    size_t offset_;
+    size_t size_;
+    util::TimeUnit granularity_;
+    bool rollup_;
+    std::vector<std::pair<uint64_t, util::TimeUnit>> rules_;
+};
+
+/**
+ * Aggregated values of a metric, one per group
+ */
+class MetricValues {
+  public:
+    virtual ~MetricValues() {}
+
+    virtual void AddGroup() = 0;
+    virtual void Update(size_t group, const char* metrics) = 0;
+    virtual bool Less(size_t a, size_t b) = 0;
+    virtual std::string Format(size_t group, util::Format& fmt) = 0;
+};
+
+struct SumOp {
+  template<typename T>
+  T operator()(T a, T b) const { return a + b; }
+};
+
+struct MaxOp {
+  template<typename T>
+  T operator()(T a, T b) const { return std::max(a, b); }
+};
+
+struct MinOp {
+  template<typename T>
+  T operator()(T a, T b) const { return std::min(a, b); }
+};
+
+template<typename T, typename Op>
+class ValueMetricValues: public MetricValues {
+  public:
+    ValueMetricValues(size_t offset, T init):offset_(offset),init_(init) {}
+
+    void AddGroup() { values_.push_back(init_); }
+
+    void Update(size_t group, const char* metrics) {
+      values_[group] = Op()(values_[group], read_value<T>(metrics + offset_));
+    }
+
+    bool Less(size_t a, size_t b) { return values_[a] < values_[b]; }
+
+    std::string Format(size_t group, util::Format& fmt) { return fmt.num(values_[group]); }
+
+  private:
+    size_t offset_;
+    T init_;
+    std::vector<T> values_;
+};
+
+template<int SizeBytes>
+class BitsetMetricValues: public MetricValues {
+  public:
+    BitsetMetricValues(size_t offset):offset_(offset) {}
+
+    void AddGroup() { values_.emplace_back(); }
+
+    void Update(size_t group, const char* metrics) {
+      values_[group] |= *reinterpret_cast<const Bitset<SizeBytes>*>(metrics + offset_);
+    }
+
+    bool Less(size_t a, size_t b) { return values_[a].cardinality() < values_[b].cardinality(); }
+
+    std::string Format(size_t group, util::Format& fmt) { return fmt.num(values_[group].cardinality()); }
+
+  private:
+    size_t offset_;
+    std::vector<Bitset<SizeBytes>> values_;
+};
+
+template<typename T>
+static MetricValues* make_metric_values(db::Metric::AggregationType agg_type, size_t offset) {
+  switch (agg_type) {
+    case db::Metric::AggregationType::MAX:
+      return new ValueMetricValues<T, MaxOp>(offset, std::numeric_limits<T>::lowest());
+    case db::Metric::AggregationType::MIN:
+      return new ValueMetricValues<T, MinOp>(offset, std::numeric_limits<T>::max());
+    default:
+      return new ValueMetricValues<T, SumOp>(offset, 0);
+  }
+}
+
+static MetricValues* make_metric_values(const db::Metric* metric, const db::SegmentLayout& layout) {
+  size_t offset = layout.metric_offsets[metric->index()];
+  auto agg_type = metric->agg_type();
+  if (agg_type == db::Metric::AggregationType::BITSET) {
+    if (metric->num_type().size() == 8) {
+      return new BitsetMetricValues<8>(offset);
+    }
+    return new BitsetMetricValues<4>(offset);
+  }
+  switch (static_cast<const db::MetricType&>(metric->num_type()).type()) {
+    case db::MetricType::Type::INT: return make_metric_values<int32_t>(agg_type, offset);
+    case db::MetricType::Type::UINT: return make_metric_values<uint32_t>(agg_type, offset);
+    case db::MetricType::Type::LONG: return make_metric_values<int64_t>(agg_type, offset);
+    case db::MetricType::Type::ULONG: return make_metric_values<uint64_t>(agg_type, offset);
+    case db::MetricType::Type::DOUBLE: return make_metric_values<double>(agg_type, offset);
+  }
+  throw std::runtime_error("Unsupported type");
+}
+
+void QueryInterpreter::Visit(AggregateQuery* query) {
+  auto& table = query->table();
+  auto& layout = table.store()->layout();
+  auto predicate = build_predicate(query);
+
+  std::vector<DimKey> dim_keys;
+  for (auto& dim_col : query->dimension_cols()) {
+    dim_keys.emplace_back(dim_col, layout);
+  }
+  std::vector<std::unique_ptr<MetricValues>> metric_values;
+  for (auto& metric_col : query->metric_cols()) {
+    metric_values.emplace_back(make_metric_values(metric_col.metric(), layout));
+  }
+
+  // Groups are numbered in order of appearance, and their keys are stored one after another:
+  size_t dims_num = dim_keys.size();
+  std::string key(dims_num * sizeof(uint64_t), '\0');
+  std::unordered_map<std::string, size_t> groups;
+  std::vector<uint64_t> group_keys;
+
+  scan(table, *predicate, stats_, [&](const char* dims, const char* metrics) {
+    for (size_t d = 0; d < dims_num; ++d) {
+      uint64_t value = dim_keys[d].Extract(dims);
+      std::memcpy(&key[d * sizeof(uint64_t)], &value, sizeof(uint64_t));
+    }
+    auto it = groups.find(key);
+    if (it == groups.end()) {
+      it = groups.insert(std::make_pair(key, groups.size())).first;
+      group_keys.resize(group_keys.size() + dims_num);
+      std::memcpy(&group_keys[group_keys.size() - dims_num], key.data(), key.size());
+      for (auto& values : metric_values) {
+        values->AddGroup();
+      }
+    }
+    for (auto& values : metric_values) {
+      values->Update(it->second, metrics);
+    }
+    return true;
+  });
+
+  size_t groups_num = groups.size();
+  stats_.aggregated_recs = groups_num;
+
+  size_t skip = std::min(groups_num, query->skip());
+  size_t limit = std::min(query->limit(), groups_num - skip);
+  size_t end = limit > 0 ? skip + limit : groups_num;
+
+  std::vector<size_t> sorted(groups_num);
+  for (size_t g = 0; g < groups_num; ++g) {
+    sorted[g] = g;
+  }
+
+  auto& sort_cols = query->sort_cols();
+  if (!sort_cols.empty()) {
+    // Sort columns refer to selected dimensions and metrics by column index:
+    std::vector<std::function<bool(size_t, size_t)>> less;
+    std::vector<std::shared_ptr<const db::DictOrder>> orders;
+    for (auto& sort_col : sort_cols) {
+      auto col = sort_col.col();
+      std::function<bool(size_t, size_t)> col_less;
+      if (col->type() == db::Column::Type::DIMENSION) {
+        size_t d = 0;
+        while (query->dimension_cols()[d].dim() != col) ++d;
+        if (static_cast<const db::Dimension*>(col)->dim_type() == db::Dimension::DimType::STRING) {
+          orders.push_back(static_cast<const db::StrDimension*>(col)->dict()->Order());
+          auto& ranks = orders.back()->ranks;
+          auto rank = [&ranks](uint64_t code) { return code < ranks.size() ? ranks[code] : code; };
+          col_less = [&group_keys, dims_num, d, rank](size_t a, size_t b) {
+            return rank(group_keys[a * dims_num + d]) < rank(group_keys[b * dims_num + d]);
+          };
+        } else {
+          col_less = [&group_keys, dims_num, d](size_t a, size_t b) {
+            return group_keys[a * dims_num + d] < group_keys[b * dims_num + d];
+          };
+        }
+      } else {
+        size_t m = 0;
+        while (query->metric_cols()[m].metric() != col) ++m;
+        auto values = metric_values[m].get();
+        col_less = [values](size_t a, size_t b) { return values->Less(a, b); };
+      }
+      if (sort_col.ascending()) {
+        less.push_back(col_less);
+      } else {
+        less.push_back([col_less](size_t a, size_t b) { return col_less(b, a); });
+      }
+    }
+
+    auto sort_cmp = [&less](size_t a, size_t b) {
+      for (auto& col_less : less) {
+        if (col_less(a, b)) return true;
+        if (col_less(b, a)) return false;
+      }
+      return false;
+    };
+    if (end < groups_num) {
+      std::partial_sort(sorted.begin(), sorted.begin() + end, sorted.end(), sort_cmp);
+    } else {
+      std::sort(sorted.begin(), sorted.end(), sort_cmp);
+    }
+  }
+
+  RowOutput::Row row(query->dimension_cols().size() + query->metric_cols().size());
+  util::Format fmt;
+
+  output_.Start();
+
+  if (query->header()) {
+    for (auto& dim_col : query->dimension_cols()) {
+      row[dim_col.index()] = dim_col.dim()->name();
+    }
+    for (auto& metric_col : query->metric_cols()) {
+      row[metric_col.index()] = metric_col.metric()->name();
+    }
+    output_.Send(row);
+  }
+
+  for (size_t sorted_idx = skip; sorted_idx < end; ++sorted_idx) {
+    size_t group = sorted[sorted_idx];
+    for (size_t d = 0; d < dims_num; ++d) {
+      auto& dim_col = query->dimension_cols()[d];
+      auto dim = dim_col.dim();
+      uint64_t value = group_keys[group * dims_num + d];
+      auto& cell = row[dim_col.index()];
+
+      if (dim->dim_type() == db::Dimension::DimType::STRING) {
+        auto dict = static_cast<const db::StrDimension*>(dim)->dict();
+        dict->lock().lock_shared();
+        cell = dict->c2v()[value];
+        dict->lock().unlock_shared();
+      } else if (dim->dim_type() == db::Dimension::DimType::TIME && !dim_col.format().empty()) {
+        cell = fmt.date(dim_col.format().c_str(), (uint32_t) value);
+      } else if (dim->dim_type() == db::Dimension::DimType::BOOLEAN) {
+        cell = value ? "true" : "false";
+      } else {
+        cell = fmt.num(value);
+      }
+    }
+    for (size_t m = 0; m < metric_values.size(); ++m) {
+      row[query->metric_cols()[m].index()] = metric_values[m]->Format(group, fmt);
+    }
+    output_.Send(row);
+    ++stats_.output_recs;
+  }
+  output_.Flush();
+}
+
+void QueryInterpreter::Visit(SearchQuery* query) {
+  auto& table = query->table();
+  auto dim = query->dimension();
+  size_t offset = table.store()->layout().dim_offsets[dim->index()];
+  size_t size = dim->num_type().size();
+  auto dict = dim->dim_type() == db::Dimension::DimType::STRING ?
+    static_cast<const db::StrDimension*>(dim)->dict() : nullptr;
+  auto predicate = build_predicate(query);
+
+  std::unordered_set<uint64_t> codes;
+  std::vector<std::string> values;
+  std::string check_value;
+  util::Format fmt;
+
+  scan(table, *predicate, stats_, [&](const char* dims, const char* metrics __attribute__((unused))) {
+    uint64_t code = read_uint(dims + offset, size);
+    if (codes.insert(code).second) {
+      if (dict != nullptr) {
+        dict->lock().lock_shared();
+        check_value = dict->c2v()[code];
+        dict->lock().unlock_shared();
+      } else {
+        check_value = fmt.num(code);
+      }
+      if (check_value.find(query->term()) != std::string::npos) {
+        values.push_back(check_value);
+        if (values.size() >= query->limit()) {
+          return false;
+        }
+      }
+    }
+    return true;
+  });
+  stats_.aggregated_recs = codes.size();
+
+  output_.Start();
+  output_.SendAsCol(values);
+  stats_.output_recs = values.size();
+  output_.Flush();
+}
+
+}}
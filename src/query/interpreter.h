@@ -0,0 +1,33 @@
+#ifndef VIYA_QUERY_INTERPRETER_H_
+#define VIYA_QUERY_INTERPRETER_H_
+
+#include "query/query.h"
+#include "query/output.h"
+#include "query/stats.h"
+
+namespace viya {
+namespace query {
+
+/**
+ * Executes queries on segments directly, using their layout description instead of
+ * generated code. This is much slower than running a compiled query, but doesn't need
+ * to wait for the compilation, so it's used for queries which were not compiled yet.
+ */
+class QueryInterpreter: public QueryVisitor {
+  public:
+    QueryInterpreter(RowOutput& output, QueryStats& stats)
+      :output_(output),stats_(stats) {}
+
+    QueryInterpreter(const QueryInterpreter& other) = delete;
+
+    void Visit(AggregateQuery* query);
+    void Visit(SearchQuery* query);
+
+  private:
+    RowOutput& output_;
+    QueryStats& stats_;
+};
+
+}}
+
+#endif // VIYA_QUERY_INTERPRETER_H_
@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <memory>
 #include "db/table.h"
 #include "db/database.h"
 #include "query/filter.h"
@@ -30,7 +32,13 @@ AggregateQuery::AggregateQuery(const util::Config& config, db::Table& table)
   :FilterBasedQuery(config.sub("filter"), table),
   skip_(config.num("skip", 0)),
   limit_(config.num("limit", 0)),
-  header_(config.boolean("header", false)) {
+  header_(config.boolean("header", false)),
+  threads_(config.num("threads", 0)),
+  sample_(config.real("sample", 1.0)) {
+
+  if (!(sample_ > 0.0 && sample_ <= 1.0)) {
+    throw std::invalid_argument("Sample must be in (0, 1] range");
+  }
 
   size_t output_idx = 0;
   if (config.exists("select")) {
@@ -51,6 +59,17 @@ AggregateQuery::AggregateQuery(const util::Config& config, db::Table& table)
     }
   }
 
+  // Keep columns in table order, so queries selecting the same columns in different order
+  // share generated code. Position of a column in the result row is given by its index:
+  std::stable_sort(dimension_cols_.begin(), dimension_cols_.end(),
+                   [](const DimOutputColumn& a, const DimOutputColumn& b) {
+                     return a.dim()->index() < b.dim()->index();
+                   });
+  std::stable_sort(metric_cols_.begin(), metric_cols_.end(),
+                   [](const MetricOutputColumn& a, const MetricOutputColumn& b) {
+                     return a.metric()->index() < b.metric()->index();
+                   });
+
   if (config.exists("sort")) {
     for (auto& sort_conf : config.sublist("sort")) {
       auto sort_column = sort_conf.str("column");
@@ -81,6 +100,17 @@ AggregateQuery::AggregateQuery(const util::Config& config, db::Table& table)
   }
 }
 
+bool AggregateQuery::time_dependent() const {
+  for (auto& dim_col : dimension_cols_) {
+    auto dim = dim_col.dim();
+    if (dim->dim_type() == db::Dimension::DimType::TIME
+        && !static_cast<const db::TimeDimension*>(dim)->rollup_rules().empty()) {
+      return true;
+    }
+  }
+  return false;
+}
+
 void AggregateQuery::Accept(QueryVisitor& visitor) {
   visitor.Visit(this);
 }
@@ -96,14 +126,128 @@ void SearchQuery::Accept(QueryVisitor& visitor) {
   visitor.Visit(this);
 }
 
+/**
+ * Returns the dimension of the view, which has the same values as the given one of the table,
+ * or nullptr if there's no such dimension. Time dimension may be truncated in the view to
+ * a coarser granularity, in which case it's returned along with that granularity.
+ */
+static const db::Dimension* view_dimension(const db::Table& view, const db::Dimension* dim,
+                                           db::Granularity& truncated) {
+  const db::Dimension* view_dim = nullptr;
+  for (auto d : view.dimensions()) {
+    if (d->name() == dim->name()) {
+      view_dim = d;
+    }
+  }
+  truncated = db::Granularity();
+  if (view_dim != nullptr && dim->dim_type() == db::Dimension::DimType::TIME) {
+    auto& view_granularity = static_cast<const db::TimeDimension*>(view_dim)->granularity();
+    auto& granularity = static_cast<const db::TimeDimension*>(dim)->granularity();
+    if (!view_granularity.empty()
+        && (granularity.empty() || granularity.time_unit() != view_granularity.time_unit())) {
+      truncated = view_granularity;
+    }
+  }
+  return view_dim;
+}
+
+/**
+ * Whether values truncated to the given time unit can be truncated further to the requested one.
+ * Weeks don't divide months or years, so nothing coarser can be derived from them.
+ */
+static bool derivable(util::TimeUnit truncated, util::TimeUnit requested) {
+  return truncated == requested || (truncated > requested && truncated != util::TimeUnit::WEEK);
+}
+
+/**
+ * Whether the view contains filter columns with their original values. Tuples of a view
+ * aggregate many tuples of the table, so filtering them by a metric gives different results.
+ */
+static bool covers_filter(const db::Table& view, const Filter* filter) {
+  FilterColumns filter_columns;
+  filter->Accept(filter_columns);
+  for (auto col : filter_columns.columns()) {
+    if (col->type() == db::Column::Type::METRIC) {
+      return false;
+    }
+    db::Granularity truncated;
+    auto dim = static_cast<const db::Dimension*>(col);
+    if (view_dimension(view, dim, truncated) == nullptr || !truncated.empty()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool covers(const db::Table& view, const AggregateQuery& query) {
+  for (auto& dim_col : query.dimension_cols()) {
+    db::Granularity truncated;
+    if (view_dimension(view, dim_col.dim(), truncated) == nullptr) {
+      return false;
+    }
+    if (!truncated.empty()) {
+      if (dim_col.granularity().empty()
+          || !derivable(truncated.time_unit(), dim_col.granularity().time_unit())) {
+        return false;
+      }
+      // Truncated dimension isn't rolled up in the view, so the view only gives the same
+      // result when no rollup rule of the table changes values at the requested granularity:
+      auto& rules = static_cast<const db::TimeDimension*>(dim_col.dim())->rollup_rules();
+      if (std::any_of(rules.begin(), rules.end(), [&dim_col](const db::RollupRule& rule) {
+                        return !derivable(rule.granularity().time_unit(), dim_col.granularity().time_unit()); })) {
+        return false;
+      }
+    }
+  }
+  for (auto& metric_col : query.metric_cols()) {
+    auto& metrics = view.metrics();
+    if (std::none_of(metrics.begin(), metrics.end(), [&metric_col](const db::Metric* m) {
+                       return m->name() == metric_col.metric()->name(); })) {
+      return false;
+    }
+  }
+  return covers_filter(view, query.filter());
+}
+
+static bool covers(const db::Table& view, const SearchQuery& query) {
+  db::Granularity truncated;
+  if (view_dimension(view, query.dimension(), truncated) == nullptr || !truncated.empty()) {
+    return false;
+  }
+  return covers_filter(view, query.filter());
+}
+
+/**
+ * Returns the smallest view of the table, which can answer the query, or nullptr if there's none
+ */
+template<typename Q>
+static db::Table* smallest_view(db::Table& table, const Q& query) {
+  db::Table* smallest = nullptr;
+  size_t smallest_size = 0;
+  for (auto view : table.views()) {
+    if (covers(*view, query)) {
+      size_t size = view->size();
+      if (smallest == nullptr || size < smallest_size) {
+        smallest = view;
+        smallest_size = size;
+      }
+    }
+  }
+  return smallest;
+}
+
 Query* QueryFactory::Create(const util::Config& config, db::Database& database) {
   std::string type = config.str("type");
   auto table = database.GetTable(config.str("table"));
   if (type == "aggregate") {
-    return new AggregateQuery(config, *table);
+    std::unique_ptr<AggregateQuery> query(new AggregateQuery(config, *table));
+    auto view = smallest_view(*table, *query);
+    return view != nullptr ? new AggregateQuery(config, *view) : query.release();
   }
   if (type == "search") {
-    return new SearchQuery(config, *table);
+    std::unique_ptr<SearchQuery> query(new SearchQuery(config, *table));
+    auto view = smallest_view(*table, *query);
+    return view != nullptr ? new SearchQuery(config, *view) : query.release();
   }
   throw std::invalid_argument("Unsupported query type: " + type);
 }
@@ -108,12 +108,27 @@ class AggregateQuery: public FilterBasedQuery {
   public:
     AggregateQuery(const util::Config& config, db::Table& table);
 
+    // Selected columns are ordered as in table, index() gives their position in output:
     const std::vector<DimOutputColumn>& dimension_cols() const { return dimension_cols_; }
     const std::vector<MetricOutputColumn>& metric_cols() const { return metric_cols_; }
     const std::vector<SortColumn>& sort_cols() const { return sort_cols_; }
     size_t skip() const { return skip_; }
     size_t limit() const { return limit_; }
     bool header() const { return header_; }
+    size_t threads() const { return threads_; }
+
+    /**
+     * Probability of every tuple to be scanned. Sums and counts of sampled queries are scaled
+     * accordingly, and their standard errors are added to the result.
+     */
+    double sample() const { return sample_; }
+    bool sampled() const { return sample_ < 1.0; }
+
+    /**
+     * Whether results depend on the current time, because time dimensions having rollup rules
+     * are rolled up relatively to it
+     */
+    bool time_dependent() const;
 
     void Accept(class QueryVisitor& visitor);
  
@@ -124,6 +139,8 @@ class AggregateQuery: public FilterBasedQuery {
     size_t skip_;
     size_t limit_;
     bool header_;
+    size_t threads_; // requested scan parallelism (0 means database default)
+    double sample_;
 };
 
 class SearchQuery: public FilterBasedQuery {
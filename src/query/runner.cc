@@ -1,5 +1,9 @@
+#include <algorithm>
+#include <sstream>
+#include <cityhash/src/city.h>
 #include "db/table.h"
 #include "query/runner.h"
+#include "query/interpreter.h"
 #include "codegen/query/filter.h"
 #include "codegen/query/query.h"
 
@@ -8,32 +12,164 @@ namespace query {
 
 namespace cg = viya::codegen;
 
+/**
+ * Identifies query result by table, generated code (query shape), filter arguments and
+ * the rest of runtime parameters
+ */
+static std::string CacheKey(db::Table& table, cg::QueryGenerator& generator,
+                            const std::vector<db::AnyNum>& args, const std::string& params) {
+  auto& code = generator.code();
+  uint64_t code_hash = CityHash64(code.c_str(), code.size());
+
+  std::string key = table.name();
+  key.push_back('\0');
+  key.append(reinterpret_cast<const char*>(&code_hash), sizeof(code_hash));
+  for (auto& arg : args) {
+    key.append(arg.data(), db::AnyNum::size());
+  }
+  key.push_back('\0');
+  key.append(params);
+  return key;
+}
+
 void QueryRunner::Visit(AggregateQuery* query) {
   stats_.OnBegin("aggregate", query->table().name());
 
-  auto query_fn = cg::QueryGenerator(database_.compiler(), *query).AggQueryFunction();
+  cg::QueryGenerator generator(database_.compiler(), *query);
 
   cg::FilterArgsPacker args_packer;
   query->filter()->Accept(args_packer);
 
-  stats_.OnCompile();
+  // Output columns and sorting are passed at runtime, so they don't affect generated code:
+  std::vector<size_t> columns;
+  for (auto& dim_col : query->dimension_cols()) {
+    columns.push_back(dim_col.index());
+  }
+  for (auto& metric_col : query->metric_cols()) {
+    columns.push_back(metric_col.index());
+  }
+  std::vector<std::pair<size_t, bool>> sort;
+  for (auto& sort_col : query->sort_cols()) {
+    size_t col_num = std::find(columns.begin(), columns.end(), sort_col.index()) - columns.begin();
+    sort.push_back(std::make_pair(col_num, sort_col.ascending()));
+  }
+
+  std::string cache_key;
+  uint64_t version = query->table().version();
+  if (database_.result_cache().enabled() && !query->time_dependent()) {
+    std::ostringstream params;
+    params<<query->skip()<<" "<<query->limit()<<" "<<query->header()<<" "<<query->sample();
+    for (auto col : columns) {
+      params<<" "<<col;
+    }
+    for (auto& sort_col : sort) {
+      params<<" "<<sort_col.first<<(sort_col.second ? "+" : "-");
+    }
+    cache_key = CacheKey(query->table(), generator, args_packer.args(), params.str());
+    if (SendCached(cache_key, version)) {
+      return;
+    }
+  }
+  RecordingRowOutput recording_output(output_, database_.result_cache().max_entry_size());
+  RowOutput& output = cache_key.empty() ? output_ : recording_output;
+
+  // Interpreter doesn't sample, so approximate queries always wait for compilation:
+  auto query_fn = database_.interpret_cold_queries() && !query->sampled() ?
+    generator.AggQueryFunctionAsync() : generator.AggQueryFunction();
+
+  if (query_fn == nullptr) {
+    // Answer using the interpreter, while the query is compiled in background:
+    stats_.OnCompile();
+    stats_.interpreted = true;
+    QueryInterpreter(output, stats_).Visit(query);
+  } else {
+    stats_.OnCompile();
+
+    // Queries rolling up time dimensions can't reuse partials, as they depend on the current time,
+    // and sampled queries don't use them at all:
+    std::unique_ptr<SegmentPartials> partials;
+    if (database_.partial_cache().enabled() && !query->time_dependent() && !query->sampled()) {
+      partials.reset(new SegmentPartials(database_.partial_cache(), query->table().name(),
+                                         CacheKey(query->table(), generator, args_packer.args(), ""),
+                                         generator.library()));
+    }
+
+    size_t threads = database_.AcquireScanThreads(
+      query->threads() > 0 ? query->threads() : database_.query_parallelism());
+    try {
+      query_fn(query->table(), output, stats_, args_packer.args(), query->skip(), query->limit(), threads,
+               query->header(), columns, sort, partials.get(), query->sample());
+    } catch (...) {
+      database_.ReleaseScanThreads(threads);
+      throw;
+    }
+    database_.ReleaseScanThreads(threads);
+  }
 
-  query_fn(query->table(), output_, stats_, args_packer.args(), query->skip(), query->limit());
+  if (!cache_key.empty()) {
+    CacheResult(query->table(), cache_key, version, recording_output);
+  }
   stats_.OnEnd();
 }
 
 void QueryRunner::Visit(SearchQuery* query) {
   stats_.OnBegin("search", query->table().name());
 
-  auto query_fn = cg::QueryGenerator(database_.compiler(), *query).SearchQueryFunction();
+  cg::QueryGenerator generator(database_.compiler(), *query);
 
   cg::FilterArgsPacker args_packer;
   query->filter()->Accept(args_packer);
 
-  stats_.OnCompile();
+  std::string cache_key;
+  uint64_t version = query->table().version();
+  if (database_.result_cache().enabled()) {
+    std::string params = std::to_string(query->limit()) + " " + query->term();
+    cache_key = CacheKey(query->table(), generator, args_packer.args(), params);
+    if (SendCached(cache_key, version)) {
+      return;
+    }
+  }
+  RecordingRowOutput recording_output(output_, database_.result_cache().max_entry_size());
+  RowOutput& output = cache_key.empty() ? output_ : recording_output;
+
+  auto query_fn = database_.interpret_cold_queries() ?
+    generator.SearchQueryFunctionAsync() : generator.SearchQueryFunction();
+
+  if (query_fn == nullptr) {
+    stats_.OnCompile();
+    stats_.interpreted = true;
+    QueryInterpreter(output, stats_).Visit(query);
+  } else {
+    stats_.OnCompile();
+    query_fn(query->table(), output, stats_, args_packer.args(), query->term(), query->limit());
+  }
 
-  query_fn(query->table(), output_, stats_, args_packer.args(), query->term(), query->limit());
+  if (!cache_key.empty()) {
+    CacheResult(query->table(), cache_key, version, recording_output);
+  }
   stats_.OnEnd();
 }
 
+bool QueryRunner::SendCached(const std::string& cache_key, uint64_t version) {
+  auto result = database_.result_cache().Get(cache_key, version);
+  if (!result) {
+    return false;
+  }
+  stats_.OnCompile();
+  stats_.cached = true;
+  stats_.output_recs = result->rows.size();
+  ResultCache::Send(*result, output_);
+  stats_.OnEnd();
+  return true;
+}
+
+void QueryRunner::CacheResult(db::Table& table, const std::string& cache_key, uint64_t version,
+                              const RecordingRowOutput& recording_output) {
+  // Result is only valid if no load was in progress while it was computed:
+  auto result = recording_output.result();
+  if (result && version % 2 == 0 && table.version() == version) {
+    database_.result_cache().Put(table.name(), cache_key, version, result);
+  }
+}
+
 }}
@@ -5,13 +5,24 @@
 #include "query/query.h"
 #include "query/output.h"
 #include "query/stats.h"
+#include "query/cache.h"
 
 namespace viya {
 namespace query {
 
 namespace db = viya::db;
 
-using AggQueryFn = void (*)(db::Table&, RowOutput&, QueryStats&, std::vector<db::AnyNum>, size_t, size_t);
+/**
+ * Besides filter arguments, skip, limit and the number of threads, aggregation query function
+ * receives output settings at runtime: whether to print header, position of every selected
+ * column (dimensions then metrics, in table order) in output row, and sort columns given by
+ * their number in the same order along with the sort direction. Then comes the cache of partial
+ * aggregations of full segments, or nullptr if they're not cached, and the probability of
+ * every tuple to be sampled (1 unless the query is approximate).
+ */
+using AggQueryFn = void (*)(db::Table&, RowOutput&, QueryStats&, std::vector<db::AnyNum>, size_t, size_t, size_t,
+                            bool, const std::vector<size_t>&, const std::vector<std::pair<size_t, bool>>&,
+                            SegmentPartials*, double);
 using SearchQueryFn = void (*)(db::Table&, RowOutput&, QueryStats&, std::vector<db::AnyNum>, const std::string&, size_t);
 
 class QueryRunner: public QueryVisitor {
@@ -27,6 +38,13 @@ class QueryRunner: public QueryVisitor {
   private:
     void RunFilterBasedQuery(FilterBasedQuery* query);
 
+    /**
+     * Sends the cached result of the query if the table didn't change since it was computed
+     */
+    bool SendCached(const std::string& cache_key, uint64_t version);
+    void CacheResult(db::Table& table, const std::string& cache_key, uint64_t version,
+                     const RecordingRowOutput& recording_output);
+
   private:
     db::Database& database_;
     RowOutput& output_;
@@ -22,9 +22,15 @@ void QueryStats::OnEnd() {
 
   LOG(INFO)<<"Query time "<<query_time<<" ms ("
     <<"ss="<<std::to_string(scanned_segments)
+    <<",cs="<<std::to_string(cached_segments)
+    <<",sts="<<std::to_string(star_tree_segments)
     <<",sr="<<std::to_string(scanned_recs)
     <<",ar="<<std::to_string(aggregated_recs)
     <<",or="<<std::to_string(output_recs)
+    <<",st="<<std::to_string(scan_threads)
+    <<(sample_ratio < 1.0 ? ",sample=" + std::to_string(sample_ratio) : "")
+    <<(interpreted ? ",int" : "")
+    <<(cached ? ",cache" : "")
     <<")"<<std::endl;
 
   std::ostringstream prefix;
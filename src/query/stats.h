@@ -14,8 +14,8 @@ namespace util = viya::util;
 class QueryStats {
   public:
     QueryStats(const util::Statsd& statsd):
-      statsd_(statsd),scanned_segments(0),scanned_recs(0),
-      aggregated_recs(0),output_recs(0) {}
+      statsd_(statsd),scanned_segments(0),cached_segments(0),star_tree_segments(0),scanned_recs(0),
+      aggregated_recs(0),output_recs(0),scan_threads(1),sample_ratio(1.0),interpreted(false),cached(false) {}
 
     void OnBegin(const std::string& query_type, const std::string& table);
     void OnCompile();
@@ -26,9 +26,15 @@ class QueryStats {
     std::string query_type_;
     std::string table_;
     size_t scanned_segments;
+    size_t cached_segments; // segments, whose partial aggregations were taken from cache
+    size_t star_tree_segments; // segments answered by traversing their star-tree index
     size_t scanned_recs;
     size_t aggregated_recs;
     size_t output_recs;
+    size_t scan_threads;
+    double sample_ratio; // fraction of tuples aggregated by approximate query
+    bool interpreted; // whether the query was run by the interpreter
+    bool cached;      // whether the result was taken from the query cache
     cr::duration<float> compile_time;
     cr::duration<float> whole_time;
 
@@ -33,6 +33,20 @@ void Http::Start() {
     });
   };
 
+  server_.resource["^/tables/([^/]+)/warmup$"]["POST"] = [&](ResponsePtr response, RequestPtr request) {
+    // Warmup only compiles queries, and mustn't hold the single write thread, which loads
+    // and creates tables, for the whole compilation:
+    database_.read_pool().push([=](int id __attribute__((unused))) {
+      try {
+        util::Config warmup_conf(request->content.string());
+        database_.Warmup(request->path_match[1], warmup_conf.sublist("queries"));
+        *response<<"HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n";
+      } catch (std::exception& e) {
+        SendError(response, "Error warming up table: " + std::string(e.what()));
+      }
+    });
+  };
+
   server_.resource["^/tables/([^/]+)/meta$"]["GET"] = [&](ResponsePtr response, RequestPtr request) {
     database_.read_pool().push([=](int id __attribute__((unused))) {
       try {
@@ -43,6 +43,13 @@ class Bitset {
       roaring_.runOptimize();
     }
 
+    /**
+     * Approximate memory taken by the bitmap outside of this object
+     */
+    size_t heap_size() const {
+      return roaring_.getSizeInBytes(false);
+    }
+
   private:
     NumType cardinality_;
     RoaringType roaring_;
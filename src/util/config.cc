@@ -92,6 +92,17 @@ long Config::num(const char* key, long default_value) const {
   }
 }
 
+double Config::real(const char* key, double default_value) const {
+  if (!exists(key)) {
+    return default_value;
+  }
+  try {
+    return (*reinterpret_cast<json*>(conf_))[key].get<double>();
+  } catch (std::exception& e) {
+    throw std::invalid_argument(std::string(key) + ": " + e.what());
+  }
+}
+
 std::vector<long> Config::numlist(const char* key) const {
   ValidateKey(key);
   try {
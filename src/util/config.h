@@ -36,6 +36,8 @@ class Config {
     void set_num(const char* key, long value);
     void set_numlist(const char* key, std::vector<long> value);
 
+    double real(const char* key, double default_value) const;
+
     bool boolean(const char* key) const;
     bool boolean(const char* key, bool default_value) const;
     void set_boolean(const char* key, bool value);
@@ -0,0 +1,115 @@
+#ifndef VIYA_UTIL_QUEUE_H_
+#define VIYA_UTIL_QUEUE_H_
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+
+namespace viya {
+namespace util {
+
+/**
+ * Bounded lock-free multi-producer multi-consumer queue (D. Vyukov's algorithm).
+ * Capacity is rounded up to the nearest power of two.
+ */
+template<typename T>
+class BoundedQueue {
+  public:
+    BoundedQueue(size_t capacity) {
+      size_t size = 2;
+      while (size < capacity) {
+        size <<= 1;
+      }
+      mask_ = size - 1;
+      cells_.reset(new Cell[size]);
+      for (size_t i = 0; i < size; ++i) {
+        cells_[i].sequence.store(i, std::memory_order_relaxed);
+      }
+      enqueue_pos_.store(0, std::memory_order_relaxed);
+      dequeue_pos_.store(0, std::memory_order_relaxed);
+    }
+
+    BoundedQueue(const BoundedQueue& other) = delete;
+
+    /**
+     * Returns false if the queue is full
+     */
+    bool TryPush(const T& value) {
+      Cell* cell;
+      size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+      while (true) {
+        cell = &cells_[pos & mask_];
+        size_t seq = cell->sequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+        if (diff == 0) {
+          if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+            break;
+          }
+        } else if (diff < 0) {
+          return false;
+        } else {
+          pos = enqueue_pos_.load(std::memory_order_relaxed);
+        }
+      }
+      cell->data = value;
+      cell->sequence.store(pos + 1, std::memory_order_release);
+      return true;
+    }
+
+    /**
+     * Returns false if the queue is empty
+     */
+    bool TryPop(T& value) {
+      Cell* cell;
+      size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+      while (true) {
+        cell = &cells_[pos & mask_];
+        size_t seq = cell->sequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t) seq - (intptr_t) (pos + 1);
+        if (diff == 0) {
+          if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+            break;
+          }
+        } else if (diff < 0) {
+          return false;
+        } else {
+          pos = dequeue_pos_.load(std::memory_order_relaxed);
+        }
+      }
+      value = cell->data;
+      cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+      return true;
+    }
+
+    /**
+     * Approximate number of elements in the queue
+     */
+    size_t size() const {
+      size_t enqueue_pos = enqueue_pos_.load(std::memory_order_relaxed);
+      size_t dequeue_pos = dequeue_pos_.load(std::memory_order_relaxed);
+      return enqueue_pos > dequeue_pos ? enqueue_pos - dequeue_pos : 0;
+    }
+
+    size_t capacity() const { return mask_ + 1; }
+
+  private:
+    struct Cell {
+      std::atomic<size_t> sequence;
+      T data;
+    };
+
+    static const size_t CACHELINE_SIZE = 64;
+
+    char pad0_[CACHELINE_SIZE];
+    std::unique_ptr<Cell[]> cells_;
+    size_t mask_;
+    char pad1_[CACHELINE_SIZE];
+    std::atomic<size_t> enqueue_pos_;
+    char pad2_[CACHELINE_SIZE];
+    std::atomic<size_t> dequeue_pos_;
+    char pad3_[CACHELINE_SIZE];
+};
+
+}}
+
+#endif // VIYA_UTIL_QUEUE_H_
@@ -0,0 +1,52 @@
+#ifndef VIYA_UTIL_VARINT_H_
+#define VIYA_UTIL_VARINT_H_
+
+#include <cstdint>
+#include <string>
+
+namespace viya {
+namespace util {
+
+/**
+ * Reads unsigned LEB128 encoded integer, and advances the pointer past it.
+ * The caller must make sure that the whole value is available in the buffer.
+ */
+inline uint64_t read_varint(const char*& p) {
+  uint64_t value = 0;
+  int shift = 0;
+  uint8_t byte;
+  do {
+    byte = static_cast<uint8_t>(*p++);
+    value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    shift += 7;
+  } while (byte & 0x80);
+  return value;
+}
+
+/**
+ * Bounds checked version of the above. Returns false if the value is not
+ * completely contained within [p, end).
+ */
+inline bool read_varint(const char*& p, const char* end, uint64_t& value) {
+  value = 0;
+  for (int shift = 0; p < end && shift < 64; shift += 7) {
+    uint8_t byte = static_cast<uint8_t>(*p++);
+    value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+inline void write_varint(std::string& out, uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<char>(value));
+}
+
+}}
+
+#endif // VIYA_UTIL_VARINT_H_
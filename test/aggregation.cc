@@ -1,4 +1,5 @@
 #include <algorithm>
+#include <set>
 #include "db/table.h"
 #include "util/config.h"
 #include "query/output.h"
@@ -42,6 +43,23 @@ TEST_F(InappEvents, AggregationQuery)
   EXPECT_EQ(expected, actual);
 }
 
+TEST_F(InappEvents, MetricsOnly)
+{
+  auto table = db.GetTable("events");
+  aggregation_load_events(table);
+
+  query::MemoryRowOutput output;
+  db.Query(
+    std::move(util::Config(
+        "{\"type\": \"aggregate\","
+        " \"table\": \"events\","
+        " \"select\": [{\"column\": \"revenue\"}],"
+        " \"filter\": {\"op\": \"eq\", \"column\": \"country\", \"value\": \"US\"}}")), output);
+
+  std::vector<query::MemoryRowOutput::Row> expected = {{"6.2"}};
+  EXPECT_EQ(expected, output.rows());
+}
+
 TEST_F(InappEvents, OutputColumnsOrder)
 {
   auto table = db.GetTable("events");
@@ -123,3 +141,372 @@ TEST_F(InappEvents, MissingValueNe)
   EXPECT_EQ(expected, output.rows());
 }
 
+
+TEST(Aggregation, ParallelScan)
+{
+  db::Database db(std::move(util::Config(
+          "{\"scan_threads\": 3,"
+          " \"tables\": [{\"name\": \"events\","
+          "               \"segment_size\": 10,"
+          "               \"dimensions\": [{\"name\": \"app_id\"}, {\"name\": \"version\"},"
+          "                                {\"name\": \"seq\", \"type\": \"numeric\"}],"
+          "               \"metrics\": [{\"name\": \"count\", \"type\": \"count\"},"
+          "                             {\"name\": \"user_id\", \"type\": \"bitset\"}]}]}")));
+  auto table = db.GetTable("events");
+  for (int i = 0; i < 100; ++i) {
+    table->Load({
+      {"app" + std::to_string(i % 7), std::to_string(i % 3), std::to_string(i), "1", std::to_string(i % 13)}
+    });
+  }
+
+  auto run_query = [&db](size_t threads, std::vector<query::MemoryRowOutput::Row>& rows) {
+    query::MemoryRowOutput output;
+    auto stats = db.Query(
+      std::move(util::Config(
+          "{\"type\": \"aggregate\","
+          " \"table\": \"events\","
+          " \"dimensions\": [\"app_id\"],"
+          " \"metrics\": [\"count\", \"user_id\"],"
+          " \"threads\": " + std::to_string(threads) + ","
+          " \"filter\": {\"op\": \"ne\", \"column\": \"version\", \"value\": \"2\"}}")), output);
+    rows = output.rows();
+    std::sort(rows.begin(), rows.end());
+    return stats;
+  };
+
+  std::vector<query::MemoryRowOutput::Row> expected, actual;
+  auto serial_stats = run_query(1, expected);
+  auto parallel_stats = run_query(8, actual);
+
+  EXPECT_EQ(7, expected.size());
+  EXPECT_EQ(expected, actual);
+
+  // Parallelism is limited by the admission budget:
+  EXPECT_EQ(1, serial_stats.scan_threads);
+  EXPECT_EQ(4, parallel_stats.scan_threads);
+  EXPECT_EQ(10, parallel_stats.scanned_segments);
+  EXPECT_EQ(100, parallel_stats.scanned_recs);
+}
+
+TEST(Aggregation, BatchedFilter)
+{
+  db::Database db(std::move(util::Config(
+          "{\"tables\": [{\"name\": \"events\","
+          "               \"dimensions\": [{\"name\": \"bucket\", \"type\": \"numeric\"},"
+          "                                {\"name\": \"seq\", \"type\": \"numeric\"}],"
+          "               \"metrics\": [{\"name\": \"count\", \"type\": \"count\"}]}]}")));
+  auto table = db.GetTable("events");
+  // Several filter blocks, the last one being incomplete:
+  for (int i = 0; i < 3000; ++i) {
+    table->Load({{std::to_string(i % 10), std::to_string(i), "1"}});
+  }
+
+  query::MemoryRowOutput output;
+  db.Query(
+    std::move(util::Config(
+        "{\"type\": \"aggregate\","
+        " \"table\": \"events\","
+        " \"dimensions\": [\"bucket\"],"
+        " \"metrics\": [\"count\"],"
+        " \"filter\": {\"op\": \"or\", \"filters\": ["
+        "               {\"op\": \"lt\", \"column\": \"bucket\", \"value\": \"3\"},"
+        "               {\"op\": \"gt\", \"column\": \"seq\", \"value\": \"2994\"}"
+        "             ]}}")), output);
+
+  std::vector<query::MemoryRowOutput::Row> expected = {
+    {"0", "300"}, {"1", "300"}, {"2", "300"},
+    {"5", "1"}, {"6", "1"}, {"7", "1"}, {"8", "1"}, {"9", "1"}
+  };
+  auto actual = output.rows();
+  std::sort(actual.begin(), actual.end());
+
+  EXPECT_EQ(expected, actual);
+}
+
+TEST(Aggregation, ManyGroups)
+{
+  db::Database db(std::move(util::Config(
+          "{\"scan_threads\": 1,"
+          " \"tables\": [{\"name\": \"events\","
+          "               \"segment_size\": 1000,"
+          "               \"dimensions\": [{\"name\": \"user\", \"type\": \"numeric\"},"
+          "                                {\"name\": \"day\", \"type\": \"numeric\"}],"
+          "               \"metrics\": [{\"name\": \"count\", \"type\": \"count\"}]}]}")));
+  auto table = db.GetTable("events");
+  for (int day = 0; day < 2; ++day) {
+    for (int user = 0; user < 5000; ++user) {
+      table->Load({{std::to_string(user), std::to_string(day), "1"}});
+    }
+  }
+
+  query::MemoryRowOutput output;
+  db.Query(
+    std::move(util::Config(
+        "{\"type\": \"aggregate\","
+        " \"table\": \"events\","
+        " \"dimensions\": [\"user\"],"
+        " \"metrics\": [\"count\"],"
+        " \"threads\": 2,"
+        " \"filter\": {\"op\": \"ge\", \"column\": \"day\", \"value\": \"0\"}}")), output);
+
+  auto rows = output.rows();
+  EXPECT_EQ(5000, rows.size());
+  std::set<std::string> users;
+  for (auto& row : rows) {
+    users.insert(row[0]);
+    EXPECT_EQ("2", row[1]);
+  }
+  EXPECT_EQ(5000, users.size());
+}
+
+TEST(Aggregation, SelectiveFilter)
+{
+  // Hash table is presized after the first block, while holding groups of that block:
+  db::Database db(std::move(util::Config(
+          "{\"tables\": [{\"name\": \"events\","
+          "               \"segment_size\": 10000,"
+          "               \"dimensions\": [{\"name\": \"user\", \"type\": \"numeric\"}],"
+          "               \"metrics\": [{\"name\": \"count\", \"type\": \"count\"}]}]}")));
+  auto table = db.GetTable("events");
+  table->BeforeLoad();
+  for (int user = 0; user < 20000; ++user) {
+    std::vector<std::string> row = {std::to_string(user), "1"};
+    table->Load(row);
+  }
+  table->AfterLoad();
+
+  for (auto& limit : std::vector<std::string> {"100", "20000"}) {
+    query::MemoryRowOutput output;
+    db.Query(
+      std::move(util::Config(
+          "{\"type\": \"aggregate\","
+          " \"table\": \"events\","
+          " \"dimensions\": [\"user\"],"
+          " \"metrics\": [\"count\"],"
+          " \"threads\": 1,"
+          " \"filter\": {\"op\": \"lt\", \"column\": \"user\", \"value\": \"" + limit + "\"}}")), output);
+
+    auto rows = output.rows();
+    EXPECT_EQ(std::stoul(limit), rows.size());
+    std::set<std::string> users;
+    for (auto& row : rows) {
+      users.insert(row[0]);
+      EXPECT_EQ("1", row[1]);
+    }
+    EXPECT_EQ(std::stoul(limit), users.size());
+  }
+}
+
+TEST(Aggregation, SparseKeys)
+{
+  db::Database db(std::move(util::Config(
+          "{\"tables\": [{\"name\": \"events\","
+          "               \"dimensions\": [{\"name\": \"device\", \"type\": \"numeric\", \"max\": 20000000000},"
+          "                                {\"name\": \"os\"}],"
+          "               \"metrics\": [{\"name\": \"count\", \"type\": \"count\"}]}]}")));
+  auto table = db.GetTable("events");
+  // Key space is too large for array aggregation, so hash table is used:
+  for (int i = 0; i < 100; ++i) {
+    table->Load({{std::to_string(i * 100000007L), i % 2 ? "ios" : "android", "1"}});
+    table->Load({{std::to_string(i * 100000007L), i % 2 ? "ios" : "android", "1"}});
+  }
+
+  query::MemoryRowOutput output;
+  db.Query(
+    std::move(util::Config(
+        "{\"type\": \"aggregate\","
+        " \"table\": \"events\","
+        " \"dimensions\": [\"device\", \"os\"],"
+        " \"metrics\": [\"count\"],"
+        " \"filter\": {\"op\": \"eq\", \"column\": \"os\", \"value\": \"ios\"}}")), output);
+
+  auto rows = output.rows();
+  EXPECT_EQ(50, rows.size());
+  for (auto& row : rows) {
+    EXPECT_EQ(0, std::stol(row[0]) % 100000007L);
+    EXPECT_EQ("ios", row[1]);
+    EXPECT_EQ("2", row[2]);
+  }
+}
+
+TEST(Aggregation, WideKeys)
+{
+  // Keys of 9-16 bytes are packed into 128 bit integers, and longer ones aren't packed:
+  db::Database db(std::move(util::Config(
+          "{\"tables\": [{\"name\": \"events\","
+          "               \"dimensions\": [{\"name\": \"a\", \"type\": \"numeric\", \"max\": 20000000000},"
+          "                                {\"name\": \"b\", \"type\": \"numeric\", \"max\": 20000000000},"
+          "                                {\"name\": \"c\", \"type\": \"numeric\", \"max\": 20000000000}],"
+          "               \"metrics\": [{\"name\": \"count\", \"type\": \"count\"}]}]}")));
+  auto table = db.GetTable("events");
+  table->Load({
+    {"10000000000", "1", "2", "1"},
+    {"10000000000", "1", "2", "1"},
+    {"10000000000", "2", "1", "1"},
+    {"1", "10000000000", "2", "1"}
+  });
+
+  query::MemoryRowOutput output;
+  db.Query(
+    std::move(util::Config(
+        "{\"type\": \"aggregate\","
+        " \"table\": \"events\","
+        " \"dimensions\": [\"a\", \"b\"],"
+        " \"metrics\": [\"count\"],"
+        " \"filter\": {\"op\": \"gt\", \"column\": \"c\", \"value\": \"0\"}}")), output);
+
+  std::vector<query::MemoryRowOutput::Row> expected = {
+    {"1", "10000000000", "1"},
+    {"10000000000", "1", "2"},
+    {"10000000000", "2", "1"}
+  };
+  auto actual = output.rows();
+  std::sort(actual.begin(), actual.end());
+
+  EXPECT_EQ(expected, actual);
+}
+
+TEST(Aggregation, Warmup)
+{
+  db::Database db(std::move(util::Config(
+          "{\"tables\": [{\"name\": \"events\","
+          "               \"dimensions\": [{\"name\": \"country\"},"
+          "                                {\"name\": \"event_name\", \"length\": 24},"
+          "                                {\"name\": \"install_time\", \"type\": \"numeric\"}],"
+          "               \"metrics\": [{\"name\": \"count\", \"type\": \"count\"},"
+          "                             {\"name\": \"revenue\", \"type\": \"double_sum\"}],"
+          "               \"warmup_queries\": ["
+          "                 {\"type\": \"aggregate\", \"dimensions\": [\"country\"], \"metrics\": [\"count\"],"
+          "                  \"filter\": {\"op\": \"eq\", \"column\": \"event_name\", \"value\": \"\"}}]}]}")));
+  auto table = db.GetTable("events");
+  aggregation_load_events(table);
+
+  db.Warmup("events", {util::Config(
+        "{\"type\": \"search\", \"dimension\": \"event_name\", \"term\": \"\", \"limit\": 1,"
+        " \"filter\": {\"op\": \"gt\", \"column\": \"revenue\", \"value\": \"0\"}}")});
+
+  auto misses = db.compiler().stats().misses;
+
+  query::MemoryRowOutput output;
+  db.Query(
+    std::move(util::Config(
+        "{\"type\": \"aggregate\","
+        " \"table\": \"events\","
+        " \"dimensions\": [\"country\"],"
+        " \"metrics\": [\"count\"],"
+        " \"filter\": {\"op\": \"eq\", \"column\": \"event_name\", \"value\": \"purchase\"}}")), output);
+  db.Query(
+    std::move(util::Config(
+        "{\"type\": \"search\","
+        " \"table\": \"events\","
+        " \"dimension\": \"event_name\","
+        " \"term\": \"ur\","
+        " \"limit\": 5,"
+        " \"filter\": {\"op\": \"gt\", \"column\": \"revenue\", \"value\": \"1\"}}")), output);
+
+  EXPECT_EQ(misses, db.compiler().stats().misses);
+
+  EXPECT_THROW(db.Warmup("events", {util::Config("{\"type\": \"aggregate\", \"dimensions\": [\"none\"]}")}),
+               std::exception);
+}
+
+TEST(Aggregation, ResultCache)
+{
+  db::Database db(std::move(util::Config(
+          "{\"query_cache_size\": 4096,"
+          " \"tables\": [{\"name\": \"events\","
+          "               \"dimensions\": [{\"name\": \"country\"},"
+          "                                {\"name\": \"event_name\", \"length\": 24},"
+          "                                {\"name\": \"install_time\", \"type\": \"numeric\"}],"
+          "               \"metrics\": [{\"name\": \"revenue\", \"type\": \"double_sum\"}]}]}")));
+  auto table = db.GetTable("events");
+  aggregation_load_events(table);
+
+  auto query = [&db](const std::string& column, const std::string& value, query::MemoryRowOutput& output) {
+    auto stats = db.Query(
+      std::move(util::Config(
+          "{\"type\": \"aggregate\","
+          " \"table\": \"events\","
+          " \"dimensions\": [\"event_name\"],"
+          " \"metrics\": [\"revenue\"],"
+          " \"filter\": {\"op\": \"eq\", \"column\": \"" + column + "\", \"value\": \"" + value + "\"}}")), output);
+    return stats.cached;
+  };
+
+  query::MemoryRowOutput output1, output2, output3, output4;
+  EXPECT_FALSE(query("country", "US", output1));
+  EXPECT_TRUE(query("country", "US", output2));
+  EXPECT_EQ(output1.rows(), output2.rows());
+
+  // Different filter arguments are cached separately:
+  EXPECT_FALSE(query("country", "IL", output3));
+  EXPECT_TRUE(output3.rows().empty());
+
+  // New data invalidates cached results:
+  table->Load({{"US", "purchase", "20141112", "2.0"}});
+  EXPECT_FALSE(query("country", "US", output4));
+  std::vector<query::MemoryRowOutput::Row> expected = {{"donate", "5"}, {"purchase", "3.2"}};
+  auto actual = output4.rows();
+  std::sort(actual.begin(), actual.end());
+  EXPECT_EQ(expected, actual);
+
+  // Least recently used results are evicted when the budget is exceeded:
+  for (int i = 0; i < 50; ++i) {
+    query::MemoryRowOutput output;
+    query("install_time", std::to_string(20141100 + i), output);
+  }
+  auto cache_stats = db.result_cache().stats();
+  EXPECT_GT(cache_stats.evictions, 0);
+  EXPECT_LE(cache_stats.size, 4096);
+
+  query::MemoryRowOutput output5;
+  EXPECT_FALSE(query("country", "US", output5));
+  actual = output5.rows();
+  std::sort(actual.begin(), actual.end());
+  EXPECT_EQ(expected, actual);
+}
+
+TEST(Aggregation, PartialCache)
+{
+  db::Database db(std::move(util::Config(
+          "{\"partial_cache_size\": 1048576,"
+          " \"tables\": [{\"name\": \"events\","
+          "               \"segment_size\": 10,"
+          "               \"dimensions\": [{\"name\": \"country\"},"
+          "                                {\"name\": \"user\", \"type\": \"numeric\"}],"
+          "               \"metrics\": [{\"name\": \"revenue\", \"type\": \"double_sum\"}]}]}")));
+  auto table = db.GetTable("events");
+  const char* countries[] = {"US", "IL", "RU"};
+  for (int i = 0; i < 35; ++i) {
+    table->Load({{countries[i % 3], std::to_string(i), "1.0"}});
+  }
+
+  auto query = [&db](query::MemoryRowOutput& output) {
+    auto stats = db.Query(
+      std::move(util::Config(
+          "{\"type\": \"aggregate\","
+          " \"table\": \"events\","
+          " \"dimensions\": [\"country\"],"
+          " \"metrics\": [\"revenue\"],"
+          " \"sort\": [{\"column\": \"revenue\"}],"
+          " \"filter\": {\"op\": \"lt\", \"column\": \"user\", \"value\": \"100\"}}")), output);
+    return stats.cached_segments;
+  };
+
+  query::MemoryRowOutput output1, output2, output3, output4;
+  EXPECT_EQ(0, query(output1));
+  EXPECT_EQ(3, query(output2));
+  EXPECT_EQ(output1.rows(), output2.rows());
+
+  // Only the segment, which was updated in place, is scanned again:
+  table->Load({{"US", "0", "10.0"}});
+  EXPECT_EQ(2, query(output3));
+  std::vector<query::MemoryRowOutput::Row> expected = {{"US", "22"}, {"IL", "12"}, {"RU", "11"}};
+  EXPECT_EQ(expected, output3.rows());
+
+  // New tuples go to the last segment, while the full ones are still cached:
+  table->Load({{"RU", "100", "1.0"}, {"RU", "40", "3.0"}});
+  EXPECT_EQ(3, query(output4));
+  expected = {{"US", "22"}, {"RU", "14"}, {"IL", "12"}};
+  EXPECT_EQ(expected, output4.rows());
+}
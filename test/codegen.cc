@@ -1,7 +1,16 @@
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <ctime>
+#include <stdexcept>
+#include <unistd.h>
+#include <boost/filesystem.hpp>
 #include "gtest/gtest.h"
 #include "codegen/compiler.h"
 
 namespace cg = viya::codegen;
+namespace util = viya::util;
+namespace fs = boost::filesystem;
 
 TEST(Codegen, Basic)
 {
@@ -13,3 +22,178 @@ TEST(Codegen, Basic)
   EXPECT_EQ(123, func());
 }
 
+
+TEST(Codegen, ConcurrentCompile)
+{
+  cg::Compiler compiler;
+  auto make_code = [](int value) {
+    return "int viya_foo() __attribute__((__visibility__(\"default\"))); int viya_foo() { return "
+      + std::to_string(value) + "; }";
+  };
+
+  std::vector<std::shared_ptr<cg::SharedLibrary>> libs(8);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < libs.size(); ++i) {
+    threads.emplace_back([&, i] { libs[i] = compiler.Compile(make_code(1000 + i % 2)); });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  for (size_t i = 0; i < libs.size(); ++i) {
+    auto func = libs[i]->GetFunction<int (*)()>(std::string("_Z8viya_foov"));
+    EXPECT_EQ(1000 + (int)(i % 2), func());
+    EXPECT_EQ(libs[i % 2].get(), libs[i].get());
+  }
+}
+
+TEST(Codegen, CompileError)
+{
+  cg::Compiler compiler;
+  std::string code = "int viya_broken() { return }";
+
+  std::vector<std::thread> threads;
+  std::vector<int> failures(4);
+  for (size_t i = 0; i < failures.size(); ++i) {
+    threads.emplace_back([&, i] {
+      try {
+        compiler.Compile(code);
+      } catch (std::runtime_error& e) {
+        failures[i] = 1;
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  for (auto f : failures) {
+    EXPECT_EQ(1, f);
+  }
+}
+
+TEST(Codegen, PrecompiledHeaders)
+{
+  char tmp_path[] = "/tmp/viya_codegen_XXXXXX";
+  ASSERT_NE(nullptr, mkdtemp(tmp_path));
+  util::Config config("{\"tmp_path\": \"" + std::string(tmp_path) + "\", \"precompile_headers\": true}");
+
+  // Prelude headers are force-included, so the code doesn't include them itself:
+  std::string code = "int viya_foo() __attribute__((__visibility__(\"default\"))); int viya_foo() {"
+    " std::vector<std::string> v = {\"a\", \"bc\"}; return v.size() + v[1].size(); }";
+  {
+    cg::Compiler compiler(config);
+    auto library = compiler.Compile(code);
+    auto func = library->GetFunction<int (*)()>(std::string("_Z8viya_foov"));
+    EXPECT_EQ(4, func());
+  }
+
+  // Precompiled header is reused by other compilers:
+  cg::Compiler compiler(config);
+  auto library = compiler.Compile(code);
+  auto func = library->GetFunction<int (*)()>(std::string("_Z8viya_foov"));
+  EXPECT_EQ(4, func());
+
+  size_t headers = 0;
+  for (fs::directory_iterator it(tmp_path), end; it != end; ++it) {
+    if (it->path().extension() == ".gch") {
+      ++headers;
+    }
+  }
+  EXPECT_EQ(1, headers);
+  fs::remove_all(tmp_path);
+}
+
+TEST(Codegen, TieredCompile)
+{
+  cg::Compiler compiler(util::Config("{\"tiered_compilation\": true, \"optimize_after\": 3}"));
+  // Make code unique, so that an optimized library is not left by a previous run:
+  int expected = std::time(nullptr) % 1000000;
+  std::string code = "int viya_foo() __attribute__((__visibility__(\"default\"))); int viya_foo() { return "
+    + std::to_string(expected) + "; } int viya_bar" + std::to_string(getpid()) + ";";
+
+  auto quick = compiler.Compile(code, true);
+  auto quick_func = quick->GetFunction<int (*)()>(std::string("_Z8viya_foov"));
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_EQ(quick.get(), compiler.Compile(code, true).get());
+  }
+
+  // Optimized library replaces the quick one once it's ready:
+  std::shared_ptr<cg::SharedLibrary> optimized;
+  for (int attempt = 0; attempt < 600; ++attempt) {
+    optimized = compiler.Compile(code, true);
+    if (optimized.get() != quick.get()) {
+      break;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  EXPECT_NE(quick.get(), optimized.get());
+
+  auto func = optimized->GetFunction<int (*)()>(std::string("_Z8viya_foov"));
+  EXPECT_EQ(expected, func());
+  // Quick library is still loaded, since it's referenced:
+  EXPECT_EQ(expected, quick_func());
+}
+
+TEST(Codegen, UntieredCompile)
+{
+  char tmp_path[] = "/tmp/viya_codegen_XXXXXX";
+  ASSERT_NE(nullptr, mkdtemp(tmp_path));
+  cg::Compiler compiler(util::Config(
+      "{\"tmp_path\": \"" + std::string(tmp_path) + "\", \"precompile_headers\": false,"
+      " \"tiered_compilation\": true}"));
+
+  // Code, which isn't requested as tiered, is fully optimized right away:
+  std::string code = "int viya_foo() __attribute__((__visibility__(\"default\"))); int viya_foo() { return 5; }";
+  auto library = compiler.Compile(code);
+  auto func = library->GetFunction<int (*)()>(std::string("_Z8viya_foov"));
+  EXPECT_EQ(5, func());
+
+  size_t libraries = 0;
+  for (fs::directory_iterator it(tmp_path), end; it != end; ++it) {
+    if (it->path().extension() == ".so") {
+      EXPECT_EQ(std::string::npos, it->path().filename().string().find("_quick"));
+      ++libraries;
+    }
+  }
+  EXPECT_EQ(1, libraries);
+  fs::remove_all(tmp_path);
+}
+
+TEST(Codegen, LibraryEviction)
+{
+  char tmp_path[] = "/tmp/viya_codegen_XXXXXX";
+  ASSERT_NE(nullptr, mkdtemp(tmp_path));
+  cg::Compiler compiler(util::Config(
+      "{\"tmp_path\": \"" + std::string(tmp_path) + "\", \"precompile_headers\": false,"
+      " \"max_libraries\": 2, \"max_disk_size\": 1}"));
+  auto make_code = [](int value) {
+    return "int viya_foo() __attribute__((__visibility__(\"default\"))); int viya_foo() { return "
+      + std::to_string(value) + "; }";
+  };
+
+  auto held = compiler.Compile(make_code(1));
+  compiler.Compile(make_code(2));
+  compiler.Compile(make_code(3));
+
+  // Second library is evicted, since the first one is still referenced:
+  auto stats = compiler.stats();
+  EXPECT_EQ(2, stats.libraries);
+  EXPECT_EQ(1, stats.evictions);
+  EXPECT_EQ(held.get(), compiler.Compile(make_code(1)).get());
+  EXPECT_EQ(1, compiler.stats().hits);
+
+  // Only the last compiled file fits the disk quota:
+  EXPECT_LE(2, stats.disk_evictions);
+  size_t files = 0;
+  for (fs::directory_iterator it(tmp_path), end; it != end; ++it) {
+    if (it->path().extension() == ".so") {
+      ++files;
+    }
+  }
+  EXPECT_EQ(1, files);
+  fs::remove_all(tmp_path);
+
+  auto func = held->GetFunction<int (*)()>(std::string("_Z8viya_foov"));
+  EXPECT_EQ(1, func());
+}
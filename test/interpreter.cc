@@ -0,0 +1,137 @@
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include "db/table.h"
+#include "util/config.h"
+#include "query/output.h"
+#include "db.h"
+#include "gtest/gtest.h"
+
+namespace util = viya::util;
+namespace query = viya::query;
+
+static std::string interpreter_table_conf(size_t segment_size) {
+  return "{\"name\": \"events\","
+    " \"segment_size\": " + std::to_string(segment_size) + ","
+    " \"dimensions\": [{\"name\": \"country\"},"
+    "                  {\"name\": \"event_name\"},"
+    "                  {\"name\": \"version\", \"type\": \"numeric\"},"
+    "                  {\"name\": \"install_time\", \"type\": \"time\"},"
+    "                  {\"name\": \"is_organic\", \"type\": \"boolean\"}],"
+    " \"metrics\": [{\"name\": \"count\", \"type\": \"count\"},"
+    "               {\"name\": \"revenue\", \"type\": \"double_sum\"},"
+    "               {\"name\": \"level\", \"type\": \"int_max\"},"
+    "               {\"name\": \"user_id\", \"type\": \"bitset\"}]}";
+}
+
+static void interpreter_load_events(db::Table* table) {
+  const char* countries[] = {"US", "IL", "RU", "DE", "FR"};
+  const char* events[] = {"install", "purchase", "donate"};
+  for (int i = 0; i < 500; ++i) {
+    table->Load({{
+      countries[i % 5], events[i % 3], std::to_string(i % 4),
+      std::to_string(1415791501 + (i % 6) * 40000), i % 2 ? "true" : "false",
+      std::to_string(i % 10) + ".5", std::to_string(i % 17), std::to_string(i % 23)
+    }});
+  }
+}
+
+TEST(Interpreter, SameResultsAsCompiled)
+{
+  db::Database compiled_db(std::move(util::Config(
+          "{\"tables\": [" + interpreter_table_conf(100) + "]}")));
+  db::Database interpreted_db(std::move(util::Config(
+          "{\"interpret_cold_queries\": true,"
+          " \"tables\": [" + interpreter_table_conf(70) + "]}")));
+  interpreter_load_events(compiled_db.GetTable("events"));
+  interpreter_load_events(interpreted_db.GetTable("events"));
+
+  std::vector<std::string> queries = {
+    "{\"type\": \"aggregate\", \"table\": \"events\","
+    " \"dimensions\": [\"country\", \"event_name\"],"
+    " \"metrics\": [\"count\", \"revenue\", \"level\", \"user_id\"],"
+    " \"filter\": {\"op\": \"ne\", \"column\": \"country\", \"value\": \"RU\"}}",
+
+    "{\"type\": \"aggregate\", \"table\": \"events\","
+    " \"dimensions\": [\"version\", \"is_organic\"],"
+    " \"metrics\": [\"count\"],"
+    " \"filter\": {\"op\": \"and\", \"filters\": ["
+    "   {\"op\": \"in\", \"column\": \"event_name\", \"values\": [\"install\", \"donate\"]},"
+    "   {\"op\": \"not\", \"filter\": {\"op\": \"gt\", \"column\": \"level\", \"value\": \"10\"}}]}}",
+
+    "{\"type\": \"aggregate\", \"table\": \"events\","
+    " \"select\": [{\"column\": \"install_time\", \"format\": \"%Y-%m-%d\", \"granularity\": \"day\"},"
+    "              {\"column\": \"revenue\"}],"
+    " \"filter\": {\"op\": \"or\", \"filters\": ["
+    "   {\"op\": \"lt\", \"column\": \"country\", \"value\": \"IL\"},"
+    "   {\"op\": \"ge\", \"column\": \"revenue\", \"value\": \"8\"}]}}",
+
+    "{\"type\": \"aggregate\", \"table\": \"events\","
+    " \"dimensions\": [\"country\", \"version\"],"
+    " \"metrics\": [\"revenue\", \"user_id\"],"
+    " \"sort\": [{\"column\": \"user_id\", \"ascending\": false}, {\"column\": \"country\"},"
+    "            {\"column\": \"version\"}],"
+    " \"skip\": 2, \"limit\": 5, \"header\": true,"
+    " \"filter\": {\"op\": \"gt\", \"column\": \"install_time\", \"value\": \"1415791501\"}}",
+
+    "{\"type\": \"search\", \"table\": \"events\","
+    " \"dimension\": \"country\", \"term\": \"R\", \"limit\": 10,"
+    " \"filter\": {\"op\": \"ge\", \"column\": \"version\", \"value\": \"1\"}}"
+  };
+
+  for (auto& query : queries) {
+    query::MemoryRowOutput compiled_output, interpreted_output;
+    auto compiled_stats = compiled_db.Query(util::Config(query), compiled_output);
+    auto interpreted_stats = interpreted_db.Query(util::Config(query), interpreted_output);
+
+    EXPECT_FALSE(compiled_stats.interpreted);
+    EXPECT_TRUE(interpreted_stats.interpreted);
+    EXPECT_EQ(compiled_stats.aggregated_recs, interpreted_stats.aggregated_recs);
+
+    auto expected = compiled_output.rows();
+    auto actual = interpreted_output.rows();
+    if (query.find("sort") == std::string::npos) {
+      std::sort(expected.begin(), expected.end());
+      std::sort(actual.begin(), actual.end());
+    }
+    if (query.find("search") != std::string::npos) {
+      std::sort(expected[0].begin(), expected[0].end());
+      std::sort(actual[0].begin(), actual[0].end());
+    }
+    EXPECT_EQ(expected, actual) << query;
+  }
+}
+
+TEST(Interpreter, SwitchToCompiled)
+{
+  db::Database db(std::move(util::Config(
+          "{\"interpret_cold_queries\": true,"
+          " \"tables\": [" + interpreter_table_conf(100) + "]}")));
+  interpreter_load_events(db.GetTable("events"));
+
+  std::string query =
+    "{\"type\": \"aggregate\", \"table\": \"events\","
+    " \"dimensions\": [\"event_name\"],"
+    " \"metrics\": [\"count\"],"
+    " \"filter\": {\"op\": \"eq\", \"column\": \"is_organic\", \"value\": \"true\"}}";
+
+  std::vector<query::MemoryRowOutput::Row> expected = {
+    {"donate", "83"}, {"install", "83"}, {"purchase", "84"}
+  };
+
+  // Query is interpreted until its compilation is finished:
+  bool interpreted = true;
+  for (int attempt = 0; attempt < 600 && interpreted; ++attempt) {
+    query::MemoryRowOutput output;
+    interpreted = db.Query(util::Config(query), output).interpreted;
+
+    auto actual = output.rows();
+    std::sort(actual.begin(), actual.end());
+    EXPECT_EQ(expected, actual);
+
+    if (interpreted) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+  }
+  EXPECT_FALSE(interpreted);
+}
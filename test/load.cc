@@ -1,7 +1,18 @@
 #include <fstream>
+#include <algorithm>
 #include <unistd.h>
+#include <zlib.h>
+#include "db/defs.h"
+#if HAVE_ZSTD
+#include <zstd.h>
+#endif
+#if HAVE_LZ4
+#include <lz4frame.h>
+#endif
 #include "db/table.h"
 #include "db/store.h"
+#include "util/varint.h"
+#include "query/output.h"
 #include "gtest/gtest.h"
 #include "db.h"
 
@@ -94,3 +105,340 @@ TEST_F(InappEvents, LoadFromTsvCols)
   EXPECT_EQ(expected, output.rows());
 }
 
+
+TEST_F(InappEvents, LoadFromTsvParallel)
+{
+  auto table = db.GetTable("events");
+  std::string fname("InappEvents_LoadFromTsvParallel.tsv");
+
+  // Large enough to be split into many batches:
+  std::ofstream out(fname);
+  for (int i = 0; i < 200000; ++i) {
+    out<<(i % 2 ? "US" : "IL")<<"\tpurchase\t"<<(20141112 + i % 100)<<"\t1\n";
+  }
+  out<<"US\tpurchase\t20141112\t1";
+  out.close();
+
+  util::Config load_conf(
+    "{\"file\": \"" + fname + "\","
+    " \"type\": \"file\","
+    " \"format\": \"tsv\","
+    " \"parser_threads\": 4,"
+    " \"table\": \"" + table->name() + "\"}");
+  db.Load(load_conf);
+
+  query::MemoryRowOutput output;
+  db.Query(
+    std::move(util::Config(
+        "{\"type\": \"aggregate\","
+        " \"table\": \"events\","
+        " \"dimensions\": [\"country\"],"
+        " \"metrics\": [\"count\"],"
+        " \"filter\": {\"op\": \"ne\", \"column\": \"country\", \"value\": \"IL\"}}")), output);
+
+  std::vector<query::MemoryRowOutput::Row> expected = {
+    {"US", "100001"}
+  };
+  EXPECT_EQ(expected, output.rows());
+
+  // Parse errors are propagated from parser threads:
+  out.open(fname, std::ios::app);
+  out<<"\nUS\tpurchase\t20141112\t1\t1\n";
+  out.close();
+  EXPECT_THROW(db.Load(load_conf), std::runtime_error);
+  unlink(fname.c_str());
+}
+
+TEST_F(InappEvents, LoadWithIoUring)
+{
+  auto table = db.GetTable("events");
+  std::string fname("InappEvents_LoadWithIoUring.tsv");
+
+  std::ofstream out(fname);
+  for (int i = 0; i < 100000; ++i) {
+    out<<"US\tpurchase\t"<<(20141112 + i % 100)<<"\t1\n";
+  }
+  out.close();
+
+  // Falls back to blocking reads where io_uring or direct I/O are not available:
+  util::Config load_conf(
+    "{\"file\": \"" + fname + "\","
+    " \"type\": \"file\","
+    " \"format\": \"tsv\","
+    " \"io_uring\": true,"
+    " \"direct_io\": true,"
+    " \"io_depth\": 3,"
+    " \"io_block_size\": 65536,"
+    " \"table\": \"" + table->name() + "\"}");
+  db.Load(load_conf);
+  unlink(fname.c_str());
+
+  query::MemoryRowOutput output;
+  db.Query(
+    std::move(util::Config(
+        "{\"type\": \"aggregate\","
+        " \"table\": \"events\","
+        " \"dimensions\": [\"country\"],"
+        " \"metrics\": [\"count\"],"
+        " \"filter\": {\"op\": \"ne\", \"column\": \"country\", \"value\": \"IL\"}}")), output);
+
+  std::vector<query::MemoryRowOutput::Row> expected = {
+    {"US", "100000"}
+  };
+  EXPECT_EQ(expected, output.rows());
+}
+
+TEST_F(InappEvents, LoadFromGzipTsv)
+{
+  auto table = db.GetTable("events");
+  std::string fname("InappEvents_LoadFromGzipTsv.tsv.gz");
+
+  // Two concatenated gzip members, large enough to span several read buffers:
+  for (auto mode : {"wb", "ab"}) {
+    gzFile out = gzopen(fname.c_str(), mode);
+    for (int i = 0; i < 50000; ++i) {
+      std::string line = "US\tpurchase\t" + std::to_string(20141112 + i % 100) + "\t1\n";
+      gzwrite(out, line.data(), line.size());
+    }
+    gzclose(out);
+  }
+
+  util::Config load_conf(
+    "{\"file\": \"" + fname + "\","
+    " \"type\": \"file\","
+    " \"format\": \"tsv\","
+    " \"table\": \"" + table->name() + "\"}");
+  db.Load(load_conf);
+  unlink(fname.c_str());
+
+  EXPECT_EQ(100, table->store()->segments()[0]->size());
+
+  query::MemoryRowOutput output;
+  db.Query(
+    std::move(util::Config(
+        "{\"type\": \"aggregate\","
+        " \"table\": \"events\","
+        " \"dimensions\": [\"country\"],"
+        " \"metrics\": [\"count\"],"
+        " \"filter\": {\"op\": \"ne\", \"column\": \"country\", \"value\": \"IL\"}}")), output);
+
+  std::vector<query::MemoryRowOutput::Row> expected = {
+    {"US", "100000"}
+  };
+  EXPECT_EQ(expected, output.rows());
+}
+
+
+/**
+ * Loads a compressed file, which consists of the given frames, and checks that all of them
+ * were read. The file is loaded again with its tail cut off, which must fail.
+ */
+static void load_compressed_events(db::Database& db, const std::string& fname,
+                                   const std::vector<std::string>& frames) {
+  std::string data;
+  for (auto& frame : frames) {
+    data.append(frame);
+  }
+  std::ofstream out(fname, std::ios::binary);
+  out.write(data.data(), data.size());
+  out.close();
+
+  util::Config load_conf(
+    "{\"file\": \"" + fname + "\","
+    " \"type\": \"file\","
+    " \"format\": \"tsv\","
+    " \"table\": \"events\"}");
+  db.Load(load_conf);
+
+  query::MemoryRowOutput output;
+  db.Query(
+    std::move(util::Config(
+        "{\"type\": \"aggregate\","
+        " \"table\": \"events\","
+        " \"dimensions\": [\"country\"],"
+        " \"metrics\": [\"count\"],"
+        " \"filter\": {\"op\": \"ne\", \"column\": \"country\", \"value\": \"IL\"}}")), output);
+
+  std::vector<query::MemoryRowOutput::Row> expected = {
+    {"US", std::to_string(50000 * frames.size())}
+  };
+  EXPECT_EQ(expected, output.rows());
+
+  out.open(fname, std::ios::binary | std::ios::trunc);
+  out.write(data.data(), data.size() - 100);
+  out.close();
+  EXPECT_THROW(db.Load(load_conf), std::runtime_error);
+  unlink(fname.c_str());
+}
+
+static std::string events_tsv() {
+  std::string tsv;
+  for (int i = 0; i < 50000; ++i) {
+    tsv += "US\tpurchase\t" + std::to_string(20141112 + i % 100) + "\t1\n";
+  }
+  return tsv;
+}
+
+#if HAVE_ZSTD
+TEST_F(InappEvents, LoadFromZstdTsv)
+{
+  std::vector<std::string> frames;
+  for (int i = 0; i < 2; ++i) {
+    auto tsv = events_tsv();
+    std::string frame(ZSTD_compressBound(tsv.size()), '\0');
+    size_t size = ZSTD_compress(&frame[0], frame.size(), tsv.data(), tsv.size(), 3);
+    ASSERT_FALSE(ZSTD_isError(size));
+    frame.resize(size);
+    frames.push_back(frame);
+  }
+  load_compressed_events(db, "InappEvents_LoadFromZstdTsv.tsv.zst", frames);
+}
+#endif
+
+#if HAVE_LZ4
+TEST_F(InappEvents, LoadFromLz4Tsv)
+{
+  std::vector<std::string> frames;
+  for (int i = 0; i < 2; ++i) {
+    auto tsv = events_tsv();
+    std::string frame(LZ4F_compressFrameBound(tsv.size(), nullptr), '\0');
+    size_t size = LZ4F_compressFrame(&frame[0], frame.size(), tsv.data(), tsv.size(), nullptr);
+    ASSERT_FALSE(LZ4F_isError(size));
+    frame.resize(size);
+    frames.push_back(frame);
+  }
+  load_compressed_events(db, "InappEvents_LoadFromLz4Tsv.tsv.lz4", frames);
+}
+#endif
+
+class BinaryWriter {
+  public:
+    BinaryWriter() {
+      buf_.append("VIYA\x01", 5);
+    }
+
+    void Header(const std::vector<std::pair<std::string, std::string>>& columns) {
+      viya::util::write_varint(buf_, columns.size());
+      for (auto& col : columns) {
+        viya::util::write_varint(buf_, col.first.size());
+        buf_.append(col.first);
+        buf_.push_back(col.second[0]);
+        buf_.push_back((char) std::stoi(col.second.substr(1)));
+      }
+    }
+
+    void Str(const std::string& value) {
+      viya::util::write_varint(buf_, value.size());
+      buf_.append(value);
+    }
+
+    template<typename T>
+    void Num(T value) {
+      buf_.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    void Write(const std::string& fname) {
+      std::ofstream out(fname, std::ios::binary);
+      out.write(buf_.data(), buf_.size());
+    }
+
+  private:
+    std::string buf_;
+};
+
+TEST_F(InappEvents, LoadFromBinary)
+{
+  auto table = db.GetTable("events");
+  std::string fname("InappEvents_LoadFromBinary.bin");
+
+  BinaryWriter writer;
+  writer.Header({{"revenue", "f8"}, {"event_name", "s0"}, {"index", "i4"},
+                 {"country", "s0"}, {"install_time", "u4"}});
+  writer.Num(0.1); writer.Str("purchase"); writer.Num((int32_t) 1); writer.Str("US"); writer.Num((uint32_t) 20141112);
+  writer.Num(1.1); writer.Str("purchase"); writer.Num((int32_t) 2); writer.Str("US"); writer.Num((uint32_t) 20141112);
+  writer.Num(0.3); writer.Str(""); writer.Num((int32_t) 3); writer.Str("US"); writer.Num((uint32_t) 20141112);
+  writer.Num(0.0); writer.Str("purchase"); writer.Num((int32_t) 5); writer.Str("IL"); writer.Num((uint32_t) 20141112);
+  writer.Write(fname);
+
+  util::Config load_conf(
+    "{\"file\": \"" + fname + "\","
+    " \"type\": \"file\","
+    " \"format\": \"binary\","
+    " \"table\": \"" + table->name() + "\"}");
+  db.Load(load_conf);
+  unlink(fname.c_str());
+
+  EXPECT_EQ(1, table->store()->segments().size());
+  EXPECT_EQ(3, table->store()->segments()[0]->size());
+
+  query::MemoryRowOutput output;
+  db.Query(
+    std::move(util::Config(
+        "{\"type\": \"aggregate\","
+        " \"table\": \"events\","
+        " \"dimensions\": [\"country\", \"install_time\"],"
+        " \"metrics\": [\"revenue\", \"count\"],"
+        " \"filter\": {\"op\": \"ne\", \"column\": \"country\", \"value\": \"IL\"}}")), output);
+
+  std::vector<query::MemoryRowOutput::Row> expected = {
+    {"US", "20141112", "1.5", "3"}
+  };
+  EXPECT_EQ(expected, output.rows());
+}
+
+TEST_F(InappEvents, LoadFromBinaryWrongType)
+{
+  auto table = db.GetTable("events");
+  std::string fname("InappEvents_LoadFromBinaryWrongType.bin");
+
+  BinaryWriter writer;
+  writer.Header({{"country", "s0"}, {"event_name", "s0"}, {"install_time", "u8"}, {"revenue", "f8"}});
+  writer.Write(fname);
+
+  util::Config load_conf(
+    "{\"file\": \"" + fname + "\","
+    " \"type\": \"file\","
+    " \"format\": \"binary\","
+    " \"table\": \"" + table->name() + "\"}");
+  EXPECT_THROW(db.Load(load_conf), std::invalid_argument);
+  unlink(fname.c_str());
+}
+
+TEST(Load, SameSchemaTables)
+{
+  auto table_conf = [](const std::string& name) {
+    return "{\"name\": \"" + name + "\","
+      " \"dimensions\": [{\"name\": \"country\"}, {\"name\": \"time\", \"type\": \"time\"}],"
+      " \"metrics\": [{\"name\": \"count\", \"type\": \"count\"},"
+      "               {\"name\": \"users\", \"type\": \"bitset\"}]}";
+  };
+  db::Database db(std::move(util::Config(
+          "{\"tables\": [" + table_conf("events1") + ", " + table_conf("events2") + "]}")));
+  auto libraries = db.compiler().stats().libraries;
+
+  db.CreateTable(util::Config(table_conf("events3")));
+  EXPECT_EQ(libraries, db.compiler().stats().libraries);
+
+  // Tables share the code, but not the upsert state:
+  db.GetTable("events1")->Load({{"US", "1415791501", "1"}, {"IL", "1415791501", "2"}});
+  db.GetTable("events2")->Load({{"US", "1415791501", "3"}});
+  db.GetTable("events1")->Load({{"US", "1415791501", "4"}});
+
+  for (auto& table : {"events1", "events2", "events3"}) {
+    query::MemoryRowOutput output;
+    db.Query(util::Config(
+        "{\"type\": \"aggregate\", \"table\": \"" + std::string(table) + "\","
+        " \"dimensions\": [\"country\"], \"metrics\": [\"count\", \"users\"],"
+        " \"filter\": {\"op\": \"gt\", \"column\": \"count\", \"value\": \"0\"}}"), output);
+    auto actual = output.rows();
+    std::sort(actual.begin(), actual.end());
+
+    std::vector<query::MemoryRowOutput::Row> expected;
+    if (table == std::string("events1")) {
+      expected = {{"IL", "1", "1"}, {"US", "2", "2"}};
+    } else if (table == std::string("events2")) {
+      expected = {{"US", "1", "1"}};
+    }
+    EXPECT_EQ(expected, actual) << table;
+  }
+}
@@ -0,0 +1,89 @@
+#include <algorithm>
+#include <cmath>
+#include "db/table.h"
+#include "util/config.h"
+#include "query/output.h"
+#include "db.h"
+#include "gtest/gtest.h"
+
+namespace util = viya::util;
+namespace query = viya::query;
+
+class SampledEvents : public testing::Test {
+  protected:
+    SampledEvents()
+      :db(std::move(util::Config(
+              "{\"tables\": [{\"name\": \"events\","
+              "               \"segment_size\": 100,"
+              "               \"dimensions\": [{\"name\": \"country\"},"
+              "                                {\"name\": \"user\", \"type\": \"numeric\"}],"
+              "               \"metrics\": [{\"name\": \"count\", \"type\": \"count\"},"
+              "                             {\"name\": \"revenue\", \"type\": \"double_sum\"},"
+              "                             {\"name\": \"level\", \"type\": \"int_max\"}]}]}"))) {}
+    db::Database db;
+
+    void Load() {
+      const char* countries[] = {"US", "IL", "RU"};
+      auto table = db.GetTable("events");
+      table->BeforeLoad();
+      for (int i = 0; i < 3000; ++i) {
+        std::vector<std::string> row = {countries[i % 3], std::to_string(i),
+                                        std::to_string(i % 10) + ".5", std::to_string(i % 7)};
+        table->Load(row);
+      }
+      table->AfterLoad();
+    }
+
+    std::vector<query::MemoryRowOutput::Row> Query(const std::string& sample, double* sample_ratio = nullptr) {
+      query::MemoryRowOutput output;
+      auto query_stats = db.Query(util::Config(
+          "{\"type\": \"aggregate\", \"table\": \"events\", " + sample +
+          " \"dimensions\": [\"country\"], \"metrics\": [\"count\", \"revenue\", \"level\"],"
+          " \"filter\": {\"op\": \"ne\", \"column\": \"country\", \"value\": \"RU\"}}"), output);
+      if (sample_ratio != nullptr) {
+        *sample_ratio = query_stats.sample_ratio;
+      }
+      auto rows = output.rows();
+      std::sort(rows.begin(), rows.end());
+      return rows;
+    }
+};
+
+TEST_F(SampledEvents, Estimates)
+{
+  Load();
+  auto exact = Query("");
+  ASSERT_EQ(2, exact.size());
+
+  double sample_ratio = 1.0;
+  auto sampled = Query("\"sample\": 0.3,", &sample_ratio);
+  EXPECT_GT(sample_ratio, 0.25);
+  EXPECT_LT(sample_ratio, 0.35);
+
+  // Standard errors of count and revenue are added after the selected columns:
+  ASSERT_EQ(2, sampled.size());
+  for (size_t i = 0; i < exact.size(); ++i) {
+    ASSERT_EQ(6, sampled[i].size());
+    EXPECT_EQ(exact[i][0], sampled[i][0]);
+    for (size_t col = 1; col <= 2; ++col) {
+      double exact_value = std::stod(exact[i][col]);
+      double estimate = std::stod(sampled[i][col]);
+      double error = std::stod(sampled[i][col + 3]);
+      EXPECT_GT(error, 0.0);
+      EXPECT_LT(error, exact_value * 0.2);
+      EXPECT_LE(std::abs(estimate - exact_value), 5 * error);
+    }
+  }
+
+  // The same data gives the same sample:
+  EXPECT_EQ(sampled, Query("\"sample\": 0.3,"));
+
+  // Whole table is scanned when sampling everything:
+  EXPECT_EQ(exact, Query("\"sample\": 1,"));
+}
+
+TEST_F(SampledEvents, InvalidSample)
+{
+  EXPECT_THROW(Query("\"sample\": 0,"), std::invalid_argument);
+  EXPECT_THROW(Query("\"sample\": 1.5,"), std::invalid_argument);
+}
@@ -120,3 +120,152 @@ TEST_F(InappEvents, LimitGreaterThanResult)
 
   EXPECT_EQ(expected, output.rows());
 }
+
+TEST_F(InappEvents, TopNWithSkip)
+{
+  auto table = db.GetTable("events");
+  sort_load_events(table);
+
+  query::MemoryRowOutput output;
+  db.Query(
+    std::move(util::Config(
+        "{\"type\": \"aggregate\","
+        " \"table\": \"events\","
+        " \"dimensions\": [\"country\", \"install_time\"],"
+        " \"metrics\": [\"revenue\"],"
+        " \"filter\": {\"op\": \"gt\", \"column\": \"count\", \"value\": \"0\"},"
+        " \"sort\": [{\"column\": \"install_time\"}, {\"column\": \"country\", \"ascending\": true}],"
+        " \"skip\": 1,"
+        " \"limit\": 3}")), output);
+
+  std::vector<query::MemoryRowOutput::Row> expected = {
+    {"RU", "20141112", "1"},
+    {"AZ", "20141111", "1.1"},
+    {"CH", "20141111", "1.1"}
+  };
+
+  EXPECT_EQ(expected, output.rows());
+}
+
+TEST_F(InappEvents, StringRangeFilter)
+{
+  auto table = db.GetTable("events");
+  sort_load_events(table);
+
+  auto query_countries = [this](const std::string& filter) {
+    query::MemoryRowOutput output;
+    db.Query(
+      std::move(util::Config(
+          "{\"type\": \"aggregate\","
+          " \"table\": \"events\","
+          " \"dimensions\": [\"country\"],"
+          " \"metrics\": [\"count\"],"
+          " \"filter\": " + filter + ","
+          " \"sort\": [{\"column\": \"country\", \"ascending\": false}]}")), output);
+    std::vector<std::string> countries;
+    for (auto& row : output.rows()) {
+      countries.push_back(row[0]);
+    }
+    return countries;
+  };
+
+  EXPECT_EQ(std::vector<std::string>({"IL", "CH"}), query_countries(
+      "{\"op\": \"and\", \"filters\": ["
+      "  {\"op\": \"ge\", \"column\": \"country\", \"value\": \"CH\"},"
+      "  {\"op\": \"lt\", \"column\": \"country\", \"value\": \"KZ\"}]}"));
+
+  // Bound values don't have to exist in the dictionary:
+  EXPECT_EQ(std::vector<std::string>({"IL", "CH", "AZ"}), query_countries(
+      "{\"op\": \"le\", \"column\": \"country\", \"value\": \"J\"}"));
+  EXPECT_EQ(std::vector<std::string>(), query_countries(
+      "{\"op\": \"gt\", \"column\": \"country\", \"value\": \"ZZ\"}"));
+
+  // New values are merged into the dictionary order:
+  table->Load({
+    {"BR", "purchase", "20141110", "0.1"},
+    {"ZA", "purchase", "20141110", "0.1"}
+  });
+  EXPECT_EQ(std::vector<std::string>({"ZA", "US", "RU", "KZ"}), query_countries(
+      "{\"op\": \"gt\", \"column\": \"country\", \"value\": \"JP\"}"));
+  EXPECT_EQ(std::vector<std::string>({"CH", "BR", "AZ"}), query_countries(
+      "{\"op\": \"lt\", \"column\": \"country\", \"value\": \"IL\"}"));
+}
+
+TEST_F(InappEvents, SortSharesCompiledCode)
+{
+  auto table = db.GetTable("events");
+  sort_load_events(table);
+
+  query::MemoryRowOutput output1;
+  db.Query(
+    std::move(util::Config(
+        "{\"type\": \"aggregate\","
+        " \"table\": \"events\","
+        " \"dimensions\": [\"event_name\", \"country\"],"
+        " \"metrics\": [\"revenue\"],"
+        " \"filter\": {\"op\": \"gt\", \"column\": \"count\", \"value\": \"0\"},"
+        " \"sort\": [{\"column\": \"revenue\", \"ascending\": false}],"
+        " \"limit\": 2}")), output1);
+
+  auto misses = db.compiler().stats().misses;
+
+  // Different selection order, sorting, paging and header don't require compilation:
+  query::MemoryRowOutput output2;
+  db.Query(
+    std::move(util::Config(
+        "{\"type\": \"aggregate\","
+        " \"table\": \"events\","
+        " \"select\": [{\"column\": \"revenue\"}, {\"column\": \"country\"}, {\"column\": \"event_name\"}],"
+        " \"filter\": {\"op\": \"gt\", \"column\": \"count\", \"value\": \"0\"},"
+        " \"sort\": [{\"column\": \"event_name\"}, {\"column\": \"country\", \"ascending\": true}],"
+        " \"header\": true, \"skip\": 1}")), output2);
+
+  EXPECT_EQ(misses, db.compiler().stats().misses);
+
+  std::vector<query::MemoryRowOutput::Row> expected1 = {
+    {"review", "KZ", "5"},
+    {"refund", "AZ", "1.1"}
+  };
+  EXPECT_EQ(expected1, output1.rows());
+
+  std::vector<query::MemoryRowOutput::Row> expected2 = {
+    {"revenue", "country", "event_name"},
+    {"1.1", "AZ", "refund"},
+    {"1.1", "CH", "refund"},
+    {"1.01", "IL", "refund"},
+    {"0.1", "US", "purchase"},
+    {"1", "RU", "donate"}
+  };
+  EXPECT_EQ(expected2, output2.rows());
+}
+
+TEST(Sort, FormattedTime)
+{
+  db::Database db(std::move(util::Config(
+          "{\"tables\": [{\"name\": \"events\","
+          "               \"dimensions\": [{\"name\": \"install_time\", \"type\": \"time\"}],"
+          "               \"metrics\": [{\"name\": \"count\", \"type\": \"count\"}]}]}")));
+  db.GetTable("events")->Load({
+    {"1421280000"},
+    {"1414886400"},
+    {"1417392000"}
+  });
+
+  query::MemoryRowOutput output;
+  db.Query(
+    std::move(util::Config(
+        "{\"type\": \"aggregate\","
+        " \"table\": \"events\","
+        " \"select\": [{\"column\": \"install_time\", \"format\": \"%d/%m/%Y\"},"
+        "              {\"column\": \"count\"}],"
+        " \"filter\": {\"op\": \"gt\", \"column\": \"count\", \"value\": \"0\"},"
+        " \"sort\": [{\"column\": \"install_time\", \"ascending\": true}]}")), output);
+
+  // Time is sorted chronologically, and not by its formatted value:
+  std::vector<query::MemoryRowOutput::Row> expected = {
+    {"02/11/2014", "1"},
+    {"01/12/2014", "1"},
+    {"15/01/2015", "1"}
+  };
+  EXPECT_EQ(expected, output.rows());
+}
@@ -0,0 +1,175 @@
+#include <algorithm>
+#include <json.hpp>
+#include "db/table.h"
+#include "util/config.h"
+#include "query/output.h"
+#include "db.h"
+#include "gtest/gtest.h"
+
+namespace util = viya::util;
+namespace query = viya::query;
+
+static std::string star_tree_table(const std::string& name, bool indexed,
+                                   const std::string& star_tree_options = "") {
+  return "{\"name\": \"" + name + "\","
+    "  \"segment_size\": 50,"
+    "  \"dimensions\": [{\"name\": \"country\"},"
+    "                   {\"name\": \"device\"},"
+    "                   {\"name\": \"app\"},"
+    "                   {\"name\": \"time\", \"type\": \"time\"},"
+    "                   {\"name\": \"user\", \"type\": \"numeric\"}],"
+    "  \"metrics\": [{\"name\": \"count\", \"type\": \"count\"},"
+    "                {\"name\": \"revenue\", \"type\": \"double_sum\"},"
+    "                {\"name\": \"level\", \"type\": \"int_max\"},"
+    "                {\"name\": \"users\", \"type\": \"bitset\"}]"
+    + (indexed ? ", \"star_tree\": {\"dimensions\": [\"country\", \"device\", \"app\", \"time\"],"
+                 "                 \"max_leaf_records\": 3" + star_tree_options + "}" : "")
+    + "}";
+}
+
+class StarTreeEvents : public testing::Test {
+  protected:
+    StarTreeEvents(const std::string& star_tree_options = "")
+      :db(std::move(util::Config(
+              "{\"tables\": [" + star_tree_table("indexed", true, star_tree_options) + ","
+              + star_tree_table("plain", false) + "]}"))) {}
+    db::Database db;
+
+    void Load(const std::vector<std::vector<std::string>>& rows) {
+      for (auto name : {"indexed", "plain"}) {
+        auto table = db.GetTable(name);
+        table->BeforeLoad();
+        for (auto row : rows) {
+          table->Load(row);
+        }
+        table->AfterLoad();
+        table->WaitStarTrees();
+      }
+    }
+
+    std::vector<std::string> Row(int i) {
+      const char* countries[] = {"US", "IL", "RU", "DE", "FR"};
+      const char* devices[] = {"ios", "android", "web"};
+      return {countries[(i * 7) % 5], devices[(i * 5) % 3], "app" + std::to_string((i * 3) % 7),
+              std::to_string(1500000000 + (i % 40) * 3 * 86400), std::to_string(i),
+              std::to_string(i % 10) + ".5", std::to_string(i % 13), std::to_string(i % 17)};
+    }
+
+    /**
+     * Runs the query on both tables, and checks that the results are the same
+     */
+    size_t Query(const std::string& query) {
+      std::vector<query::MemoryRowOutput::Row> results[2];
+      size_t star_tree_segments[2];
+      const char* tables[] = {"indexed", "plain"};
+      for (int i = 0; i < 2; ++i) {
+        query::MemoryRowOutput output;
+        auto stats = db.Query(util::Config(
+            "{\"type\": \"aggregate\", \"table\": \"" + std::string(tables[i]) + "\", " + query + "}"), output);
+        results[i] = output.rows();
+        std::sort(results[i].begin(), results[i].end());
+        star_tree_segments[i] = stats.star_tree_segments;
+      }
+      EXPECT_FALSE(results[1].empty());
+      EXPECT_EQ(results[1], results[0]);
+      EXPECT_EQ(0, star_tree_segments[1]);
+      return star_tree_segments[0];
+    }
+};
+
+TEST_F(StarTreeEvents, SameResults)
+{
+  std::vector<std::vector<std::string>> rows;
+  for (int i = 0; i < 230; ++i) {
+    rows.push_back(Row(i));
+  }
+  Load(rows);
+
+  // Only full segments are indexed:
+  EXPECT_EQ(4, Query(
+      "\"dimensions\": [\"country\"], \"metrics\": [\"count\", \"revenue\", \"level\", \"users\"],"
+      "\"filter\": {\"op\": \"ne\", \"column\": \"device\", \"value\": \"tv\"}"));
+  EXPECT_EQ(4, Query(
+      "\"select\": [{\"column\": \"count\"}, {\"column\": \"revenue\"}],"
+      "\"filter\": {\"op\": \"ge\", \"column\": \"time\", \"value\": \"1500100000\"}"));
+  EXPECT_EQ(4, Query(
+      "\"dimensions\": [\"device\"], \"metrics\": [\"count\", \"revenue\"],"
+      "\"filter\": {\"op\": \"in\", \"column\": \"app\", \"values\": [\"app1\", \"app3\"]}"));
+  EXPECT_EQ(4, Query(
+      "\"dimensions\": [\"country\", \"app\"], \"metrics\": [\"level\", \"users\"],"
+      "\"filter\": {\"op\": \"and\", \"filters\": ["
+      "  {\"op\": \"ne\", \"column\": \"device\", \"value\": \"web\"},"
+      "  {\"op\": \"not\", \"filter\": {\"op\": \"eq\", \"column\": \"country\", \"value\": \"US\"}}]}"));
+  EXPECT_EQ(4, Query(
+      "\"select\": [{\"column\": \"time\", \"granularity\": \"month\"}, {\"column\": \"revenue\"}],"
+      "\"filter\": {\"op\": \"or\", \"filters\": ["
+      "  {\"op\": \"gt\", \"column\": \"country\", \"value\": \"IL\"},"
+      "  {\"op\": \"eq\", \"column\": \"app\", \"value\": \"app5\"}]}"));
+
+  // Queries on other columns are answered by scanning segments:
+  EXPECT_EQ(0, Query(
+      "\"dimensions\": [\"user\"], \"metrics\": [\"count\"],"
+      "\"filter\": {\"op\": \"ne\", \"column\": \"device\", \"value\": \"tv\"}"));
+  EXPECT_EQ(0, Query(
+      "\"dimensions\": [\"country\"], \"metrics\": [\"count\"],"
+      "\"filter\": {\"op\": \"gt\", \"column\": \"level\", \"value\": \"5\"}"));
+}
+
+TEST_F(StarTreeEvents, RebuiltOnUpdate)
+{
+  std::vector<std::vector<std::string>> rows;
+  for (int i = 0; i < 100; ++i) {
+    rows.push_back(Row(i));
+  }
+  Load(rows);
+
+  std::string query =
+    "\"dimensions\": [\"country\", \"device\"], \"metrics\": [\"count\", \"revenue\"],"
+    "\"filter\": {\"op\": \"ne\", \"column\": \"app\", \"value\": \"app2\"}";
+  EXPECT_EQ(2, Query(query));
+
+  // Tuples of the first segment are updated in place:
+  Load({Row(3), Row(7)});
+  EXPECT_EQ(2, Query(query));
+}
+
+TEST_F(StarTreeEvents, Metadata)
+{
+  std::vector<std::vector<std::string>> rows;
+  for (int i = 0; i < 230; ++i) {
+    rows.push_back(Row(i));
+  }
+  Load(rows);
+
+  std::string output;
+  db.GetTable("indexed")->PrintMetadata(output);
+  auto meta = nlohmann::json::parse(output);
+  EXPECT_EQ(4, meta["star_tree"]["segments"].get<size_t>());
+  size_t memory_size = 0;
+  for (auto& segment : meta["segments"]) {
+    if (segment.find("star_tree") != segment.end()) {
+      memory_size += segment["star_tree"]["memory_size"].get<size_t>();
+    }
+  }
+  EXPECT_GT(memory_size, 0);
+  EXPECT_EQ(memory_size, meta["star_tree"]["memory_size"].get<size_t>());
+}
+
+class LimitedStarTreeEvents : public StarTreeEvents {
+  protected:
+    LimitedStarTreeEvents():StarTreeEvents(", \"max_memory_size\": 1") {}
+};
+
+TEST_F(LimitedStarTreeEvents, MemoryLimit)
+{
+  std::vector<std::vector<std::string>> rows;
+  for (int i = 0; i < 230; ++i) {
+    rows.push_back(Row(i));
+  }
+  Load(rows);
+
+  // Limit is checked before building a tree, so only the first one is built:
+  EXPECT_EQ(1, Query(
+      "\"dimensions\": [\"country\"], \"metrics\": [\"count\", \"revenue\"],"
+      "\"filter\": {\"op\": \"ne\", \"column\": \"device\", \"value\": \"tv\"}"));
+}
@@ -0,0 +1,158 @@
+#include <algorithm>
+#include "db/table.h"
+#include "util/config.h"
+#include "query/output.h"
+#include "db.h"
+#include "gtest/gtest.h"
+
+namespace util = viya::util;
+namespace query = viya::query;
+
+class ViewEvents : public testing::Test {
+  protected:
+    ViewEvents()
+      :db(std::move(util::Config(
+              "{\"tables\": [{\"name\": \"events\","
+              "               \"dimensions\": [{\"name\": \"country\"},"
+              "                                {\"name\": \"event_name\"},"
+              "                                {\"name\": \"install_time\", \"type\": \"time\"}],"
+              "               \"metrics\": [{\"name\": \"count\", \"type\": \"count\"},"
+              "                             {\"name\": \"revenue\", \"type\": \"double_sum\"},"
+              "                             {\"name\": \"level\", \"type\": \"int_max\"}],"
+              "               \"views\": [{\"name\": \"by_country\","
+              "                            \"dimensions\": [\"country\"],"
+              "                            \"metrics\": [\"count\", \"revenue\"]},"
+              "                           {\"name\": \"daily\","
+              "                            \"dimensions\": [\"install_time\", \"country\"],"
+              "                            \"metrics\": [\"revenue\", \"count\", \"level\"],"
+              "                            \"granularity\": \"day\"}]}]}"))) {}
+    db::Database db;
+
+    void Load() {
+      db.GetTable("events")->Load({
+        {"US", "purchase", "1415791501", "1.5", "3"},
+        {"US", "donate", "1415877901", "2.0", "5"},
+        {"IL", "purchase", "1415791600", "3.0", "1"},
+        {"IL", "purchase", "1418000000", "1.0", "2"},
+        {"RU", "install", "1418000000", "0", "1"}
+      });
+    }
+
+    std::vector<query::MemoryRowOutput::Row> Query(const std::string& query, std::string& table) {
+      query::MemoryRowOutput output;
+      auto stats = db.Query(util::Config(query), output);
+      table = stats.table_;
+      auto rows = output.rows();
+      std::sort(rows.begin(), rows.end());
+      return rows;
+    }
+};
+
+TEST_F(ViewEvents, LoadedWithTable)
+{
+  Load();
+  auto table = db.GetTable("events");
+  ASSERT_EQ(2, table->views().size());
+  EXPECT_EQ(5, table->size());
+  EXPECT_EQ(3, table->views()[0]->size());
+  EXPECT_EQ(5, table->views()[1]->size());
+}
+
+TEST_F(ViewEvents, QueryRouting)
+{
+  Load();
+  std::string table;
+
+  std::vector<query::MemoryRowOutput::Row> expected = {{"IL", "2", "4"}, {"RU", "1", "0"}, {"US", "2", "3.5"}};
+  EXPECT_EQ(expected, Query(
+      "{\"type\": \"aggregate\", \"table\": \"events\","
+      " \"dimensions\": [\"country\"], \"metrics\": [\"count\", \"revenue\"],"
+      " \"filter\": {\"op\": \"ne\", \"column\": \"country\", \"value\": \"DE\"}}", table));
+  EXPECT_EQ("events.by_country", table);
+
+  // Time dimension is truncated to days in the view, so coarser granularity can be requested:
+  expected = {{"1414800000", "IL", "1"}, {"1414800000", "US", "5"},
+              {"1417392000", "IL", "2"}, {"1417392000", "RU", "1"}};
+  EXPECT_EQ(expected, Query(
+      "{\"type\": \"aggregate\", \"table\": \"events\","
+      " \"select\": [{\"column\": \"install_time\", \"granularity\": \"month\"},"
+      "              {\"column\": \"country\"}, {\"column\": \"level\"}],"
+      " \"filter\": {\"op\": \"in\", \"column\": \"country\", \"values\": [\"US\", \"IL\", \"RU\"]}}", table));
+  EXPECT_EQ("events.daily", table);
+
+  // Original timestamps are only found in the table:
+  EXPECT_EQ(4, Query(
+      "{\"type\": \"aggregate\", \"table\": \"events\","
+      " \"dimensions\": [\"install_time\"], \"metrics\": [\"count\"],"
+      " \"filter\": {\"op\": \"ne\", \"column\": \"country\", \"value\": \"DE\"}}", table).size());
+  EXPECT_EQ("events", table);
+
+  EXPECT_EQ(3, Query(
+      "{\"type\": \"aggregate\", \"table\": \"events\","
+      " \"dimensions\": [\"country\"], \"metrics\": [\"count\"],"
+      " \"filter\": {\"op\": \"gt\", \"column\": \"install_time\", \"value\": \"1415791550\"}}", table).size());
+  EXPECT_EQ("events", table);
+
+  // Filtering aggregated tuples of a view by metric would give a different result:
+  expected = {{"IL", "1"}, {"US", "2"}};
+  EXPECT_EQ(expected, Query(
+      "{\"type\": \"aggregate\", \"table\": \"events\","
+      " \"dimensions\": [\"country\"], \"metrics\": [\"count\"],"
+      " \"filter\": {\"op\": \"ge\", \"column\": \"revenue\", \"value\": \"1.5\"}}", table));
+  EXPECT_EQ("events", table);
+
+  auto rows = Query(
+      "{\"type\": \"search\", \"table\": \"events\","
+      " \"dimension\": \"country\", \"term\": \"\", \"limit\": 10,"
+      " \"filter\": {\"op\": \"ne\", \"column\": \"country\", \"value\": \"US\"}}", table);
+  ASSERT_EQ(1, rows.size());
+  std::sort(rows[0].begin(), rows[0].end());
+  expected = {{"IL", "RU"}};
+  EXPECT_EQ(expected, rows);
+  EXPECT_EQ("events.by_country", table);
+}
+
+TEST(Views, RollupRules)
+{
+  setenv("VIYA_TEST_ROLLUP_TS", "1496570140L", 1);
+
+  db::Database db(std::move(util::Config(
+          "{\"tables\": [{\"name\": \"events\","
+          "               \"dimensions\": [{\"name\": \"country\"},"
+          "                                {\"name\": \"install_time\","
+          "                                 \"type\": \"time\","
+          "                                 \"rollup_rules\": ["
+          "                                   {\"granularity\": \"day\",   \"after\": \"1 weeks\"},"
+          "                                   {\"granularity\": \"month\", \"after\": \"1 years\"}"
+          "                                ]}],"
+          "               \"metrics\": [{\"name\": \"count\", \"type\": \"count\"}],"
+          "               \"views\": [{\"name\": \"hourly\","
+          "                            \"dimensions\": [\"install_time\", \"country\"],"
+          "                            \"metrics\": [\"count\"],"
+          "                            \"granularity\": \"hour\"}]}]}")));
+  db.GetTable("events")->Load({
+    {"US", "1461801600"},
+    {"US", "1461888000"}
+  });
+
+  auto query = [&db](const std::string& granularity, std::string& table) {
+    query::MemoryRowOutput output;
+    auto stats = db.Query(util::Config(
+        "{\"type\": \"aggregate\", \"table\": \"events\","
+        " \"select\": [{\"column\": \"install_time\", \"granularity\": \"" + granularity + "\"},"
+        "              {\"column\": \"count\"}],"
+        " \"filter\": {\"op\": \"eq\", \"column\": \"country\", \"value\": \"US\"}}"), output);
+    table = stats.table_;
+    return output.rows();
+  };
+  std::string table;
+
+  // Days older than a year are rolled up to months in the table, but not in the view:
+  std::vector<query::MemoryRowOutput::Row> expected = {{"1459468800", "2"}};
+  EXPECT_EQ(expected, query("day", table));
+  EXPECT_EQ("events", table);
+
+  // Rollup rules don't change values truncated to months:
+  EXPECT_EQ(expected, query("month", table));
+  EXPECT_EQ("events.hourly", table);
+}
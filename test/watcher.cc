@@ -0,0 +1,109 @@
+#include <chrono>
+#include <thread>
+#include <fstream>
+#include <cstdio>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include "util/config.h"
+#include "db/table.h"
+#include "db/database.h"
+#include "query/output.h"
+#include "gtest/gtest.h"
+
+namespace db = viya::db;
+namespace util = viya::util;
+namespace query = viya::query;
+
+static void write_file(const std::string& dir, const std::string& name, const std::string& content) {
+  std::string tmp_file = name + ".tmp";
+  std::ofstream out(tmp_file);
+  out<<content;
+  out.close();
+  // Watcher only picks up files that are moved into the directory:
+  std::rename(tmp_file.c_str(), (dir + "/" + name).c_str());
+}
+
+static std::vector<query::MemoryRowOutput::Row> count_rows(db::Database& db, const std::string& table) {
+  query::MemoryRowOutput output;
+  db.Query(
+    std::move(util::Config(
+        "{\"type\": \"aggregate\","
+        " \"table\": \"" + table + "\","
+        " \"dimensions\": [\"country\"],"
+        " \"metrics\": [\"count\"],"
+        " \"filter\": {\"op\": \"ne\", \"column\": \"country\", \"value\": \"IL\"}}")), output);
+  return output.rows();
+}
+
+TEST(Watcher, ConcurrentTables)
+{
+  mkdir("Watcher_ConcurrentTables_a", 0755);
+  mkdir("Watcher_ConcurrentTables_b", 0755);
+  {
+    db::Database db(std::move(util::Config(
+          "{\"ingest_threads\": 2,"
+          " \"tables\": [{\"name\": \"a\","
+          "               \"dimensions\": [{\"name\": \"country\"}],"
+          "               \"metrics\": [{\"name\": \"count\", \"type\": \"count\"}],"
+          "               \"watch\": {\"directory\": \"Watcher_ConcurrentTables_a\","
+          "                           \"concurrency\": 2, \"queue_size\": 1}},"
+          "              {\"name\": \"b\","
+          "               \"dimensions\": [{\"name\": \"country\"}, {\"name\": \"event_name\"}],"
+          "               \"metrics\": [{\"name\": \"count\", \"type\": \"count\"}],"
+          "               \"watch\": {\"directory\": \"Watcher_ConcurrentTables_b\"}}]}")));
+
+    // Queue size is smaller than the number of files, so some of them are held back at first:
+    for (auto name : {"1.tsv", "2.tsv", "3.tsv", "4.tsv"}) {
+      write_file("Watcher_ConcurrentTables_a", name, "US\nUS\n");
+    }
+    write_file("Watcher_ConcurrentTables_b", "1.tsv", "US\tpurchase\n");
+
+    std::vector<query::MemoryRowOutput::Row> expected_a = {{"US", "8"}};
+    std::vector<query::MemoryRowOutput::Row> expected_b = {{"US", "1"}};
+    for (int i = 0; i < 100; ++i) {
+      if (count_rows(db, "a") == expected_a && count_rows(db, "b") == expected_b) {
+        break;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    EXPECT_EQ(expected_a, count_rows(db, "a"));
+    EXPECT_EQ(expected_b, count_rows(db, "b"));
+  }
+  for (auto name : {"1.tsv", "2.tsv", "3.tsv", "4.tsv"}) {
+    unlink((std::string("Watcher_ConcurrentTables_a/") + name).c_str());
+  }
+  unlink("Watcher_ConcurrentTables_b/1.tsv");
+  rmdir("Watcher_ConcurrentTables_a");
+  rmdir("Watcher_ConcurrentTables_b");
+}
+
+TEST(Watcher, CompressedFiles)
+{
+  mkdir("Watcher_CompressedFiles", 0755);
+  {
+    db::Database db(std::move(util::Config(
+          "{\"tables\": [{\"name\": \"events\","
+          "               \"dimensions\": [{\"name\": \"country\"}],"
+          "               \"metrics\": [{\"name\": \"count\", \"type\": \"count\"}],"
+          "               \"watch\": {\"directory\": \"Watcher_CompressedFiles\"}}]}")));
+
+    // Compressed files are picked up with the default extensions:
+    gzFile out = gzopen("1.tsv.gz", "wb");
+    std::string content = "US\nUS\n";
+    gzwrite(out, content.data(), content.size());
+    gzclose(out);
+    std::rename("1.tsv.gz", "Watcher_CompressedFiles/1.tsv.gz");
+
+    std::vector<query::MemoryRowOutput::Row> expected = {{"US", "2"}};
+    for (int i = 0; i < 100; ++i) {
+      if (count_rows(db, "events") == expected) {
+        break;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    EXPECT_EQ(expected, count_rows(db, "events"));
+  }
+  unlink("Watcher_CompressedFiles/1.tsv.gz");
+  rmdir("Watcher_CompressedFiles");
+}